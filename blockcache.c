@@ -0,0 +1,524 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "types.h"
+#include "utils.h"
+#include "riscv.h"
+#include "blockcache.h"
+#include "memory.h"
+#include "jit.h"
+
+// Hash table of translated blocks, keyed on start PC
+static bb_block_t* bb_table[1 << BB_HASH_BITS];
+
+bb_range_t bb_code_range = { 0xFFFFFFFF, 0 };
+
+// Hot blocks are compiled to host code when set
+static bool bb_jit_enabled = false;
+
+static inline unsigned bb_hash(Address pc)
+{
+  return (pc >> 2) & ((1U << BB_HASH_BITS) - 1);
+}
+
+static inline bool bb_hits_code(Address address, Alignment alignment)
+{
+  return (address < bb_code_range.hi) && (address + alignment > bb_code_range.lo);
+}
+
+/**
+ * Fills one record for the instruction at pc. Anything that is not a plain
+ * RV32I/M op we can do inline (including every encoding execute_instruction()
+ * rejects) becomes BB_FALLBACK so the interpreter reproduces its behaviour.
+ **/
+static void bb_decode(Instruction instruction, Address pc, bb_op_t* op)
+{
+  unsigned int funct7 = (instruction.itype.imm >> 5) & 0x7F;
+
+  op->kind = BB_FALLBACK;
+  op->bits = instruction.bits;
+  op->rd   = instruction.rtype.rd;
+  op->rs1  = instruction.rtype.rs1;
+  op->rs2  = instruction.rtype.rs2;
+  op->imm  = 0;
+
+  switch (instruction.opcode) {
+    case 0x33:  //R-type
+      if (instruction.rtype.funct7 == 0x01) {
+        op->kind = BB_MUL + instruction.rtype.funct3;
+        break;
+      }
+      switch (instruction.rtype.funct3) {
+        case 0x0:
+          if (instruction.rtype.funct7 == 0x00) op->kind = BB_ADD;
+          else if (instruction.rtype.funct7 == 0x20) op->kind = BB_SUB;
+          break;
+        case 0x1:
+          if (instruction.rtype.funct7 == 0x00) op->kind = BB_SLL;
+          break;
+        case 0x2:
+          if (instruction.rtype.funct7 == 0x00) op->kind = BB_SLT;
+          break;
+        case 0x4:
+          if (instruction.rtype.funct7 == 0x00) op->kind = BB_XOR;
+          break;
+        case 0x5:
+          if (instruction.rtype.funct7 == 0x00) op->kind = BB_SRL;
+          else if (instruction.rtype.funct7 == 0x20) op->kind = BB_SRA;
+          break;
+        case 0x6:
+          if (instruction.rtype.funct7 == 0x00) op->kind = BB_OR;
+          break;
+        case 0x7:
+          if (instruction.rtype.funct7 == 0x00) op->kind = BB_AND;
+          break;
+        default:
+          break;
+      }
+      break;
+    case 0x13:  //I-type, except load
+      op->imm = sign_extend_number(instruction.itype.imm, 12);
+      switch (instruction.itype.funct3) {
+        case 0x0: op->kind = BB_ADDI; break;
+        case 0x2: op->kind = BB_SLTI; break;
+        case 0x4: op->kind = BB_XORI; break;
+        case 0x6: op->kind = BB_ORI;  break;
+        case 0x7: op->kind = BB_ANDI; break;
+        case 0x1:
+          op->imm = instruction.itype.imm & 0x1F;
+          if (funct7 == 0x00) op->kind = BB_SLLI;
+          break;
+        case 0x5:
+          op->imm = instruction.itype.imm & 0x1F;
+          if (funct7 == 0x00) op->kind = BB_SRLI;
+          else if (funct7 == 0x20) op->kind = BB_SRAI;
+          break;
+        default:
+          break;
+      }
+      break;
+    case 0x03:  //Load
+      op->imm = sign_extend_number(instruction.itype.imm, 12);
+      // loads into x0 stay in the interpreter so x0 is never written here
+      if (op->rd != 0) {
+        switch (instruction.itype.funct3) {
+          case 0x0: op->kind = BB_LB; break;
+          case 0x1: op->kind = BB_LH; break;
+          case 0x2: op->kind = BB_LW; break;
+          default: break;
+        }
+      }
+      break;
+    case 0x23:  //S-type
+      op->imm = get_store_offset(instruction);
+      switch (instruction.stype.funct3) {
+        case 0x0: op->kind = BB_SB; break;
+        case 0x1: op->kind = BB_SH; break;
+        case 0x2: op->kind = BB_SW; break;
+        default: break;
+      }
+      break;
+    case 0x37:  //U-type
+      op->kind = BB_LUI;
+      op->imm = (sWord)(instruction.utype.imm << 12);
+      break;
+    case 0x17:  //AUIPC, the PC is known here so it is a constant like lui
+      op->kind = BB_LUI;
+      op->imm = pc + (instruction.utype.imm << 12);
+      break;
+    case 0x63:  //SB-type
+      op->imm = pc + get_branch_offset(instruction);
+      switch (instruction.sbtype.funct3) {
+        case 0x0: op->kind = BB_BEQ;  break;
+        case 0x1: op->kind = BB_BNE;  break;
+        case 0x4: op->kind = BB_BLT;  break;
+        case 0x5: op->kind = BB_BGE;  break;
+        case 0x6: op->kind = BB_BLTU; break;
+        case 0x7: op->kind = BB_BGEU; break;
+        default: break;
+      }
+      break;
+    case 0x6F:  //UJ-type
+      op->kind = BB_JAL;
+      op->imm = pc + get_jump_offset(instruction);
+      break;
+    case 0x67:  //JALR
+      if (instruction.itype.funct3 == 0x0) op->kind = BB_JALR;
+      op->imm = sign_extend_number(instruction.itype.imm, 12);
+      break;
+    case 0x73:  //Ecall, CSR accesses are left to the interpreter
+      if (instruction.itype.funct3 == 0x0) op->kind = BB_ECALL;
+      break;
+    default:
+      break;
+  }
+
+  // ALU results written to x0 are discarded anyway
+  if (op->rd == 0 && op->kind < BB_LB) {
+    op->kind = BB_NOP;
+  }
+  if (op->rd == 0 && op->kind == BB_LUI) {
+    op->kind = BB_NOP;
+  }
+}
+
+static bb_block_t* bb_translate(Address pc, Byte* memory_p, const void* const* labels)
+{
+  bb_op_t ops[BB_MAX_INSNS + 1];
+  uint32_t n = 0;
+  bool fallthru = false;
+
+  while (1) {
+    if (n == BB_MAX_INSNS) {
+      // block got too long, finish it with an explicit fall-through
+      memset(&ops[n], 0, sizeof(bb_op_t));
+      ops[n].kind = BB_FALLTHRU;
+      fallthru = true;
+      break;
+    }
+
+    Address insn_pc = pc + 4 * n;
+    if (n > 0 && (insn_pc & (GUEST_PAGE_SIZE - 1)) == 0 && !mem_allowed(insn_pc, MEM_PERM_R)) {
+      // don't read ahead into a page the program may never reach
+      memset(&ops[n], 0, sizeof(bb_op_t));
+      ops[n].kind = BB_FALLTHRU;
+      fallthru = true;
+      break;
+    }
+
+    Instruction instruction;
+    mem_fault_pc = insn_pc;
+    instruction.bits = load(memory_p, insn_pc, LENGTH_WORD);
+    bb_decode(instruction, insn_pc, &ops[n]);
+    n++;
+
+    if (ops[n - 1].kind >= BB_BEQ) {
+      break;
+    }
+  }
+
+  uint32_t nops = fallthru ? n + 1 : n;
+  bb_block_t* blk = malloc(sizeof(bb_block_t) + nops * sizeof(bb_op_t));
+  if (blk == NULL) {
+    printf("Error: Unable to allocate translated block at 0x%08x\n", pc);
+    exit(-1);
+  }
+
+  blk->start = pc;
+  blk->ninsns = n;
+  blk->exec_count = 0;
+  blk->jit = NULL;
+  blk->jit_tried = false;
+  blk->succ[0] = NULL;
+  blk->succ[1] = NULL;
+  for (uint32_t i = 0; i < nops; i++) {
+    blk->ops[i] = ops[i];
+    blk->ops[i].handler = labels[ops[i].kind];
+  }
+
+  if (pc < bb_code_range.lo) bb_code_range.lo = pc;
+  if (pc + 4 * n > bb_code_range.hi) bb_code_range.hi = pc + 4 * n;
+
+  return blk;
+}
+
+static bb_block_t* bb_lookup(Address pc, Byte* memory_p, const void* const* labels)
+{
+  unsigned h = bb_hash(pc);
+  bb_block_t* blk;
+
+  for (blk = bb_table[h]; blk != NULL; blk = blk->next) {
+    if (blk->start == pc) {
+      return blk;
+    }
+  }
+
+  blk = bb_translate(pc, memory_p, labels);
+  blk->next = bb_table[h];
+  bb_table[h] = blk;
+  return blk;
+}
+
+void bb_flush(void)
+{
+  for (unsigned h = 0; h < (1U << BB_HASH_BITS); h++) {
+    bb_block_t* blk = bb_table[h];
+    while (blk != NULL) {
+      bb_block_t* next = blk->next;
+      free(blk);
+      blk = next;
+    }
+    bb_table[h] = NULL;
+  }
+  bb_code_range.lo = 0xFFFFFFFF;
+  bb_code_range.hi = 0;
+  jit_reset();
+}
+
+void bb_set_jit(bool enable)
+{
+  bb_jit_enabled = enable && jit_available();
+}
+
+/**
+ * Executes a single instruction through the interpreter.
+ * Returns false (without executing) when it is the exit ecall.
+ **/
+static bool bb_step(regfile_t* regfile_p, Byte* memory_p)
+{
+  Instruction instruction;
+  mem_fault_pc = regfile_p->PC;
+  instruction.bits = load(memory_p, regfile_p->PC, LENGTH_WORD);
+
+  if (instruction.opcode == 0x73 && instruction.itype.funct3 == 0x0 && regfile_p->R[10] == 10) {
+    return false;
+  }
+
+  bool code_store = false;
+  if (instruction.opcode == 0x23) {
+    Address address = regfile_p->R[instruction.stype.rs1] + get_store_offset(instruction);
+    code_store = bb_hits_code(address, LENGTH_WORD);
+  }
+
+  execute_instruction(instruction.bits, regfile_p, memory_p);
+  regfile_p->R[0] = 0;
+
+  if (code_store) {
+    bb_flush();
+  }
+  return true;
+}
+
+uint64_t bb_run(regfile_t* regfile_p, Byte* memory_p, uint64_t max_insns, bool* halted)
+{
+  static const void* const labels[BB_OP_COUNT] = {
+    [BB_ADD]  = &&do_add,  [BB_SUB]  = &&do_sub,  [BB_SLL]  = &&do_sll,
+    [BB_SLT]  = &&do_slt,  [BB_XOR]  = &&do_xor,  [BB_SRL]  = &&do_srl,
+    [BB_SRA]  = &&do_sra,  [BB_OR]   = &&do_or,   [BB_AND]  = &&do_and,
+    [BB_MUL]  = &&do_mul,  [BB_MULH] = &&do_mulh,
+    [BB_MULHSU] = &&do_mulhsu, [BB_MULHU] = &&do_mulhu,
+    [BB_DIV]  = &&do_div,  [BB_DIVU] = &&do_divu,
+    [BB_REM]  = &&do_rem,  [BB_REMU] = &&do_remu,
+    [BB_ADDI] = &&do_addi, [BB_SLLI] = &&do_slli, [BB_SLTI] = &&do_slti,
+    [BB_XORI] = &&do_xori, [BB_SRLI] = &&do_srli, [BB_SRAI] = &&do_srai,
+    [BB_ORI]  = &&do_ori,  [BB_ANDI] = &&do_andi,
+    [BB_LB]   = &&do_lb,   [BB_LH]   = &&do_lh,   [BB_LW]   = &&do_lw,
+    [BB_SB]   = &&do_sb,   [BB_SH]   = &&do_sh,   [BB_SW]   = &&do_sw,
+    [BB_LUI]  = &&do_lui,  [BB_NOP]  = &&do_nop,
+    [BB_BEQ]  = &&do_beq,  [BB_BNE]  = &&do_bne,
+    [BB_BLT]  = &&do_blt,  [BB_BGE]  = &&do_bge,
+    [BB_BLTU] = &&do_bltu, [BB_BGEU] = &&do_bgeu,
+    [BB_JAL]  = &&do_jal,  [BB_JALR] = &&do_jalr,
+    [BB_ECALL] = &&do_ecall, [BB_FALLBACK] = &&do_fallback,
+    [BB_FALLTHRU] = &&do_fallthru,
+  };
+
+  Register* R = regfile_p->R;
+  uint64_t executed = 0;
+  uint64_t retired_base = emu_retired_counter;  // instret for CSR reads
+  bb_block_t* blk = NULL;
+  const bb_op_t* op;
+  Address next_pc;
+  int taken;
+
+  *halted = false;
+
+  while (executed < max_insns) {
+    if (blk == NULL) {
+      blk = bb_lookup(regfile_p->PC, memory_p, labels);
+    }
+
+    // Not enough budget left for the whole block, single-step instead
+    if (blk->ninsns > max_insns - executed) {
+      emu_retired_counter = retired_base + executed;
+      if (!bb_step(regfile_p, memory_p)) {
+        *halted = true;
+        return executed;
+      }
+      executed++;
+      blk = NULL;
+      continue;
+    }
+
+    blk->exec_count++;
+
+    if (bb_jit_enabled) {
+      if (!blk->jit_tried && blk->exec_count >= BB_JIT_HOT) {
+        blk->jit = jit_compile(blk);
+        blk->jit_tried = true;
+      }
+      if (blk->jit != NULL) {
+        uint32_t retired = 0;
+        Address pc = ((jit_fn_t)blk->jit)(R, memory_p, &retired);
+        // retired == 0 means the first op wants the interpreter (e.g. a
+        // store into translated code), so run this block the slow way
+        if (retired != 0) {
+          executed += retired;
+          regfile_p->PC = pc;
+          taken = (pc != blk->start + 4 * blk->ninsns);
+          goto chain_pc;
+        }
+      }
+    }
+
+    op = blk->ops;
+    goto *op->handler;
+
+#define BB_NEXT()  goto *(++op)->handler
+#define BB_OP_PC() (blk->start + 4 * (Address)(op - blk->ops))
+#define BB_STORE(alignment)                                                \
+    {                                                                      \
+      Address address = R[op->rs1] + op->imm;                              \
+      mem_fault_pc = BB_OP_PC();                                           \
+      store(memory_p, address, alignment, R[op->rs2]);                     \
+      if (bb_hits_code(address, alignment)) {                              \
+        /* self-modifying code: retire up to here and retranslate */       \
+        executed += (op - blk->ops) + 1;                                   \
+        regfile_p->PC = BB_OP_PC() + 4;                                    \
+        bb_flush();                                                        \
+        blk = NULL;                                                        \
+        continue;                                                          \
+      }                                                                    \
+    }                                                                      \
+    BB_NEXT();
+
+  do_add:  R[op->rd] = R[op->rs1] + R[op->rs2]; BB_NEXT();
+  do_sub:  R[op->rd] = R[op->rs1] - R[op->rs2]; BB_NEXT();
+  do_sll:  R[op->rd] = R[op->rs1] << (R[op->rs2] & 0x1F); BB_NEXT();
+  do_slt:  R[op->rd] = ((sWord)R[op->rs1] < (sWord)R[op->rs2]) ? 1 : 0; BB_NEXT();
+  do_xor:  R[op->rd] = R[op->rs1] ^ R[op->rs2]; BB_NEXT();
+  do_srl:  R[op->rd] = R[op->rs1] >> (R[op->rs2] & 0x1F); BB_NEXT();
+  do_sra:  R[op->rd] = (sWord)R[op->rs1] >> (R[op->rs2] & 0x1F); BB_NEXT();
+  do_or:   R[op->rd] = R[op->rs1] | R[op->rs2]; BB_NEXT();
+  do_and:  R[op->rd] = R[op->rs1] & R[op->rs2]; BB_NEXT();
+  do_mul:  R[op->rd] = R[op->rs1] * R[op->rs2]; BB_NEXT();
+  do_mulh:
+    R[op->rd] = ((sDouble)(sWord)R[op->rs1] * (sDouble)(sWord)R[op->rs2]) >> 32;
+    BB_NEXT();
+  do_mulhsu: R[op->rd] = muldiv_result(0x2, R[op->rs1], R[op->rs2]); BB_NEXT();
+  do_mulhu:  R[op->rd] = muldiv_result(0x3, R[op->rs1], R[op->rs2]); BB_NEXT();
+  do_div:    R[op->rd] = muldiv_result(0x4, R[op->rs1], R[op->rs2]); BB_NEXT();
+  do_divu:   R[op->rd] = muldiv_result(0x5, R[op->rs1], R[op->rs2]); BB_NEXT();
+  do_rem:    R[op->rd] = muldiv_result(0x6, R[op->rs1], R[op->rs2]); BB_NEXT();
+  do_remu:   R[op->rd] = muldiv_result(0x7, R[op->rs1], R[op->rs2]); BB_NEXT();
+
+  do_addi: R[op->rd] = R[op->rs1] + op->imm; BB_NEXT();
+  do_slli: R[op->rd] = R[op->rs1] << op->imm; BB_NEXT();
+  do_slti: R[op->rd] = ((sWord)R[op->rs1] < op->imm) ? 1 : 0; BB_NEXT();
+  do_xori: R[op->rd] = R[op->rs1] ^ op->imm; BB_NEXT();
+  do_srli: R[op->rd] = R[op->rs1] >> op->imm; BB_NEXT();
+  do_srai: R[op->rd] = (sWord)R[op->rs1] >> op->imm; BB_NEXT();
+  do_ori:  R[op->rd] = R[op->rs1] | op->imm; BB_NEXT();
+  do_andi: R[op->rd] = R[op->rs1] & op->imm; BB_NEXT();
+
+  do_lb:
+    mem_fault_pc = BB_OP_PC();
+    R[op->rd] = sign_extend_number(load(memory_p, R[op->rs1] + op->imm, LENGTH_BYTE), 8);
+    BB_NEXT();
+  do_lh:
+    mem_fault_pc = BB_OP_PC();
+    R[op->rd] = sign_extend_number(load(memory_p, R[op->rs1] + op->imm, LENGTH_HALF_WORD), 16);
+    BB_NEXT();
+  do_lw:
+    mem_fault_pc = BB_OP_PC();
+    R[op->rd] = load(memory_p, R[op->rs1] + op->imm, LENGTH_WORD);
+    BB_NEXT();
+
+  do_sb: BB_STORE(LENGTH_BYTE)
+  do_sh: BB_STORE(LENGTH_HALF_WORD)
+  do_sw: BB_STORE(LENGTH_WORD)
+
+  do_lui: R[op->rd] = op->imm; BB_NEXT();
+  do_nop: BB_NEXT();
+
+  do_beq:
+    taken = (R[op->rs1] == R[op->rs2]);
+    next_pc = taken ? (Address)op->imm : BB_OP_PC() + 4;
+    goto chain;
+  do_bne:
+    taken = (R[op->rs1] != R[op->rs2]);
+    next_pc = taken ? (Address)op->imm : BB_OP_PC() + 4;
+    goto chain;
+  do_blt:
+    taken = ((sWord)R[op->rs1] < (sWord)R[op->rs2]);
+    next_pc = taken ? (Address)op->imm : BB_OP_PC() + 4;
+    goto chain;
+  do_bge:
+    taken = ((sWord)R[op->rs1] >= (sWord)R[op->rs2]);
+    next_pc = taken ? (Address)op->imm : BB_OP_PC() + 4;
+    goto chain;
+  do_bltu:
+    taken = (R[op->rs1] < R[op->rs2]);
+    next_pc = taken ? (Address)op->imm : BB_OP_PC() + 4;
+    goto chain;
+  do_bgeu:
+    taken = (R[op->rs1] >= R[op->rs2]);
+    next_pc = taken ? (Address)op->imm : BB_OP_PC() + 4;
+    goto chain;
+  do_jal:
+    if (op->rd != 0) {
+      R[op->rd] = BB_OP_PC() + 4;
+    }
+    taken = 1;
+    next_pc = op->imm;
+    goto chain;
+  do_jalr:
+    // the target varies, the taken link just caches the last one
+    next_pc = (R[op->rs1] + op->imm) & ~1U;
+    if (op->rd != 0) {
+      R[op->rd] = BB_OP_PC() + 4;
+    }
+    taken = 1;
+    goto chain;
+  do_fallthru:
+    taken = 0;
+    next_pc = BB_OP_PC();
+    goto chain;
+
+  do_ecall:
+    executed += blk->ninsns - 1;
+    regfile_p->PC = BB_OP_PC();
+    if (R[10] == 10) {
+      emu_retired_counter = retired_base + executed;
+      *halted = true;
+      return executed;
+    }
+    mem_fault_pc = regfile_p->PC;
+    execute_instruction(op->bits, regfile_p, memory_p);
+    executed++;
+    taken = 0;
+    goto chain_pc;
+
+  do_fallback:
+    executed += blk->ninsns - 1;
+    regfile_p->PC = BB_OP_PC();
+    emu_retired_counter = retired_base + executed;
+    mem_fault_pc = regfile_p->PC;
+    execute_instruction(op->bits, regfile_p, memory_p);
+    R[0] = 0;
+    executed++;
+    taken = 0;
+    goto chain_pc;
+
+  chain:
+    executed += blk->ninsns;
+    regfile_p->PC = next_pc;
+  chain_pc:
+    {
+      // follow (or create) the direct link to the successor block
+      bb_block_t* succ = blk->succ[taken];
+      if (succ == NULL || succ->start != regfile_p->PC) {
+        succ = bb_lookup(regfile_p->PC, memory_p, labels);
+        blk->succ[taken] = succ;
+      }
+      blk = succ;
+    }
+
+#undef BB_NEXT
+#undef BB_OP_PC
+#undef BB_STORE
+  }
+
+  emu_retired_counter = retired_base + executed;
+  return executed;
+}
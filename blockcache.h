@@ -0,0 +1,88 @@
+#ifndef __BLOCKCACHE_H__
+#define __BLOCKCACHE_H__
+
+#include <stdbool.h>
+#include "types.h"
+
+///////////////////////////////////////////////////////////////////////////////
+/// Basic-block translation cache for the functional emulator
+///////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Straight-line code is translated once into an array of handler/operand
+ * records and dispatched with computed goto. A block ends at a branch, jump or ecall
+ * (or at any instruction the translator does not handle, which is handed back
+ * to execute_instruction() so behaviour stays identical to the interpreter).
+ * Blocks are chained directly to their successors after the first lookup.
+ */
+
+#define BB_MAX_INSNS  64    // longest block we translate
+#define BB_HASH_BITS  12    // lookup table has 2^BB_HASH_BITS buckets
+#define BB_JIT_HOT    50    // executions before a block is handed to the JIT
+
+typedef enum
+{
+  BB_ADD, BB_SUB, BB_SLL, BB_SLT, BB_XOR, BB_SRL, BB_SRA, BB_OR, BB_AND,
+  BB_MUL, BB_MULH, BB_MULHSU, BB_MULHU, BB_DIV, BB_DIVU, BB_REM, BB_REMU,  // funct3 order
+  BB_ADDI, BB_SLLI, BB_SLTI, BB_XORI, BB_SRLI, BB_SRAI, BB_ORI, BB_ANDI,
+  BB_LB, BB_LH, BB_LW,
+  BB_SB, BB_SH, BB_SW,
+  BB_LUI,
+  BB_NOP,
+  // block terminators
+  BB_BEQ, BB_BNE, BB_BLT, BB_BGE, BB_BLTU, BB_BGEU, BB_JAL, BB_JALR,
+  BB_ECALL, BB_FALLBACK, BB_FALLTHRU,
+  BB_OP_COUNT
+}bb_kind_t;
+
+typedef struct
+{
+  const void* handler;  // label in bb_run() for this record
+  uint8_t     kind;     // bb_kind_t
+  uint8_t     rd;
+  uint8_t     rs1;
+  uint8_t     rs2;
+  int32_t     imm;      // immediate, or absolute target for branches/jal
+  uint32_t    bits;     // raw instruction for the interpreter fallback
+}bb_op_t;
+
+typedef struct bb_block
+{
+  Address           start;
+  uint32_t          ninsns;
+  uint64_t          exec_count;
+  void*             jit;      // host code from jit_compile(), if any
+  bool              jit_tried;
+  struct bb_block*  succ[2];  // chained successors: [0] not taken, [1] taken
+  struct bb_block*  next;     // hash bucket chain
+  bb_op_t           ops[];    // ninsns records, the last one is a terminator
+}bb_block_t;
+
+// Address range covered by translated code, used to catch self-modifying stores
+typedef struct
+{
+  Address lo;
+  Address hi;
+}bb_range_t;
+
+extern bb_range_t bb_code_range;
+
+/**
+ * Run at most max_insns instructions starting at regfile_p->PC.
+ * Returns the number of instructions executed. If the program reaches an
+ * exit ecall (a0 == 10) it is *not* executed; *halted is set and the PC is
+ * left pointing at it so the caller can decide what to do.
+ **/
+uint64_t bb_run(regfile_t* regfile_p, Byte* memory_p, uint64_t max_insns, bool* halted);
+
+/**
+ * Drop every translated block (e.g. after new code was loaded).
+ **/
+void bb_flush(void);
+
+/**
+ * Turns the JIT tier (jit.c) on or off for subsequent bb_run() calls.
+ **/
+void bb_set_jit(bool enable);
+
+#endif  // __BLOCKCACHE_H__
@@ -10,50 +10,102 @@
 #include <unistd.h>
 #include <stdio.h>
 #include "config.h"
+#include "heatmap.h"
+#include "utils.h"
 
 // HELPER FUNCTIONS USEFUL FOR IMPLEMENTING THE CACHE
 
 unsigned long long address_to_block(const unsigned long long address, const Cache *cache) {
     /*YOUR CODE HERE*/
-    /*
     int byte_offset = cache->blockBits;
     return ( (address >> byte_offset) << byte_offset);
-    */
-    return ( (address >> CACHE_BLOCK_BITS) << CACHE_BLOCK_BITS);
 }
 
 unsigned long long cache_tag(const unsigned long long address, const Cache *cache) {
     /*YOUR CODE HERE*/
-    /*
+    if (cache->indexFn != CACHE_INDEX_MOD) {
+        // a hashed index doesn't give the index bits back, keep the whole block number
+        return address >> cache->blockBits;
+    }
     // Cache tag is in the MSBs of the address
     return address >> (cache->setBits + cache->blockBits);
-    */
-    return address >> (CACHE_SET_BITS + CACHE_BLOCK_BITS);
+}
+
+// the set of the block at address in the given way of a skewed cache
+static unsigned long long cache_skew_set(const unsigned long long address, const int way, const Cache *cache) {
+    if (cache->setBits == 0) {
+        return 0;
+    }
+    // a different odd multiplier per way, so blocks that collide in one way rarely do in another
+    unsigned long long multiplier = CACHE_SAMPLE_HASH + 2ULL * way * CACHE_SKEW_STEP;
+    return ((address >> cache->blockBits) * multiplier) >> (64 - cache->setBits);
 }
 
 unsigned long long cache_set(const unsigned long long address, const Cache *cache) {
     /*YOUR CODE HERE*/
-    /*
-    // Set index is in between the tag and offset bits
-    return (address >> cache->blockBits) & ((1U << cache->setBits) - 1); 
-    */
-    return (address >> CACHE_BLOCK_BITS) & ((1U << CACHE_SET_BITS) - 1); 
+    unsigned long long block = address >> cache->blockBits;
+    unsigned long long mask = (1ULL << cache->setBits) - 1;
+
+    switch (cache->indexFn) {
+    case CACHE_INDEX_XOR: {
+        // fold every bit above the offset onto the index
+        unsigned long long set = 0;
+        if (cache->setBits == 0) {
+            return 0;
+        }
+        for (; block != 0; block >>= cache->setBits) {
+            set ^= block & mask;
+        }
+        return set;
+    }
+    case CACHE_INDEX_PRIME:
+        return block % cache->primeSets;
+    case CACHE_INDEX_SKEW:
+        // way 0's set, where the set counters are kept
+        return cache_skew_set(address, 0, cache);
+    default:
+        // Set index is in between the tag and offset bits
+        return block & mask;
+    }
+}
 
+Set *cache_set_ptr(const unsigned long long set_index, const Cache *cache) {
+    if (cache->sampleBits == 0) {
+        return &cache->sets[set_index];
+    }
+    // an odd multiplier permutes the set numbers, the low ones are modeled
+    unsigned long long slot = (set_index * CACHE_SAMPLE_HASH) & ((1ULL << cache->setBits) - 1);
+    if (slot >= (1ULL << (cache->setBits - cache->sampleBits))) {
+        return NULL;
+    }
+    return &cache->sets[slot];
+}
+
+// the line the block at address can occupy in the given way
+static Line *cache_way_line(const unsigned long long address, const int way, const Cache *cache) {
+    unsigned long long set_index = (cache->indexFn == CACHE_INDEX_SKEW) ? cache_skew_set(address, way, cache)
+                                                                        : cache_set(address, cache);
+    return &cache_set_ptr(set_index, cache)->lines[way];
+}
+
+// the LRU clock the lines of address are stamped with; the ways of a skewed
+// cache are in different sets, so they share one clock
+static int *cache_clock(const unsigned long long address, Cache *cache) {
+    if (cache->indexFn == CACHE_INDEX_SKEW) {
+        return &cache->lruClock;
+    }
+    return &cache_set_ptr(cache_set(address, cache), cache)->lru_clock;
 }
 
 bool probe_cache(const unsigned long long address, const Cache *cache) {
     /*YOUR CODE HERE*/
-    unsigned long long set_index = cache_set(address, cache);
     unsigned long long tag = cache_tag(address, cache);
 
-    // Pointers like this make it easier to read all these helper functions, instead
-    // of dealing with multiple nested dot/arrow operators which can get messy
-    Set *set = &cache->sets[set_index]; 
-
-    //for (int i = 0; i < cache->linesPerSet; ++i) {
-    for (int i = 0; i < CACHE_LINES_PER_SET; ++i) {
+    for (int i = 0; i < cache->linesPerSet; ++i) {
 
-        Line *line = &set->lines[i];
+        // Pointers like this make it easier to read all these helper functions, instead
+        // of dealing with multiple nested dot/arrow operators which can get messy
+        Line *line = cache_way_line(address, i, cache);
 
         // Along with checking tag value, need to check the valid bit
         if ( (line->valid == true) && (line->tag == tag) ) {
@@ -63,27 +115,28 @@ bool probe_cache(const unsigned long long address, const Cache *cache) {
     return false;   
 }
 
+// updates the replacement state of the line the hit is in
+static void hit_line(Line *line, const unsigned long long address, Cache *cache) {
+    int replacement_policy = CACHE_LFU;
+
+    //if (cache->lfu == 0) { // LRU Case
+    if (replacement_policy == 0) { // LRU Case
+        line->lru_clock = ++*cache_clock(address, cache);
+    } else { // LFU Case
+        line->access_counter++;
+    }
+}
+
 void hit_cacheline(const unsigned long long address, Cache *cache) {
     /*YOUR CODE HERE*/
 
-    unsigned long long set_index = cache_set(address, cache);
     unsigned long long tag = cache_tag(address, cache);
-    
-    Set *set = &cache->sets[set_index];
-
-    int replacement_policy = CACHE_LFU;
 
-    //for (int i = 0; i < cache->linesPerSet; ++i) {
-    for (int i = 0; i < CACHE_LINES_PER_SET; ++i) {
-        Line *line = &set->lines[i];
+    for (int i = 0; i < cache->linesPerSet; ++i) {
+        Line *line = cache_way_line(address, i, cache);
 
         if ( (line->valid == true) && (line->tag == tag) ) {
-            //if (cache->lfu == 0) { // LRU Case
-            if (replacement_policy == 0) { // LRU Case
-                line->lru_clock = ++set->lru_clock;
-            } else { // LFU Case
-                line->access_counter++;
-            }
+            hit_line(line, address, cache);
             break;
         }
     }
@@ -94,22 +147,18 @@ void hit_cacheline(const unsigned long long address, Cache *cache) {
 
 bool insert_cacheline(const unsigned long long address, Cache *cache) {
     /*YOUR CODE HERE*/
-    unsigned long long set_index = cache_set(address, cache);
     unsigned long long tag = cache_tag(address, cache);
     unsigned long long block_addr = address_to_block(address, cache);
 
-    Set *set = &cache->sets[set_index];
-
-    //for (int i = 0; i < cache->linesPerSet; ++i) {
-    for (int i = 0; i < CACHE_LINES_PER_SET; ++i) {
+    for (int i = 0; i < cache->linesPerSet; ++i) {
 
-        Line *line = &set->lines[i];
+        Line *line = cache_way_line(address, i, cache);
 
         if (line->valid == false) {
             line->valid = true;
             line->block_addr = block_addr;
             line->tag = tag;
-            line->lru_clock = ++set->lru_clock;
+            line->lru_clock = ++*cache_clock(address, cache);
             line->access_counter = 1; // initiate (not increment) access_counter
             return true;
         }
@@ -119,19 +168,16 @@ bool insert_cacheline(const unsigned long long address, Cache *cache) {
 
 unsigned long long victim_cacheline(const unsigned long long address, const Cache *cache) {
     /*YOUR CODE HERE*/
-    unsigned long long set_index = cache_set(address, cache);
-    Set *set = &cache->sets[set_index];
-    int victim_index = 0;
+    Line *victim = cache_way_line(address, 0, cache);
 
-    int min_accesses = set->lines[0].access_counter;
-    unsigned long long min_lru_clock = set->lines[0].lru_clock;
+    int min_accesses = victim->access_counter;
+    unsigned long long min_lru_clock = victim->lru_clock;
 
     int replacement_policy = CACHE_LFU;
 
-    //for (int i = 1; i < cache->linesPerSet; ++i) {
-    for (int i = 1; i < CACHE_LINES_PER_SET; ++i) {
+    for (int i = 1; i < cache->linesPerSet; ++i) {
 
-        Line *line = &set->lines[i];
+        Line *line = cache_way_line(address, i, cache);
 
         //if (cache->lfu) {
         if (replacement_policy == 1) { //LFU
@@ -139,36 +185,32 @@ unsigned long long victim_cacheline(const unsigned long long address, const Cach
                 (line->access_counter == min_accesses && line->lru_clock < min_lru_clock)) { 
                     min_accesses = line->access_counter;
                     min_lru_clock = line->lru_clock;
-                    victim_index = i;
+                    victim = line;
             }
         } else { // LRU
             if (line->lru_clock < min_lru_clock) {
                 min_lru_clock = line->lru_clock;
-                victim_index = i;
+                victim = line;
             }
         }
     }
-    return set->lines[victim_index].block_addr;
+    return victim->block_addr;
 }
 
 void replace_cacheline(const unsigned long long victim_block_addr, const unsigned long long insert_addr, Cache *cache) {
     /*YOUR CODE HERE*/
  
-    unsigned long long set_index = cache_set(insert_addr, cache);
     unsigned long long tag = cache_tag(insert_addr, cache);
     unsigned long long block_addr = address_to_block(insert_addr, cache);
 
-    Set *set = &cache->sets[set_index];
-
-    //for (int i = 0; i < cache->linesPerSet; ++i) {
-    for (int i = 0; i < CACHE_LINES_PER_SET; ++i) {
+    for (int i = 0; i < cache->linesPerSet; ++i) {
 
-        Line *line = &set->lines[i];
+        Line *line = cache_way_line(insert_addr, i, cache);
 
         if (line->block_addr == victim_block_addr) {
             line->block_addr = block_addr;
             line->tag = tag;
-            line->lru_clock = ++set->lru_clock;
+            line->lru_clock = ++*cache_clock(insert_addr, cache);
             line->access_counter = 1; // initiate (not increment) access_counter
             break;
         }
@@ -178,20 +220,352 @@ void replace_cacheline(const unsigned long long victim_block_addr, const unsigne
     //assert(0);
 }
 
+// LINE BUFFER (--line-buffer)
+
+static bool classes_first_touch(MissClassifier *mc, const unsigned long long key);
+static bool shadow_access(MissClassifier *mc, const unsigned long long key);
+
+// moves entry i of the line buffer to the front, the most recent
+static void line_buffer_promote(const int i, Cache *cache) {
+    unsigned long long key = cache->lineBuffer[i];
+    int way = cache->lineBufferWays[i];
+    memmove(&cache->lineBuffer[1], &cache->lineBuffer[0], i * sizeof(unsigned long long));
+    memmove(&cache->lineBufferWays[1], &cache->lineBufferWays[0], i * sizeof(int));
+    cache->lineBuffer[0] = key;
+    cache->lineBufferWays[0] = way;
+}
+
+// the way of the block at address in the line buffer, which makes it the most recent, or -1
+static int line_buffer_lookup(const unsigned long long address, Cache *cache) {
+    unsigned long long key = (address >> cache->blockBits) + 1;
+    for (int i = 0; i < cache->lineBufferSize; ++i) {
+        if (cache->lineBuffer[i] == key) {
+            line_buffer_promote(i, cache);
+            return cache->lineBufferWays[0];
+        }
+    }
+    return -1;
+}
+
+// puts the block at address, just accessed in the cache, in the line buffer,
+// dropping the least recent one
+static void line_buffer_fill(const unsigned long long address, Cache *cache) {
+    unsigned long long tag = cache_tag(address, cache);
+    int way = 0;
+    while (way < cache->linesPerSet - 1 &&
+           !(cache_way_line(address, way, cache)->valid && cache_way_line(address, way, cache)->tag == tag)) {
+        ++way;
+    }
+    line_buffer_promote(cache->lineBufferSize - 1, cache);
+    cache->lineBuffer[0] = (address >> cache->blockBits) + 1;
+    cache->lineBufferWays[0] = way;
+}
+
+// the buffer only holds blocks that are in the cache
+static void line_buffer_drop(const unsigned long long block_addr, Cache *cache) {
+    unsigned long long key = (block_addr >> cache->blockBits) + 1;
+    for (int i = 0; i < cache->lineBufferSize; ++i) {
+        if (cache->lineBuffer[i] == key) {
+            memmove(&cache->lineBuffer[i], &cache->lineBuffer[i + 1],
+                    (cache->lineBufferSize - 1 - i) * sizeof(unsigned long long));
+            memmove(&cache->lineBufferWays[i], &cache->lineBufferWays[i + 1],
+                    (cache->lineBufferSize - 1 - i) * sizeof(int));
+            cache->lineBuffer[cache->lineBufferSize - 1] = 0;
+            return;
+        }
+    }
+}
+
+/* A line buffer hit goes to the line in the recorded way without searching
+ * the set and without counting as a cache access, but the line is still
+ * used: its replacement state, the 3C shadow and the heatmap see the access */
+static void line_buffer_hit(const unsigned long long address, const int way, Cache *cache) {
+    Set *set = cache_set_ptr(cache_set(address, cache), cache);
+    ++*cache_clock(address, cache);
+    hit_line(cache_way_line(address, way, cache), address, cache);
+    set->line_buffer_hits++;
+    cache->lineBufferHits++;
+
+    if (cache->classes != NULL) {
+        unsigned long long key = (address >> cache->blockBits) + 1;
+        classes_first_touch(cache->classes, key);
+        shadow_access(cache->classes, key);
+    }
+    if (heatmap_active) {
+        heatmap_record(address, CACHE_HIT);
+    }
+}
+
+// 3C MISS CLASSIFICATION (--stats=3c)
+
+static unsigned long long classes_hash(const unsigned long long key) {
+    return (key * CACHE_SAMPLE_HASH) >> 24;
+}
+
+static MissClassifier *classes_create(const unsigned long long lines) {
+    MissClassifier *mc = checked_calloc(1, sizeof(MissClassifier), "the cache");
+    mc->seenMask = 1023;
+    mc->seen = checked_calloc(mc->seenMask + 1, sizeof(unsigned long long), "the cache");
+    mc->pcMask = 255;
+    mc->pcs = checked_calloc(mc->pcMask + 1, sizeof(PcMisses), "the cache");
+
+    int buckets = 1;
+    while (buckets < 2 * lines) {
+        buckets <<= 1;
+    }
+    mc->numLines = lines;
+    mc->lines = checked_calloc(lines, sizeof(ShadowLine), "the cache");
+    mc->buckets = checked_calloc(buckets, sizeof(int), "the cache");
+    for (int i = 0; i < buckets; ++i) {
+        mc->buckets[i] = -1;
+    }
+    mc->bucketMask = buckets - 1;
+    mc->head = -1;
+    mc->tail = -1;
+    return mc;
+}
+
+static void classes_free(MissClassifier *mc) {
+    free(mc->seen);
+    free(mc->pcs);
+    free(mc->lines);
+    free(mc->buckets);
+    free(mc);
+}
+
+// true the first time the block is seen
+static bool classes_first_touch(MissClassifier *mc, const unsigned long long key) {
+    if ((mc->seenCount + 1) * 2 > mc->seenMask) {
+        // keep the table at most half full
+        unsigned long long *old = mc->seen;
+        unsigned long long old_mask = mc->seenMask;
+        mc->seenMask = old_mask * 2 + 1;
+        mc->seen = checked_calloc(mc->seenMask + 1, sizeof(unsigned long long), "the cache");
+        for (unsigned long long i = 0; i <= old_mask; ++i) {
+            if (old[i] != 0) {
+                unsigned long long j = classes_hash(old[i]) & mc->seenMask;
+                while (mc->seen[j] != 0) {
+                    j = (j + 1) & mc->seenMask;
+                }
+                mc->seen[j] = old[i];
+            }
+        }
+        free(old);
+    }
+
+    unsigned long long i = classes_hash(key) & mc->seenMask;
+    while (mc->seen[i] != 0) {
+        if (mc->seen[i] == key) {
+            return false;
+        }
+        i = (i + 1) & mc->seenMask;
+    }
+    mc->seen[i] = key;
+    mc->seenCount++;
+    return true;
+}
+
+static MissClasses *classes_at_pc(MissClassifier *mc, const unsigned long long key) {
+    if ((mc->pcCount + 1) * 2 > mc->pcMask) {
+        PcMisses *old = mc->pcs;
+        unsigned long long old_mask = mc->pcMask;
+        mc->pcMask = old_mask * 2 + 1;
+        mc->pcs = checked_calloc(mc->pcMask + 1, sizeof(PcMisses), "the cache");
+        for (unsigned long long i = 0; i <= old_mask; ++i) {
+            if (old[i].pc != 0) {
+                unsigned long long j = classes_hash(old[i].pc) & mc->pcMask;
+                while (mc->pcs[j].pc != 0) {
+                    j = (j + 1) & mc->pcMask;
+                }
+                mc->pcs[j] = old[i];
+            }
+        }
+        free(old);
+    }
+
+    unsigned long long i = classes_hash(key) & mc->pcMask;
+    while (mc->pcs[i].pc != 0 && mc->pcs[i].pc != key) {
+        i = (i + 1) & mc->pcMask;
+    }
+    if (mc->pcs[i].pc == 0) {
+        mc->pcs[i].pc = key;
+        mc->pcCount++;
+    }
+    return &mc->pcs[i].classes;
+}
+
+static void shadow_unlink(MissClassifier *mc, const int i) {
+    ShadowLine *line = &mc->lines[i];
+    if (line->prev >= 0) {
+        mc->lines[line->prev].next = line->next;
+    } else {
+        mc->head = line->next;
+    }
+    if (line->next >= 0) {
+        mc->lines[line->next].prev = line->prev;
+    } else {
+        mc->tail = line->prev;
+    }
+}
+
+// accesses the fully associative LRU shadow cache, true on a hit
+static bool shadow_access(MissClassifier *mc, const unsigned long long key) {
+    int bucket = classes_hash(key) & mc->bucketMask;
+    int i = mc->buckets[bucket];
+    while (i >= 0 && mc->lines[i].block != key) {
+        i = mc->lines[i].chain;
+    }
+    bool hit = i >= 0;
+
+    if (hit) {
+        shadow_unlink(mc, i);
+    } else if (mc->usedLines < mc->numLines) {
+        i = mc->usedLines++;
+    } else {
+        // evict the least recently used line
+        i = mc->tail;
+        shadow_unlink(mc, i);
+        int *link = &mc->buckets[classes_hash(mc->lines[i].block) & mc->bucketMask];
+        while (*link != i) {
+            link = &mc->lines[*link].chain;
+        }
+        *link = mc->lines[i].chain;
+    }
+    if (!hit) {
+        mc->lines[i].block = key;
+        mc->lines[i].chain = mc->buckets[bucket];
+        mc->buckets[bucket] = i;
+    }
+
+    mc->lines[i].prev = -1;
+    mc->lines[i].next = mc->head;
+    if (mc->head >= 0) {
+        mc->lines[mc->head].prev = i;
+    } else {
+        mc->tail = i;
+    }
+    mc->head = i;
+    return hit;
+}
+
+static void classes_count(MissClasses *classes, const bool first_touch, const bool shadow_hit) {
+    if (first_touch) {
+        classes->compulsory++;
+    } else if (!shadow_hit) {
+        classes->capacity++;
+    } else {
+        classes->conflict++;
+    }
+}
+
+static int compare_pc_misses(const void *a, const void *b) {
+    const PcMisses *x = a, *y = b;
+    unsigned long long mx = x->classes.compulsory + x->classes.capacity + x->classes.conflict;
+    unsigned long long my = y->classes.compulsory + y->classes.capacity + y->classes.conflict;
+    if (mx != my) {
+        return mx < my ? 1 : -1;
+    }
+    return x->pc < y->pc ? -1 : x->pc > y->pc;
+}
+
+void cache_print_miss_classes(const Cache *cache) {
+    const MissClassifier *mc = cache->classes;
+    if (mc == NULL) {
+        return;
+    }
+    printf("#Misses compulsory = %5llu\n", mc->total.compulsory);
+    printf("#Misses capacity   = %5llu\n", mc->total.capacity);
+    printf("#Misses conflict   = %5llu\n", mc->total.conflict);
+
+    // the PCs with the most misses
+    PcMisses *pcs = checked_calloc(mc->pcCount + 1, sizeof(PcMisses), "the cache");
+    unsigned long long n = 0;
+    for (unsigned long long i = 0; i <= mc->pcMask; ++i) {
+        if (mc->pcs[i].pc != 0) {
+            pcs[n++] = mc->pcs[i];
+        }
+    }
+    qsort(pcs, n, sizeof(PcMisses), compare_pc_misses);
+    unsigned long long rest = 0;
+    for (unsigned long long i = 0; i < n; ++i) {
+        const MissClasses *c = &pcs[i].classes;
+        if (i < CACHE_CLASSES_PCS) {
+            printf("#Misses at %08llx = %5llu (%llu compulsory, %llu capacity, %llu conflict)\n",
+                   pcs[i].pc - 1, c->compulsory + c->capacity + c->conflict,
+                   c->compulsory, c->capacity, c->conflict);
+        } else {
+            rest += c->compulsory + c->capacity + c->conflict;
+        }
+    }
+    if (n > CACHE_CLASSES_PCS) {
+        printf("#Misses elsewhere  = %5llu (%llu more PCs)\n", rest, n - CACHE_CLASSES_PCS);
+    }
+    free(pcs);
+}
+
+void cache_clear_stats(Cache *cache) {
+    cache->hit_count = 0;
+    cache->miss_count = 0;
+    cache->eviction_count = 0;
+    cache->lineBufferHits = 0;
+    if (cache->classes != NULL) {
+        // the shadow and the blocks seen stay warm
+        MissClassifier *mc = cache->classes;
+        memset(&mc->total, 0, sizeof(MissClasses));
+        memset(mc->pcs, 0, (mc->pcMask + 1) * sizeof(PcMisses));
+        mc->pcCount = 0;
+    }
+}
+
+unsigned long long cache_modeled_sets(const Cache *cache) {
+    return 1ULL << (cache->setBits - cache->sampleBits);
+}
+
 void cacheSetUp(Cache *cache, char *name) {
     cache->hit_count = 0;
     /*YOUR CODE HERE*/
 
-    //int num_sets = 1 << cache->setBits;
-    int num_sets = 1 << CACHE_SET_BITS;
+    // geometry from the command line (config.h defaults)
+    cache->setBits = sim_config.cache_set_bits;
+    cache->linesPerSet = sim_config.cache_ways;
+    cache->blockBits = sim_config.cache_block_bits;
+    cache->sampleBits = sim_config.cache_sample_bits;
+    cache->accesses = 0;
+    cache->indexFn = sim_config.cache_index;
+    cache->lruClock = 0;
+
+    // the largest prime number of sets that fits
+    cache->primeSets = 1ULL << cache->setBits;
+    for (bool prime = false; cache->primeSets > 2 && !prime; ) {
+        prime = true;
+        for (unsigned long long d = 2; d * d <= cache->primeSets; ++d) {
+            if (cache->primeSets % d == 0) {
+                prime = false;
+                cache->primeSets--;
+                break;
+            }
+        }
+    }
+
+    unsigned long long num_sets = cache_modeled_sets(cache);
     cache->sets = (Set *)malloc(num_sets * sizeof(Set));
+    if (cache->sets == NULL) {
+        printf("Error: Unable to allocate memory for the cache\n");
+        exit(-1);
+    }
 
-    for (int i = 0; i < num_sets; ++i) {
-        //cache->sets[i].lines = (Line *)malloc(cache->linesPerSet * sizeof(Line));
-        cache->sets[i].lines = (Line *)malloc(CACHE_LINES_PER_SET * sizeof(Line));
+    for (unsigned long long i = 0; i < num_sets; ++i) {
+        cache->sets[i].lines = (Line *)malloc(cache->linesPerSet * sizeof(Line));
+        if (cache->sets[i].lines == NULL) {
+            printf("Error: Unable to allocate memory for the cache\n");
+            exit(-1);
+        }
         cache->sets[i].lru_clock = 0;
-        //for (int j = 0; j < cache->linesPerSet; ++j) {
-        for (int j = 0; j < CACHE_LINES_PER_SET; ++j) {
+        cache->sets[i].accesses = 0;
+        cache->sets[i].misses = 0;
+        cache->sets[i].evictions = 0;
+        cache->sets[i].line_buffer_hits = 0;
+        for (int j = 0; j < cache->linesPerSet; ++j) {
             cache->sets[i].lines[j].valid = false;
             cache->sets[i].lines[j].lru_clock = 0;
             cache->sets[i].lines[j].access_counter = 1;
@@ -201,17 +575,34 @@ void cacheSetUp(Cache *cache, char *name) {
     cache->hit_count = 0;
     cache->miss_count = 0;
     cache->eviction_count = 0;
+    cache->pc = 0;
+    cache->classes = NULL;
+    cache->lineBufferSize = sim_config.line_buffer;
+    cache->lineBufferHits = 0;
+    cache->lineBuffer = NULL;
+    cache->lineBufferWays = NULL;
+    if (cache->lineBufferSize > 0) {
+        cache->lineBuffer = checked_calloc(cache->lineBufferSize, sizeof(unsigned long long), "the cache");
+        cache->lineBufferWays = checked_calloc(cache->lineBufferSize, sizeof(int), "the cache");
+    }
+    if (sim_config.print_miss_classes) {
+        cache->classes = classes_create(num_sets * cache->linesPerSet);
+    }
     cache->name = name;
 }
 
 void deallocate(Cache *cache) {
     /*YOUR CODE HERE*/
-    //int num_sets = 1 << cache->setBits;
-    int num_sets = 1 << CACHE_SET_BITS;
-    for (int i = 0; i < num_sets; ++i) {
+    unsigned long long num_sets = cache_modeled_sets(cache);
+    for (unsigned long long i = 0; i < num_sets; ++i) {
         free(cache->sets[i].lines);
     }
     free(cache->sets);
+    if (cache->classes != NULL) {
+        classes_free(cache->classes);
+    }
+    free(cache->lineBuffer);
+    free(cache->lineBufferWays);
 }
 
 result operateCache(const unsigned long long address, Cache *cache) {
@@ -222,8 +613,22 @@ result operateCache(const unsigned long long address, Cache *cache) {
     ///////////////////////FROM LAB4/////////////////////////////
     // increment the global lru_clock in the corresponding cache set for the address
     unsigned long long set_index = cache_set(address, cache);
-    Set *set = &cache->sets[set_index];
-    set->lru_clock++;
+    Set *set = cache_set_ptr(set_index, cache);
+    cache->accesses++;
+    if (set == NULL) { // set sampling leaves this set out
+        r.status = CACHE_UNSAMPLED;
+        return r;
+    }
+    ++*cache_clock(address, cache);
+    set->accesses++;
+
+    // every access keeps the 3C bookkeeping up to date, not just misses
+    bool first_touch = false, shadow_hit = false;
+    if (cache->classes != NULL) {
+        unsigned long long key = (address >> cache->blockBits) + 1;
+        first_touch = classes_first_touch(cache->classes, key);
+        shadow_hit = shadow_access(cache->classes, key);
+    }
     
     // check if the address is already in the cache
     if (probe_cache(address, cache) == true) { // Cache hit
@@ -233,39 +638,51 @@ result operateCache(const unsigned long long address, Cache *cache) {
         // record hit status
         r.status = CACHE_HIT;
         
-        #ifdef PRINT_CACHE_TRACES
-        printf(CACHE_HIT_FORMAT, address);
-        #endif
+        if (sim_config.print_cache_traces) {
+            printf(CACHE_HIT_FORMAT, address);
+        }
 
     } else { // Cache miss
 
         // find an empty cache line in the cache set
+        set->misses++;
+        if (cache->classes != NULL) {
+            classes_count(&cache->classes->total, first_touch, shadow_hit);
+            classes_count(classes_at_pc(cache->classes, cache->pc + 1), first_touch, shadow_hit);
+        }
         if (insert_cacheline(address, cache) == true) {
             cache->miss_count++;
             r.status = CACHE_MISS;
             r.insert_block_addr = address_to_block(address, cache);
 
-            #ifdef PRINT_CACHE_TRACES 
-            printf(CACHE_MISS_FORMAT, address);
-            #endif
+            if (sim_config.print_cache_traces) {
+                printf(CACHE_MISS_FORMAT, address);
+            }
 
         } else {
             unsigned long long victim_block_addr = victim_cacheline(address, cache);
             replace_cacheline(victim_block_addr, address, cache);
             cache->miss_count++;
             cache->eviction_count++;
+            set->evictions++;
+            if (cache->lineBufferSize > 0) {
+                line_buffer_drop(victim_block_addr, cache);
+            }
             // Eviction
             r.status = CACHE_EVICT;
             r.victim_block_addr = victim_block_addr;
             r.insert_block_addr = address_to_block(address, cache);
 
-            #ifdef PRINT_CACHE_TRACES 
-            printf(CACHE_EVICTION_FORMAT, address);
-            #endif
+            if (sim_config.print_cache_traces) {
+                printf(CACHE_EVICTION_FORMAT, address);
+            }
         }
     }
     //////////////////////FROM LAB4/////////////////////////////
-    
+
+    if (heatmap_active) {
+        heatmap_record(address, r.status);
+    }
     return r;
     /*YOUR CODE HERE*/
 }
@@ -273,7 +690,19 @@ result operateCache(const unsigned long long address, Cache *cache) {
 int processCacheOperation(unsigned long address, Cache *cache) {
     result r;
     /*YOUR CODE HERE*/
+    // the line buffer answers without searching the set
+    if (cache->lineBufferSize > 0) {
+        int way = line_buffer_lookup(address, cache);
+        if (way >= 0) {
+            line_buffer_hit(address, way, cache);
+            return sim_config.line_buffer_latency;
+        }
+    }
+
     r = operateCache(address, cache);
+    if (cache->lineBufferSize > 0 && r.status != CACHE_UNSAMPLED) {
+        line_buffer_fill(address, cache);
+    }
 
     if (r.status == CACHE_HIT) {
         return CACHE_HIT_LATENCY;
@@ -286,3 +715,27 @@ int processCacheOperation(unsigned long address, Cache *cache) {
         return CACHE_OTHER_LATENCY;
     }
 }
+
+double cache_miss_ratio(const Cache *cache, double *bound) {
+    // ratio estimate over the modeled sets, each set one sampling unit
+    unsigned long long n = cache_modeled_sets(cache);
+    double accesses = 0, misses = 0;
+    for (unsigned long long i = 0; i < n; ++i) {
+        accesses += cache->sets[i].accesses;
+        misses += cache->sets[i].misses;
+    }
+    double ratio = (accesses > 0) ? misses / accesses : 0;
+
+    *bound = 0;
+    if (cache->sampleBits > 0 && n > 1 && accesses > 0) {
+        double sum = 0;
+        for (unsigned long long i = 0; i < n; ++i) {
+            double d = cache->sets[i].misses - ratio * cache->sets[i].accesses;
+            sum += d * d;
+        }
+        double mean = accesses / n;
+        double fraction = 1.0 / (1ULL << cache->sampleBits);
+        *bound = 1.96 * sqrt((1 - fraction) * sum / (n - 1) / n) / mean;
+    }
+    return ratio;
+}
@@ -11,19 +11,33 @@
 #include <unistd.h>
 #include <stdio.h>
 #include "utils.h"
+#include "riscv.h"
 #include "config.h"
 enum status_enum {
   CACHE_MISS = 0,
   CACHE_HIT = 1,
-  CACHE_EVICT = 2
+  CACHE_EVICT = 2,
+  CACHE_UNSAMPLED = 3  // set sampling does not model the set
+};
+
+// set index functions, --cache-index
+enum cache_index_enum {
+  CACHE_INDEX_MOD = 0,    // the address bits above the block offset
+  CACHE_INDEX_XOR = 1,    // every bit above the offset XOR-folded onto the index
+  CACHE_INDEX_PRIME = 2,  // block number modulo the largest prime <= sets
+  CACHE_INDEX_SKEW = 3    // a different hash per way (skewed-associative)
 };
 
 #define CACHE_HIT_LATENCY 2    // hit latency
-#define CACHE_MISS_LATENCY MEM_LATENCY+CACHE_HIT_LATENCY  // miss latency
-#define CACHE_OTHER_LATENCY MEM_LATENCY+CACHE_HIT_LATENCY // eviction latency
+#define CACHE_MISS_LATENCY (sim_config.mem_latency+CACHE_HIT_LATENCY)  // miss latency
+#define CACHE_OTHER_LATENCY (sim_config.mem_latency+CACHE_HIT_LATENCY) // eviction latency
+// defaults of the geometry, --cache-sets/--cache-ways/--cache-block change it
 #define CACHE_SET_BITS 4 // number of sets (2^CACHE_SET_BITS)
 #define CACHE_LINES_PER_SET 4 // Number of lines per set (associativity)
 #define CACHE_BLOCK_BITS 6 // number of blocks (2^CACHE_BLOCK_BITS)
+#define CACHE_SAMPLE_HASH 0x9E3779B97F4A7C15ULL // odd, picks the sampled sets
+#define CACHE_SKEW_STEP 0x632BE59BD9B4E019ULL // between the per-way multipliers of skew
+#define CACHE_CLASSES_PCS 16 // PCs listed in the 3C breakdown
 #define CACHE_DISPLAY_TRACE false
 #define CACHE_LFU 1 // LRU **********This is wrong? Its the other way around I think?**********
 
@@ -39,8 +53,44 @@ typedef struct {
 typedef struct {
     Line *lines;
     int lru_clock;
+    unsigned long long accesses;
+    unsigned long long misses;
+    unsigned long long evictions;
+    unsigned long long line_buffer_hits;  // not in accesses, the line buffer answered
 } Set;
 
+// misses by cause (--stats=3c): compulsory on the first touch of the block,
+// capacity if a fully associative LRU cache with as many lines misses too,
+// conflict otherwise (with LFU replacement these include the misses LRU
+// would have avoided)
+typedef struct {
+    unsigned long long compulsory;  // first touch of the block
+    unsigned long long capacity;    // also a miss in the fully associative shadow
+    unsigned long long conflict;    // a hit in the shadow
+} MissClasses;
+
+typedef struct {
+    unsigned long long block;   // block number + 1, 0 is an empty entry
+    int prev, next;             // LRU list, most recent first
+    int chain;                  // next line in the same hash bucket
+} ShadowLine;
+
+typedef struct {
+    unsigned long long pc;      // PC + 1, 0 is an empty entry
+    MissClasses classes;
+} PcMisses;
+
+typedef struct {
+    unsigned long long *seen;   // blocks touched so far (block number + 1)
+    unsigned long long seenMask, seenCount;
+    ShadowLine *lines;          // fully associative LRU, as many lines as the cache
+    int *buckets;               // first line per hash bucket, -1 if none
+    int numLines, usedLines, bucketMask, head, tail;
+    PcMisses *pcs;
+    unsigned long long pcMask, pcCount;
+    MissClasses total;
+} MissClassifier;
+
 typedef struct {
     Set *sets;
     int hit_count;
@@ -51,6 +101,17 @@ typedef struct {
     int setBits;
     int linesPerSet;
     int blockBits;
+    int sampleBits;                // 1 in 2^sampleBits sets is modeled
+    int indexFn;                   // enum cache_index_enum
+    unsigned long long primeSets;  // sets in use with CACHE_INDEX_PRIME
+    int lruClock;                  // shared by the sets with CACHE_INDEX_SKEW
+    unsigned long long *lineBuffer; // block numbers + 1 of the last blocks used, MRU first
+    int *lineBufferWays;           // the way each of them is in
+    int lineBufferSize;            // 0 without --line-buffer
+    unsigned long long lineBufferHits;
+    unsigned long long accesses;   // including sets that are not modeled
+    unsigned long long pc;         // of the access being made, for the 3C breakdown
+    MissClassifier *classes;       // NULL unless --stats=3c
     char *name;
 } Cache;
 
@@ -68,6 +129,11 @@ int processCacheOperation(unsigned long address, Cache *cache);
 unsigned long long address_to_block(const unsigned long long address, const Cache *cache);
 unsigned long long cache_tag(const unsigned long long address, const Cache *cache);
 unsigned long long cache_set(const unsigned long long address, const Cache *cache);
+Set *cache_set_ptr(const unsigned long long set_index, const Cache *cache);  // NULL if not modeled
+unsigned long long cache_modeled_sets(const Cache *cache);
+double cache_miss_ratio(const Cache *cache, double *bound);  // bound: 95%, 0 when exact
+void cache_print_miss_classes(const Cache *cache);
+void cache_clear_stats(Cache *cache);  // counters only, the contents stay
 bool probe_cache(const unsigned long long address, const Cache *cache);
 void hit_cacheline(const unsigned long long address, Cache *cache);
 bool insert_cacheline(const unsigned long long address, Cache *cache);
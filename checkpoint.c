@@ -0,0 +1,381 @@
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "types.h"
+#include "memory.h"
+#include "checkpoint.h"
+#include "csr.h"
+
+// statistics counters carried in the checkpoint (pipeline.c)
+static uint64_t* const ckpt_counters[] = {
+  &total_cycle_counter, &mem_access_counter, &miss_count, &hit_count,
+  &stall_counter, &branch_counter, &fwd_exex_counter, &fwd_exmem_counter,
+  &retired_counter, &sb_store_counter, &sb_occupancy_counter, &sb_full_stall_counter,
+  &sb_forward_counter, &sb_conflict_stall_counter, &unit_stall_counter, &unit_busy_counter,
+};
+#define CKPT_COUNTERS (sizeof(ckpt_counters) / sizeof(ckpt_counters[0]))
+
+// struct sizes and cache geometry the file was written with
+enum
+{
+  CKPT_LAYOUT_REGFILE,
+  CKPT_LAYOUT_PREGS,
+  CKPT_LAYOUT_PWIRES,
+  CKPT_LAYOUT_LINE,
+  CKPT_LAYOUT_SET_BITS,
+  CKPT_LAYOUT_WAYS,
+  CKPT_LAYOUT_BLOCK_BITS,
+  CKPT_LAYOUT_SAMPLE_BITS,
+  CKPT_LAYOUT_INDEX,
+  CKPT_LAYOUT_LINE_BUFFER,
+  CKPT_LAYOUT_CSR,
+  CKPT_LAYOUT_COUNT
+};
+
+/**
+ * File layout: header, cache, one ckpt_set_t per modeled set, the lines of
+ * every set, the line buffer, permission runs, page extents, then the page data of every
+ * extent starting at the first guest-page boundary.
+ **/
+typedef struct
+{
+  char             magic[8];
+  uint32_t         mode;
+  uint32_t         layout[CKPT_LAYOUT_COUNT];
+  uint64_t         progress;
+  int64_t          prog_numins;
+  uint64_t         counters[CKPT_COUNTERS];
+  uint32_t         perm_runs;
+  uint32_t         extents;
+  regfile_t        regfile;
+  pipeline_regs_t  pregs;
+  pipeline_wires_t pwires;
+  csr_state_t      csr;
+}ckpt_header_t;
+
+typedef struct
+{
+  int      hit_count;
+  int      miss_count;
+  int      eviction_count;
+  uint64_t accesses;
+  int64_t  lru_clock;   // CACHE_INDEX_SKEW
+  uint64_t line_buffer_hits;
+}ckpt_cache_t;
+
+typedef struct
+{
+  int64_t  lru_clock;
+  uint64_t accesses;
+  uint64_t misses;
+  uint64_t evictions;
+  uint64_t line_buffer_hits;
+}ckpt_set_t;
+
+// consecutive pages with the same permissions
+typedef struct
+{
+  uint32_t first;
+  uint32_t count;
+  uint32_t perm;
+}ckpt_run_t;
+
+// consecutive non-zero pages and where their data is in the file
+typedef struct
+{
+  uint32_t first;
+  uint32_t count;
+  uint64_t offset;
+}ckpt_extent_t;
+
+static void ckpt_layout(uint32_t* layout, const Cache* cache)
+{
+  layout[CKPT_LAYOUT_REGFILE]     = sizeof(regfile_t);
+  layout[CKPT_LAYOUT_PREGS]       = sizeof(pipeline_regs_t);
+  layout[CKPT_LAYOUT_PWIRES]      = sizeof(pipeline_wires_t);
+  layout[CKPT_LAYOUT_LINE]        = sizeof(Line);
+  layout[CKPT_LAYOUT_SET_BITS]    = cache->setBits;
+  layout[CKPT_LAYOUT_WAYS]        = cache->linesPerSet;
+  layout[CKPT_LAYOUT_BLOCK_BITS]  = cache->blockBits;
+  layout[CKPT_LAYOUT_SAMPLE_BITS] = cache->sampleBits;
+  layout[CKPT_LAYOUT_INDEX]       = cache->indexFn;
+  layout[CKPT_LAYOUT_LINE_BUFFER] = cache->lineBufferSize;
+  layout[CKPT_LAYOUT_CSR]         = sizeof(csr_state_t);
+}
+
+// bytes of the cache section
+static uint64_t ckpt_cache_size(const Cache* cache)
+{
+  uint64_t sets = cache_modeled_sets(cache);
+  return sizeof(ckpt_cache_t) + sets * sizeof(ckpt_set_t) + sets * cache->linesPerSet * sizeof(Line) +
+         cache->lineBufferSize * (sizeof(unsigned long long) + sizeof(int));
+}
+
+static bool ckpt_page_zero(const Byte* page)
+{
+  const uint64_t* w = (const uint64_t*)page;
+  for (size_t i = 0; i < GUEST_PAGE_SIZE / sizeof(uint64_t); i++) {
+    if (w[i] != 0) return false;
+  }
+  return true;
+}
+
+static uint64_t ckpt_align(uint64_t offset)
+{
+  return (offset + GUEST_PAGE_SIZE - 1) & ~(uint64_t)(GUEST_PAGE_SIZE - 1);
+}
+
+/**
+ * First page at or after page whose flag isn't value (GUEST_PAGES if none).
+ * Compares eight pages at a time, the tables have a million entries.
+ **/
+static uint32_t ckpt_skip(const Byte* flags, uint32_t page, Byte value)
+{
+  const uint64_t pattern = value * 0x0101010101010101ULL;
+  while (page < GUEST_PAGES && (page & 7) != 0) {
+    if (flags[page] != value) return page;
+    page++;
+  }
+  for (; page < GUEST_PAGES; page += 8) {
+    uint64_t w;
+    memcpy(&w, flags + page, sizeof(w));
+    if (w != pattern) break;
+  }
+  while (page < GUEST_PAGES && flags[page] == value) page++;
+  return page;
+}
+
+/**
+ * Splits mem_perm[] into runs. Returns the number of runs; runs may be NULL
+ * to only count them.
+ **/
+static uint32_t ckpt_perm_runs(ckpt_run_t* runs)
+{
+  uint32_t n = 0;
+  for (uint32_t page = 0; page < GUEST_PAGES; ) {
+    uint32_t first = page;
+    page = ckpt_skip(mem_perm, page, mem_perm[first]);
+    if (runs != NULL) {
+      runs[n] = (ckpt_run_t){ first, page - first, mem_perm[first] };
+    }
+    n++;
+  }
+  return n;
+}
+
+static void ckpt_write(FILE* f, const void* data, size_t size, const char* path)
+{
+  if (fwrite(data, 1, size, f) != size) {
+    printf("Error: unable to write checkpoint %s\n", path);
+    exit(-1);
+  }
+}
+
+static void ckpt_write_cache(FILE* f, const Cache* c, const char* path)
+{
+  ckpt_cache_t cache = { c->hit_count, c->miss_count, c->eviction_count, c->accesses, c->lruClock, c->lineBufferHits };
+  ckpt_write(f, &cache, sizeof(cache), path);
+  uint64_t sets = cache_modeled_sets(c);
+  for (uint64_t s = 0; s < sets; s++) {
+    ckpt_set_t set = { c->sets[s].lru_clock, c->sets[s].accesses, c->sets[s].misses, c->sets[s].evictions,
+                       c->sets[s].line_buffer_hits };
+    ckpt_write(f, &set, sizeof(set), path);
+  }
+  for (uint64_t s = 0; s < sets; s++) {
+    ckpt_write(f, c->sets[s].lines, c->linesPerSet * sizeof(Line), path);
+  }
+  ckpt_write(f, c->lineBuffer, c->lineBufferSize * sizeof(unsigned long long), path);
+  ckpt_write(f, c->lineBufferWays, c->lineBufferSize * sizeof(int), path);
+}
+
+void ckpt_save(const char* path, const ckpt_state_t* state)
+{
+  FILE* f = fopen(path, "wb");
+  if (f == NULL) {
+    printf("Error: unable to create checkpoint %s\n", path);
+    exit(-1);
+  }
+
+  uint32_t nruns = ckpt_perm_runs(NULL);
+  ckpt_run_t* runs = malloc(nruns * sizeof(ckpt_run_t));
+  Byte* used = malloc(GUEST_PAGES);
+  if (runs == NULL || used == NULL) {
+    printf("Error: Unable to allocate memory for the checkpoint\n");
+    exit(-1);
+  }
+  ckpt_perm_runs(runs);
+
+  // pages the program may not read still have to be saved
+  for (uint32_t r = 0; r < nruns; r++) {
+    if (!(runs[r].perm & MEM_PERM_RW)) {
+      mem_protect((Address)runs[r].first << GUEST_PAGE_BITS, (uint64_t)runs[r].count << GUEST_PAGE_BITS, MEM_PERM_RW);
+    }
+  }
+
+  // only pages the host ever backed can be non-zero
+  mem_touched_pages(used);
+  uint32_t nextents = 0;
+  for (uint32_t page = ckpt_skip(used, 0, 0); page < GUEST_PAGES; page = ckpt_skip(used, page, 0)) {
+    for (; page < GUEST_PAGES && used[page]; page++) {
+      used[page] = !ckpt_page_zero(state->memory_p + ((uint64_t)page << GUEST_PAGE_BITS));
+      nextents += used[page] && (page == 0 || !used[page - 1]);
+    }
+  }
+
+  ckpt_extent_t* extents = malloc((nextents ? nextents : 1) * sizeof(ckpt_extent_t));
+  if (extents == NULL) {
+    printf("Error: Unable to allocate memory for the checkpoint\n");
+    exit(-1);
+  }
+
+  ckpt_header_t header;
+  memset(&header, 0, sizeof(header));
+
+  uint64_t offset = ckpt_align(sizeof(header) + ckpt_cache_size(state->cache_p) + nruns * sizeof(ckpt_run_t) + nextents * sizeof(ckpt_extent_t));
+  uint32_t n = 0;
+  for (uint32_t page = ckpt_skip(used, 0, 0); page < GUEST_PAGES; page = ckpt_skip(used, page, 0)) {
+    uint32_t first = page;
+    while (page < GUEST_PAGES && used[page]) page++;
+    extents[n++] = (ckpt_extent_t){ first, page - first, offset };
+    offset += (uint64_t)(page - first) << GUEST_PAGE_BITS;
+  }
+
+  memcpy(header.magic, CKPT_MAGIC, sizeof(CKPT_MAGIC));
+  header.mode = state->mode;
+  ckpt_layout(header.layout, state->cache_p);
+  header.progress = state->progress;
+  header.prog_numins = state->prog_numins;
+  for (size_t i = 0; i < CKPT_COUNTERS; i++) {
+    header.counters[i] = *ckpt_counters[i];
+  }
+  header.perm_runs = nruns;
+  header.extents = nextents;
+  header.regfile = *state->regfile_p;
+  header.pregs = *state->pregs_p;
+  header.pwires = *state->pwires_p;
+  header.csr = csr_state;
+
+  ckpt_write(f, &header, sizeof(header), path);
+  ckpt_write_cache(f, state->cache_p, path);
+  ckpt_write(f, runs, nruns * sizeof(ckpt_run_t), path);
+  ckpt_write(f, extents, nextents * sizeof(ckpt_extent_t), path);
+  if (fseek(f, nextents ? (long)extents[0].offset : 0, nextents ? SEEK_SET : SEEK_CUR) != 0) {
+    printf("Error: unable to write checkpoint %s\n", path);
+    exit(-1);
+  }
+  for (uint32_t e = 0; e < nextents; e++) {
+    ckpt_write(f, state->memory_p + ((uint64_t)extents[e].first << GUEST_PAGE_BITS),
+               (size_t)extents[e].count << GUEST_PAGE_BITS, path);
+  }
+  if (fclose(f) != 0) {
+    printf("Error: unable to write checkpoint %s\n", path);
+    exit(-1);
+  }
+
+  for (uint32_t r = 0; r < nruns; r++) {
+    if (!(runs[r].perm & MEM_PERM_RW)) {
+      mem_protect((Address)runs[r].first << GUEST_PAGE_BITS, (uint64_t)runs[r].count << GUEST_PAGE_BITS, runs[r].perm);
+    }
+  }
+
+  free(extents);
+  free(used);
+  free(runs);
+}
+
+static void ckpt_bad(const char* path, const char* why)
+{
+  printf("Error: checkpoint %s %s\n", path, why);
+  exit(-1);
+}
+
+void ckpt_restore(const char* path, ckpt_state_t* state)
+{
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    ckpt_bad(path, "can't be opened");
+  }
+  if ((uint64_t)st.st_size < sizeof(ckpt_header_t) + ckpt_cache_size(state->cache_p)) {
+    ckpt_bad(path, "is truncated");
+  }
+  const Byte* file = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (file == MAP_FAILED) {
+    ckpt_bad(path, "can't be mapped");
+  }
+
+  const ckpt_header_t* header = (const ckpt_header_t*)file;
+  uint32_t layout[CKPT_LAYOUT_COUNT];
+  ckpt_layout(layout, state->cache_p);
+  if (memcmp(header->magic, CKPT_MAGIC, sizeof(CKPT_MAGIC)) != 0) {
+    ckpt_bad(path, "is not a checkpoint");
+  }
+  if (memcmp(header->layout, layout, sizeof(layout)) != 0) {
+    ckpt_bad(path, "was written by an incompatible build or cache configuration");
+  }
+  if (header->mode != state->mode) {
+    ckpt_bad(path, header->mode == CKPT_PIPELINE ? "was taken in the pipeline (-s)" : "was taken in the emulator (-m)");
+  }
+
+  const ckpt_cache_t* cache = (const ckpt_cache_t*)(header + 1);
+  const ckpt_set_t* sets = (const ckpt_set_t*)(cache + 1);
+  const Line* lines = (const Line*)(sets + cache_modeled_sets(state->cache_p));
+  const ckpt_run_t* runs = (const ckpt_run_t*)((const Byte*)header + sizeof(ckpt_header_t) + ckpt_cache_size(state->cache_p));
+  const ckpt_extent_t* extents = (const ckpt_extent_t*)(runs + header->perm_runs);
+  if ((const Byte*)(extents + header->extents) > file + st.st_size) {
+    ckpt_bad(path, "is truncated");
+  }
+
+  state->progress = header->progress;
+  state->prog_numins = (int)header->prog_numins;
+  for (size_t i = 0; i < CKPT_COUNTERS; i++) {
+    *ckpt_counters[i] = header->counters[i];
+  }
+  *state->regfile_p = header->regfile;
+  *state->pregs_p = header->pregs;
+  *state->pwires_p = header->pwires;
+  csr_state = header->csr;
+
+  Cache* c = state->cache_p;
+  c->hit_count = cache->hit_count;
+  c->miss_count = cache->miss_count;
+  c->eviction_count = cache->eviction_count;
+  c->accesses = cache->accesses;
+  c->lruClock = (int)cache->lru_clock;
+  c->lineBufferHits = cache->line_buffer_hits;
+  for (uint64_t s = 0; s < cache_modeled_sets(c); s++) {
+    c->sets[s].lru_clock = (int)sets[s].lru_clock;
+    c->sets[s].accesses = sets[s].accesses;
+    c->sets[s].misses = sets[s].misses;
+    c->sets[s].evictions = sets[s].evictions;
+    c->sets[s].line_buffer_hits = sets[s].line_buffer_hits;
+    memcpy(c->sets[s].lines, lines + s * c->linesPerSet, c->linesPerSet * sizeof(Line));
+  }
+  if (c->lineBufferSize > 0) {
+    const unsigned long long* buffer = (const unsigned long long*)(lines + cache_modeled_sets(c) * c->linesPerSet);
+    memcpy(c->lineBuffer, buffer, c->lineBufferSize * sizeof(unsigned long long));
+    memcpy(c->lineBufferWays, buffer + c->lineBufferSize, c->lineBufferSize * sizeof(int));
+  }
+
+  for (uint32_t e = 0; e < header->extents; e++) {
+    uint64_t len = (uint64_t)extents[e].count << GUEST_PAGE_BITS;
+    if (extents[e].offset + len > (uint64_t)st.st_size ||
+        ((uint64_t)extents[e].first << GUEST_PAGE_BITS) + len > GUEST_SPACE_SIZE) {
+      ckpt_bad(path, "is truncated");
+    }
+    mem_map_file((Address)extents[e].first << GUEST_PAGE_BITS, len, fd, (off_t)extents[e].offset);
+  }
+
+  // mem_map_file() left the extents read/write, the rest is still inaccessible
+  for (uint32_t r = 0; r < header->perm_runs; r++) {
+    mem_protect((Address)runs[r].first << GUEST_PAGE_BITS, (uint64_t)runs[r].count << GUEST_PAGE_BITS, runs[r].perm);
+  }
+
+  munmap((void*)file, st.st_size);
+  close(fd);  // the guest mappings keep the file open
+}
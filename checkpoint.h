@@ -0,0 +1,64 @@
+#ifndef __CHECKPOINT_H__
+#define __CHECKPOINT_H__
+
+#include <stdint.h>
+#include "types.h"
+#include "riscv.h"
+#include "cache.h"
+#include "pipeline.h"
+
+///////////////////////////////////////////////////////////////////////////////
+/// Checkpoint and restore of the whole simulator state
+///////////////////////////////////////////////////////////////////////////////
+
+/**
+ * A checkpoint holds everything needed to continue a run from the point it
+ * was taken: register file and PC, pipeline registers and wires, the cache
+ * (every line, LRU/LFU state and counters), the statistics counters, the
+ * guest-visible performance counters, the page permissions and guest memory.
+ *
+ * Only pages that contain something other than zeros are stored. They are
+ * kept in runs of consecutive pages, each aligned to a guest page in the
+ * file, so a restore maps the runs straight into guest memory (copy on
+ * write) instead of reading them. The file is only valid for a build with
+ * the same structure layouts and a run with the same cache geometry and
+ * index function; the header records these and a mismatch is refused.
+ *
+ * The settings (tracing, forwarding, cache on/off, latency) are not part of
+ * the checkpoint; the resumed run uses the ones it was started with.
+ */
+
+#define CKPT_MAGIC    "RVCKPT\x0a"  // last byte is the format version
+
+typedef enum
+{
+  CKPT_EMULATOR = 1,   // progress counts executed instructions
+  CKPT_PIPELINE = 2,   // progress counts cycle_pipeline() calls
+}ckpt_mode_t;
+
+// the state a checkpoint is taken from or restored into
+typedef struct
+{
+  ckpt_mode_t       mode;
+  uint64_t          progress;
+  int               prog_numins;  // length of the program (for runs without -e)
+  regfile_t*        regfile_p;
+  pipeline_regs_t*  pregs_p;      // unused for CKPT_EMULATOR
+  pipeline_wires_t* pwires_p;
+  Cache*            cache_p;
+  Byte*             memory_p;     // guest memory from mem_init()
+}ckpt_state_t;
+
+/**
+ * Writes the checkpoint to path. Exits if the file can't be written.
+ **/
+void ckpt_save(const char* path, const ckpt_state_t* state);
+
+/**
+ * Loads the checkpoint at path into state. Guest memory must still be as
+ * mem_init() left it (nothing loaded). The mode must match state->mode.
+ * Exits if the file is unreadable or was written by an incompatible build.
+ **/
+void ckpt_restore(const char* path, ckpt_state_t* state);
+
+#endif  // __CHECKPOINT_H__
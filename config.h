@@ -1,6 +1,12 @@
 #ifndef __CONFIG_H__
 #define __CONFIG_H__
 
+// These macros only set the defaults. The same settings can be chosen at run
+// time without rebuilding: --milestone=1|2|3 selects a block below, and
+// --trace=cycle,regs,cache / --stats=pipeline,cache,mem / --mem-latency=N
+// set them individually (CACHE_ENABLE is -c). Tracing and stats only choose
+// what is printed; FLUSH_BRANCHES is set by --milestone=2|3.
+//
 // For each test, uncomment all its macros, and disable all other macros.
 
 // required for MS1 (test_simulator_ms1.sh)
@@ -13,19 +19,25 @@
 // #define DEBUG_REG_TRACE
 // #define DEBUG_CYCLE
 // #define PRINT_STATS		// prints overall stats
+// #define FLUSH_BRANCHES	// squashes the wrong path after a taken branch
 // #define MEM_LATENCY 0
 
 // required for MS2: vec_xprod.input (test_simulator_ms2_extended.sh)
 // #define PRINT_STATS
+// #define FLUSH_BRANCHES
 // #define MEM_LATENCY 0
 
 // required for MS3: (test_simulator_ms3.sh)
 // #define DEBUG_REG_TRACE
 // #define DEBUG_CYCLE
 // #define PRINT_STATS
+// #define FLUSH_BRANCHES
 // #define MEM_LATENCY 100
 // #define CACHE_ENABLE 		// enable cache simulation
 // #define PRINT_CACHE_TRACES      // prints cache trace for each memory access 
 // #define PRINT_CACHE_STATS	// prints the cache stats at the end of program
 
+// optional, any test
+// #define PRINT_MEM_STATS	// prints the resident guest memory at the end of program
+
 #endif // __CONFIG_H__
@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "types.h"
+#include "utils.h"
+#include "riscv.h"
+#include "pipeline.h"
+#include "memory.h"
+#include "cosim.h"
+
+// Architectural state of the reference model
+static regfile_t cosim_regs;
+static Byte*     cosim_memory = NULL;
+static uint64_t  cosim_count = 0;
+
+Byte* cosim_init(const regfile_t* regfile_p)
+{
+  cosim_regs = *regfile_p;
+  cosim_regs.R[0] = 0;
+  if (cosim_memory == NULL) {
+    cosim_memory = mem_create();
+  }
+  cosim_count = 0;
+  return cosim_memory;
+}
+
+uint64_t cosim_retired(void)
+{
+  return cosim_count;
+}
+
+static void cosim_print_instruction(const char* who, Address pc, Word bits)
+{
+  printf("[COSIM]:   %-9s %08x: ", who, pc);
+  decode_instruction(bits);
+}
+
+void cosim_retire(const memwb_reg_t* memwb_reg, const regfile_t* regfile_p)
+{
+  Address pc = cosim_regs.PC;
+  Instruction instruction;
+  instruction.bits = load(cosim_memory, pc, LENGTH_WORD);
+
+  // what a store should leave behind, taken before the reference executes it
+  bool is_store = (instruction.opcode == 0x23);
+  Address store_addr = 0;
+  Word store_mask = 0;
+  Word store_value = 0;
+  if (is_store) {
+    store_addr = cosim_regs.R[instruction.stype.rs1] + get_store_offset(instruction);
+    store_mask = (instruction.stype.funct3 == 0x0) ? 0xFF :
+                 (instruction.stype.funct3 == 0x1) ? 0xFFFF : 0xFFFFFFFF;
+    store_value = cosim_regs.R[instruction.stype.rs2] & store_mask;
+  }
+
+  if (instruction.opcode == 0x73) {
+    // counters differ between the models, take what the pipeline read
+    if (instruction.itype.funct3 != 0x0) {
+      cosim_regs.R[instruction.itype.rd] = regfile_p->R[instruction.itype.rd];
+    }
+    cosim_regs.PC += 4;
+  } else {
+    execute_instruction(instruction.bits, &cosim_regs, cosim_memory);
+  }
+  cosim_regs.R[0] = 0;
+  cosim_count++;
+
+  bool pc_ok = (memwb_reg->instr_addr == pc) && (memwb_reg->instr.bits == instruction.bits);
+  bool store_ok = !is_store || ((memwb_reg->alu_result == store_addr) &&
+                                ((memwb_reg->write_data & store_mask) == store_value));
+  bool regs_ok = true;
+  for (int i = 1; i < 32; i++) {
+    regs_ok = regs_ok && (regfile_p->R[i] == cosim_regs.R[i]);
+  }
+  if (pc_ok && store_ok && regs_ok) {
+    return;
+  }
+
+  printf("[COSIM]: divergence at retired instruction #%lu, cycle %lu\n",
+         (unsigned long)cosim_count, (unsigned long)total_cycle_counter);
+  cosim_print_instruction("pipeline", memwb_reg->instr_addr, memwb_reg->instr.bits);
+  cosim_print_instruction("reference", pc, instruction.bits);
+  for (int i = 1; i < 32; i++) {
+    if (regfile_p->R[i] != cosim_regs.R[i]) {
+      printf("[COSIM]:   x%-2d pipeline=%08x reference=%08x\n", i, regfile_p->R[i], cosim_regs.R[i]);
+    }
+  }
+  if (!store_ok) {
+    printf("[COSIM]:   store pipeline [%08x]=%08x reference [%08x]=%08x\n",
+           memwb_reg->alu_result, memwb_reg->write_data & store_mask, store_addr, store_value);
+  }
+  exit(-1);
+}
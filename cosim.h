@@ -0,0 +1,41 @@
+#ifndef __COSIM_H__
+#define __COSIM_H__
+
+#include <stdbool.h>
+#include "types.h"
+#include "riscv.h"
+#include "pipeline.h"
+
+///////////////////////////////////////////////////////////////////////////////
+/// Lockstep co-simulation of the pipeline against the functional emulator
+///////////////////////////////////////////////////////////////////////////////
+
+/**
+ * execute_instruction() runs as a reference model next to cycle_pipeline(),
+ * on its own copy of the registers and memory. Every instruction that
+ * leaves stage_writeback() is executed once on the reference, and the two
+ * architectural states are compared: retired PC and instruction, x1..x31,
+ * and the address and value of stores. The first mismatch is reported and
+ * ends the simulation.
+ *
+ * System calls only advance the reference PC, as the pipeline does not
+ * perform them either.
+ */
+
+/**
+ * Snapshots the initial architectural state. Returns the reference memory,
+ * which must receive the same program image as the pipeline's memory.
+ **/
+Byte* cosim_init(const regfile_t* regfile_p);
+
+/**
+ * Checks one retired instruction (the memwb register just written back).
+ **/
+void cosim_retire(const memwb_reg_t* memwb_reg, const regfile_t* regfile_p);
+
+/**
+ * Number of instructions checked so far.
+ **/
+uint64_t cosim_retired(void);
+
+#endif  // __COSIM_H__
@@ -0,0 +1,126 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "types.h"
+#include "utils.h"
+#include "pipeline.h"
+#include "csr.h"
+
+csr_state_t csr_state;
+
+// CSR number ranges
+#define CSR_USER_COUNTERS     0xC00  // cycle, time, instret, hpmcounter3..31
+#define CSR_USER_COUNTERS_H   0xC80
+#define CSR_MACHINE_COUNTERS  0xB00  // mcycle, -, minstret, mhpmcounter3..31
+#define CSR_MACHINE_COUNTERS_H 0xB80
+#define CSR_MHPMEVENT         0x320  // mhpmevent3..31 at 0x323..0x33F
+
+#define CSR_CYCLE    0
+#define CSR_TIME     1
+#define CSR_INSTRET  2
+
+// what the event has counted so far
+static uint64_t csr_event_count(uint32_t event)
+{
+  switch (event) {
+    case CSR_EVENT_CACHE_MISS:   return miss_count;
+    case CSR_EVENT_CACHE_HIT:    return hit_count;
+    case CSR_EVENT_MEM_ACCESS:   return mem_access_counter;
+    case CSR_EVENT_STALL:        return stall_counter;
+    // detect_hazard() counts every stall once, unit_hazard() the ones it raises
+    case CSR_EVENT_LOAD_USE:     return stall_counter - unit_stall_counter - unit_busy_counter;
+    case CSR_EVENT_UNIT_STALL:   return unit_stall_counter + unit_busy_counter;
+    case CSR_EVENT_BRANCH_FLUSH: return branch_counter;
+    case CSR_EVENT_FWD_EXEX:     return fwd_exex_counter;
+    case CSR_EVENT_FWD_EXMEM:    return fwd_exmem_counter;
+    default:                     return 0;
+  }
+}
+
+// the count the counter's value is relative to
+static uint64_t csr_source(unsigned counter, csr_clock_t now)
+{
+  switch (counter) {
+    case CSR_CYCLE:
+    case CSR_TIME:
+      return now.cycle;
+    case CSR_INSTRET:
+      return now.instret;
+    default:
+      return csr_event_count(csr_state.event[counter]);
+  }
+}
+
+static void csr_illegal(Instruction instruction, const char* why)
+{
+  printf("Illegal CSR access (%s): 0x%08x\n", why, instruction.bits);
+  exit(-1);
+}
+
+// csrrw/csrrwi write src, csrrs/csrrsi set its bits, csrrc/csrrci clear them
+static Word csr_modify(unsigned op, Word old, Word src)
+{
+  switch (op) {
+    case 0x1: return src;
+    case 0x2: return old | src;
+    default:  return old & ~src;
+  }
+}
+
+Word csr_execute(Instruction instruction, Word src, csr_clock_t now)
+{
+  uint32_t csr = instruction.itype.imm;
+  unsigned op = instruction.itype.funct3 & 0x3;
+  bool write = (op == 0x1) || (instruction.itype.rs1 != 0);
+  unsigned counter = csr & (CSR_COUNTERS - 1);
+  uint64_t count = csr_source(counter, now) + csr_state.offset[counter];
+  bool high = false;
+  bool writable = false;
+
+  if (op == 0x0) {
+    csr_illegal(instruction, "funct3");
+  }
+
+  switch (csr & ~(CSR_COUNTERS - 1)) {
+    case CSR_USER_COUNTERS_H:
+      high = true;
+      // fall through
+    case CSR_USER_COUNTERS:
+      break;
+    case CSR_MACHINE_COUNTERS_H:
+      high = true;
+      // fall through
+    case CSR_MACHINE_COUNTERS:
+      if (counter == CSR_TIME) {
+        csr_illegal(instruction, "unknown CSR");  // there is no mtime CSR
+      }
+      writable = true;
+      break;
+    case CSR_MHPMEVENT:
+      if (counter < 3) {
+        csr_illegal(instruction, "unknown CSR");
+      }
+      Word event = csr_state.event[counter];
+      if (write) {
+        // the counter keeps its value and counts the new event from here on
+        Word value = csr_modify(op, event, src);
+        csr_state.event[counter] = (value < CSR_EVENTS) ? value : CSR_EVENT_NONE;
+        csr_state.offset[counter] = count - csr_source(counter, now);
+      }
+      return event;
+    default:
+      csr_illegal(instruction, "unknown CSR");
+  }
+
+  Word old = high ? (Word)(count >> 32) : (Word)count;
+  if (write) {
+    if (!writable) {
+      csr_illegal(instruction, "read-only");
+    }
+    Word value = csr_modify(op, old, src);
+    count = high ? ((count & 0xFFFFFFFFULL) | ((uint64_t)value << 32))
+                 : ((count & ~0xFFFFFFFFULL) | value);
+    csr_state.offset[counter] = count - csr_source(counter, now);
+  }
+  return old;
+}
@@ -0,0 +1,72 @@
+#ifndef __CSR_H__
+#define __CSR_H__
+
+#include <stdint.h>
+#include "types.h"
+
+///////////////////////////////////////////////////////////////////////////////
+/// Zicsr performance counters, readable by the guest
+///////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Guest code times its own regions with csrr, the way it would on hardware:
+ *
+ *   cycle/mcycle         0xC00/0xB00  cycles (the emulator counts one per instruction)
+ *   time                 0xC01        same as cycle, there is no separate timer
+ *   instret/minstret     0xC02/0xB02  retired instructions
+ *   hpmcounter3..31      0xC03-0xC1F  count the event selected by mhpmevent3..31
+ *   mhpmcounter3..31     0xB03-0xB1F
+ *   mhpmevent3..31       0x323-0x33F  an enum csr_event_enum value
+ *
+ * Each counter has its upper half at +0x80 (cycleh, mcycleh, ...). The user
+ * counters (0xCxx) are read-only; the machine ones can be written, e.g. to
+ * zero them before a region. A counter with no event selected holds its
+ * value. The events are the pipeline's statistics counters, so they only
+ * move under -s; the emulator has no timing model.
+ *
+ * Any other CSR, or a write to a read-only one, is an illegal instruction
+ * and ends the simulation.
+ */
+
+// mhpmevent values; anything else reads back as CSR_EVENT_NONE
+enum csr_event_enum
+{
+  CSR_EVENT_NONE,
+  CSR_EVENT_CACHE_MISS,     // miss_count
+  CSR_EVENT_CACHE_HIT,      // hit_count (cache and line buffer)
+  CSR_EVENT_MEM_ACCESS,     // mem_access_counter, accesses without a cache
+  CSR_EVENT_STALL,          // stall_counter, every hazard stall
+  CSR_EVENT_LOAD_USE,       // stalls for a load (or CSR read) result
+  CSR_EVENT_UNIT_STALL,     // stalls for a multiply/divide result or unit
+  CSR_EVENT_BRANCH_FLUSH,   // branch_counter, taken branches and jumps
+  CSR_EVENT_FWD_EXEX,       // fwd_exex_counter
+  CSR_EVENT_FWD_EXMEM,      // fwd_exmem_counter
+  CSR_EVENTS
+};
+
+#define CSR_COUNTERS 32  // cycle, time, instret, hpmcounter3..31
+
+// counter state, carried in checkpoints
+typedef struct
+{
+  uint64_t offset[CSR_COUNTERS];  // counter value minus the count of its source
+  uint32_t event[CSR_COUNTERS];   // mhpmevent, for 3..31
+}csr_state_t;
+
+extern csr_state_t csr_state;
+
+// the instruction's view of time
+typedef struct
+{
+  uint64_t cycle;
+  uint64_t instret;   // instructions retired before it
+}csr_clock_t;
+
+/**
+ * Executes csrrw, csrrs, csrrc or their immediate forms. src is the rs1
+ * value, or the zero-extended immediate. Returns the old value of the CSR
+ * for rd. csrrs/csrrc with x0 or an immediate of 0 only read.
+ **/
+Word csr_execute(Instruction instruction, Word src, csr_clock_t now);
+
+#endif  // __CSR_H__
@@ -10,12 +10,16 @@ void print_store(char *, Instruction);
 void print_branch(char *, Instruction);
 void print_lui(Instruction);
 void print_jal(Instruction);
+void print_jalr(Instruction);
+void print_auipc(Instruction);
 void print_ecall(Instruction);
+void print_csr(char *, Instruction);
 void write_rtype(Instruction);
 void write_itype_except_load(Instruction); 
 void write_load(Instruction);
 void write_store(Instruction);
 void write_branch(Instruction);
+void write_system(Instruction);
 
 
 void decode_instruction(uint32_t instruction_bits) {
@@ -50,8 +54,14 @@ void decode_instruction(uint32_t instruction_bits) {
         case 0x6F:
             print_jal(instruction);
             break;
+        case 0x67:
+            print_jalr(instruction);
+            break;
+        case 0x17:
+            print_auipc(instruction);
+            break;
         case 0x73:
-            print_ecall(instruction);
+            write_system(instruction);
             break;
         default: // undefined opcode
             handle_invalid_instruction(instruction);
@@ -60,16 +70,20 @@ void decode_instruction(uint32_t instruction_bits) {
 }
 
 void write_rtype(Instruction instruction) {
+    static char *const muldiv_names[] = {
+        "mul", "mulh", "mulhsu", "mulhu", "div", "divu", "rem", "remu"
+    };
     /* YOUR CODE HERE */
+    if (instruction.rtype.funct7 == 0x01) {
+        print_rtype(muldiv_names[instruction.rtype.funct3], instruction);
+        return;
+    }
     switch (instruction.rtype.funct3) {
         case 0x0:
             switch (instruction.rtype.funct7) {
                 case 0x0:
           print_rtype("add", instruction);
                     break;
-            case 0x1:
-                    print_rtype("mul", instruction);
-                    break;
                 case 0x20:
                     print_rtype("sub", instruction);
                     break;
@@ -87,9 +101,6 @@ void write_rtype(Instruction instruction) {
                 case 0x00:
                     print_rtype("sll", instruction);
                     break;
-                case 0x01:
-                    print_rtype("mulh", instruction);
-                    break;
                 default:
                     handle_invalid_instruction(instruction);
                     break;
@@ -110,9 +121,6 @@ void write_rtype(Instruction instruction) {
                 case 0x00:
                     print_rtype("xor", instruction);
                     break;
-                case 0x01:
-                    print_rtype("div", instruction);
-                    break;
                 default:
                     handle_invalid_instruction(instruction);
                     break;
@@ -136,9 +144,6 @@ void write_rtype(Instruction instruction) {
                 case 0x00:
                     print_rtype("or", instruction);
                     break;
-                case 0x01:
-                    print_rtype("rem", instruction);
-                    break;
                 default:
                     handle_invalid_instruction(instruction);
                     break; 
@@ -270,6 +275,47 @@ void write_branch(Instruction instruction) {
         case 0x1:
             print_branch("bne", instruction);
             break;   
+        case 0x4:
+            print_branch("blt", instruction);
+            break;
+        case 0x5:
+            print_branch("bge", instruction);
+            break;
+        case 0x6:
+            print_branch("bltu", instruction);
+            break;
+        case 0x7:
+            print_branch("bgeu", instruction);
+            break;
+        default:
+            handle_invalid_instruction(instruction);
+            break;
+    }
+}
+
+void write_system(Instruction instruction) {
+    switch (instruction.itype.funct3) {
+        case 0x0:
+            print_ecall(instruction);
+            break;
+        case 0x1:
+            print_csr("csrrw", instruction);
+            break;
+        case 0x2:
+            print_csr("csrrs", instruction);
+            break;
+        case 0x3:
+            print_csr("csrrc", instruction);
+            break;
+        case 0x5:
+            print_csr("csrrwi", instruction);
+            break;
+        case 0x6:
+            print_csr("csrrsi", instruction);
+            break;
+        case 0x7:
+            print_csr("csrrci", instruction);
+            break;
         default:
             handle_invalid_instruction(instruction);
             break;
@@ -315,7 +361,26 @@ void print_jal(Instruction instruction) {
     printf(JAL_FORMAT, instruction.ujtype.rd, get_jump_offset(instruction));
 }
 
+void print_jalr(Instruction instruction) {
+    printf(JALR_FORMAT, instruction.itype.rd, sign_extend_number(instruction.itype.imm, 12),
+           instruction.itype.rs1);
+}
+
+void print_auipc(Instruction instruction) {
+    printf(AUIPC_FORMAT, instruction.utype.rd, instruction.utype.imm);
+}
+
 void print_ecall(Instruction instruction) {
     /* YOUR CODE HERE */
     printf(ECALL_FORMAT);
+}
+
+void print_csr(char *name, Instruction instruction) {
+    if (instruction.itype.funct3 & 0x4) {  // immediate source in rs1
+        printf(CSRI_FORMAT, name, instruction.itype.rd, instruction.itype.imm,
+               instruction.itype.rs1);
+    } else {
+        printf(CSR_FORMAT, name, instruction.itype.rd, instruction.itype.imm,
+               instruction.itype.rs1);
+    }
 }
\ No newline at end of file
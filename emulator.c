@@ -1,17 +1,22 @@
 #include <stdio.h> // for stderr
 #include <stdlib.h> // for exit()
+#include <string.h> // for memcpy()
 #include "types.h"
 #include "utils.h"
 #include "riscv.h"
+#include "csr.h"
 
 void execute_rtype(Instruction, Processor *);
 void execute_itype_except_load(Instruction, Processor *);
 void execute_branch(Instruction, Processor *);
 void execute_jal(Instruction, Processor *);
+void execute_jalr(Instruction, Processor *);
 void execute_load(Instruction, Processor *, Byte *);
 void execute_store(Instruction, Processor *, Byte *);
 void execute_ecall(Processor *, Byte *);
+void execute_csr(Instruction, Processor *);
 void execute_lui(Instruction, Processor *);
+void execute_auipc(Instruction, Processor *);
 
 void execute_instruction(uint32_t instruction_bits, Processor *processor,Byte *memory) {    
     Instruction instruction = parse_instruction(instruction_bits);
@@ -23,7 +28,11 @@ void execute_instruction(uint32_t instruction_bits, Processor *processor,Byte *m
             execute_itype_except_load(instruction, processor);
             break;
         case 0x73:
-            execute_ecall(processor, memory);
+            if (instruction.itype.funct3 == 0x0) {
+                execute_ecall(processor, memory);
+            } else {
+                execute_csr(instruction, processor);
+            }
             break;
         case 0x63:
             execute_branch(instruction, processor);
@@ -31,6 +40,9 @@ void execute_instruction(uint32_t instruction_bits, Processor *processor,Byte *m
         case 0x6F:
             execute_jal(instruction, processor);
             break;
+        case 0x67:
+            execute_jalr(instruction, processor);
+            break;
         case 0x23:
             execute_store(instruction, processor, memory);
             break;
@@ -40,6 +52,9 @@ void execute_instruction(uint32_t instruction_bits, Processor *processor,Byte *m
         case 0x37:
             execute_lui(instruction, processor);
             break;
+        case 0x17:
+            execute_auipc(instruction, processor);
+            break;
         default: // undefined opcode
             handle_invalid_instruction(instruction);
             exit(-1);
@@ -48,6 +63,15 @@ void execute_instruction(uint32_t instruction_bits, Processor *processor,Byte *m
 }
 
 void execute_rtype(Instruction instruction, Processor *processor) {
+    if (instruction.rtype.funct7 == 0x01) {
+        // RV32M: mul, mulh, mulhsu, mulhu, div, divu, rem, remu
+        processor->R[instruction.rtype.rd] =
+            muldiv_result(instruction.rtype.funct3,
+                          processor->R[instruction.rtype.rs1],
+                          processor->R[instruction.rtype.rs2]);
+        processor->PC += 4;
+        return;
+    }
     switch (instruction.rtype.funct3){
         case 0x0:
             switch (instruction.rtype.funct7) {
@@ -57,12 +81,6 @@ void execute_rtype(Instruction instruction, Processor *processor) {
                         ((sWord)processor->R[instruction.rtype.rs1]) +
                         ((sWord)processor->R[instruction.rtype.rs2]);
                     break;
-                case 0x1:
-                    // Mul
-                    processor->R[instruction.rtype.rd] =
-                        ((sWord)processor->R[instruction.rtype.rs1]) *
-                        ((sWord)processor->R[instruction.rtype.rs2]);
-                    break;
                 case 0x20:
                     // Sub
                     processor->R[instruction.rtype.rd] =
@@ -85,12 +103,6 @@ void execute_rtype(Instruction instruction, Processor *processor) {
                         (processor->R[instruction.rtype.rs1]) <<
                         (processor->R[instruction.rtype.rs2]);
                     break;
-                case 0x01:
-                    // mulh
-                    processor->R[instruction.rtype.rd] = 
-                        (   ((sDouble)(sWord)processor->R[instruction.rtype.rs1]) *
-                            ((sDouble)(sWord)processor->R[instruction.rtype.rs2])   ) >> 32;
-                    break;
                 default:
                     handle_invalid_instruction(instruction);
                     exit(-1);
@@ -119,12 +131,6 @@ void execute_rtype(Instruction instruction, Processor *processor) {
                         (processor->R[instruction.rtype.rs1]) ^
                         (processor->R[instruction.rtype.rs2]);
                     break;
-                case 0x01:
-                    //div
-                    processor->R[instruction.rtype.rd] = 
-                        ((sWord)processor->R[instruction.rtype.rs1]) /
-                        ((sWord)processor->R[instruction.rtype.rs2]);
-                    break;
                 default:
                     handle_invalid_instruction(instruction);
                     exit(-1);
@@ -160,12 +166,6 @@ void execute_rtype(Instruction instruction, Processor *processor) {
                         (processor->R[instruction.rtype.rs1]) |
                         (processor->R[instruction.rtype.rs2]);
                     break;
-                case 0x01:
-                    //rem
-                    processor->R[instruction.rtype.rd] =
-                        ((sWord)processor->R[instruction.rtype.rs1]) %
-                        ((sWord)processor->R[instruction.rtype.rs2]);
-                    break; 
                 default:
                     handle_invalid_instruction(instruction);
                     exit(-1);
@@ -292,7 +292,7 @@ void execute_ecall(Processor *p, Byte *memory) {
             p->PC += 4;
             break;
         case 4: // print a string
-            for(i=p->R[11];i<MEMORY_SPACE && load(memory,i,LENGTH_BYTE);i++) {
+            for(i=p->R[11];load(memory,i,LENGTH_BYTE);i++) {
                 printf("%c",load(memory,i,LENGTH_BYTE));
             }
             p->PC += 4;
@@ -331,6 +331,38 @@ void execute_branch(Instruction instruction, Processor *processor) {
                 processor->PC += 4;
             }
             break;
+        case 0x4:
+            //blt
+            if((sWord)processor->R[instruction.sbtype.rs1] < (sWord)processor->R[instruction.sbtype.rs2]) {
+                processor->PC += get_branch_offset(instruction);
+            } else {
+                processor->PC += 4;
+            }
+            break;
+        case 0x5:
+            //bge
+            if((sWord)processor->R[instruction.sbtype.rs1] >= (sWord)processor->R[instruction.sbtype.rs2]) {
+                processor->PC += get_branch_offset(instruction);
+            } else {
+                processor->PC += 4;
+            }
+            break;
+        case 0x6:
+            //bltu
+            if(processor->R[instruction.sbtype.rs1] < processor->R[instruction.sbtype.rs2]) {
+                processor->PC += get_branch_offset(instruction);
+            } else {
+                processor->PC += 4;
+            }
+            break;
+        case 0x7:
+            //bgeu
+            if(processor->R[instruction.sbtype.rs1] >= processor->R[instruction.sbtype.rs2]) {
+                processor->PC += get_branch_offset(instruction);
+            } else {
+                processor->PC += 4;
+            }
+            break;
         default:
             handle_invalid_instruction(instruction);
             exit(-1);
@@ -403,6 +435,18 @@ void execute_jal(Instruction instruction, Processor *processor) {
     processor->PC += get_jump_offset(instruction);
 }
 
+void execute_jalr(Instruction instruction, Processor *processor) {
+    if (instruction.itype.funct3 != 0x0) {
+        handle_invalid_instruction(instruction);
+        exit(-1);
+    }
+    // the target is read before the link is written, rd may equal rs1
+    Address target = (processor->R[instruction.itype.rs1] +
+                      sign_extend_number(instruction.itype.imm, 12)) & ~1U;
+    processor->R[instruction.itype.rd] = (processor->PC + 4);
+    processor->PC = target;
+}
+
 void execute_lui(Instruction instruction, Processor *processor) {
     /* YOUR CODE HERE */
     //Not sure if the imm value should be sign extended
@@ -410,35 +454,86 @@ void execute_lui(Instruction instruction, Processor *processor) {
     processor->PC += 4;
 }
 
+void execute_auipc(Instruction instruction, Processor *processor) {
+    processor->R[instruction.utype.rd] = processor->PC + (instruction.utype.imm << 12);
+    processor->PC += 4;
+}
+
+void execute_csr(Instruction instruction, Processor *processor) {
+    // no timing model here, every instruction counts as one cycle
+    csr_clock_t now = { emu_retired_counter, emu_retired_counter };
+    Word src = (instruction.itype.funct3 & 0x4) ? instruction.itype.rs1
+                                                : processor->R[instruction.itype.rs1];
+    processor->R[instruction.itype.rd] = csr_execute(instruction, src, now);
+    processor->PC += 4;
+}
+
+/* Aligned accesses are served by a single native load/store. Guest memory is
+ * little-endian, so on a little-endian host the bytes are already in order.
+ * There is no bounds or permission check here: bad accesses fault on the host
+ * and are reported by the handler in memory.c. */
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define NATIVE_LITTLE_ENDIAN 1
+#else
+#define NATIVE_LITTLE_ENDIAN 0
+#endif
+
+static inline int is_aligned(Address address, Alignment alignment) {
+    return (address & (alignment - 1)) == 0;
+}
+
 void store(Byte *memory, Address address, Alignment alignment, Word value) {
-    /* YOUR CODE HERE */
-    if(alignment == LENGTH_BYTE) {
-        memory[address] = value & 0xFF;
-    } else if(alignment == LENGTH_HALF_WORD) {
-        memory[address] = value & 0xFF;
-        memory[address + 1] = (value >> 8) & 0xFF;
-    } else if(alignment == LENGTH_WORD) {
-        memory[address] = value & 0xFF;
-        memory[address + 1] = (value >> 8) & 0xFF;
-        memory[address + 2] = (value >> 16) & 0xFF;   
-        memory[address + 3] = (value >> 24) & 0xFF;   
-    } else {
+    if(alignment != LENGTH_BYTE && alignment != LENGTH_HALF_WORD && alignment != LENGTH_WORD) {
         printf("Error: Unrecognized alignment %d\n", alignment);
         exit(-1);
-    }   
-   
+    }
+
+    if(NATIVE_LITTLE_ENDIAN && is_aligned(address, alignment)) {
+        // fast path
+        if(alignment == LENGTH_WORD) {
+            Word w = value;
+            memcpy(&memory[address], &w, sizeof(Word));
+        } else if(alignment == LENGTH_HALF_WORD) {
+            Half h = value & 0xFFFF;
+            memcpy(&memory[address], &h, sizeof(Half));
+        } else {
+            memory[address] = value & 0xFF;
+        }
+        return;
+    }
+
+    // misaligned (or big-endian host) slow path, one byte at a time; the
+    // address wraps around at the top of the 32-bit space
+    for(unsigned i = 0; i < alignment; i++) {
+        memory[(Address)(address + i)] = (value >> (8 * i)) & 0xFF;
+    }
 }
 
 Word load(Byte *memory, Address address, Alignment alignment) {
-    if(alignment == LENGTH_BYTE) {
-        return memory[address];
-    } else if(alignment == LENGTH_HALF_WORD) {
-        return (memory[address+1] << 8) + memory[address];
-    } else if(alignment == LENGTH_WORD) {
-        return (memory[address+3] << 24) + (memory[address+2] << 16)
-               + (memory[address+1] << 8) + memory[address];
-    } else {
+    if(alignment != LENGTH_BYTE && alignment != LENGTH_HALF_WORD && alignment != LENGTH_WORD) {
         printf("Error: Unrecognized alignment %d\n", alignment);
         exit(-1);
     }
+
+    if(NATIVE_LITTLE_ENDIAN && is_aligned(address, alignment)) {
+        // fast path
+        if(alignment == LENGTH_WORD) {
+            Word w;
+            memcpy(&w, &memory[address], sizeof(Word));
+            return w;
+        } else if(alignment == LENGTH_HALF_WORD) {
+            Half h;
+            memcpy(&h, &memory[address], sizeof(Half));
+            return h;
+        }
+        return memory[address];
+    }
+
+    // misaligned (or big-endian host) slow path, one byte at a time; the
+    // address wraps around at the top of the 32-bit space
+    Word value = 0;
+    for(unsigned i = 0; i < alignment; i++) {
+        value |= (Word)memory[(Address)(address + i)] << (8 * i);
+    }
+    return value;
 }
@@ -0,0 +1,154 @@
+#define _GNU_SOURCE  // fopencookie()
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "expect.h"
+
+#define EXPECT_BUFFER_SIZE (64 * 1024)
+#define EXPECT_CONTEXT     3              // reference lines shown before a mismatch
+#define EXPECT_CYCLE_TAG   "v==============Cycle Counter ="
+
+static const char* expect_path = NULL;
+static const char* expect_ref = NULL;   // mapped reference
+static size_t      expect_size = 0;
+static size_t      expect_pos = 0;      // bytes matched so far
+
+static size_t expect_line_start(size_t pos)
+{
+  while (pos > 0 && expect_ref[pos - 1] != '\n') {
+    pos--;
+  }
+  return pos;
+}
+
+static size_t expect_line_number(size_t pos)
+{
+  size_t line = 1;
+  for (size_t i = 0; i < pos; i++) {
+    line += (expect_ref[i] == '\n');
+  }
+  return line;
+}
+
+static void expect_print_line(const char* prefix, const char* line, size_t len)
+{
+  const char* nl = memchr(line, '\n', len);
+  int n = (int)(nl ? (size_t)(nl - line) : len);
+  fprintf(stderr, "[EXPECT]: %s%.*s\n", prefix, n, line);
+}
+
+/**
+ * Reports a mismatch at reference offset pos and terminates. got/got_len is
+ * the output from pos on (possibly empty when the output ended early).
+ **/
+static void expect_fail(size_t pos, const char* got, size_t got_len)
+{
+  size_t start = expect_line_start(pos);
+
+  // the cycle is the closest cycle header above the mismatch
+  long cycle = -1;
+  for (size_t l = start; ; l = expect_line_start(l - 1)) {
+    size_t tag = strlen(EXPECT_CYCLE_TAG);
+    if (expect_size - l > tag && strncmp(expect_ref + l, EXPECT_CYCLE_TAG, tag) == 0) {
+      cycle = strtol(expect_ref + l + tag, NULL, 10);
+      break;
+    }
+    if (l == 0) break;
+  }
+
+  fprintf(stderr, "[EXPECT]: %s differs at line %zu", expect_path, expect_line_number(pos));
+  if (cycle >= 0) fprintf(stderr, " (cycle %ld)", cycle);
+  fprintf(stderr, "\n");
+
+  size_t ctx = start;
+  for (int i = 0; i < EXPECT_CONTEXT && ctx > 0; i++) {
+    ctx = expect_line_start(ctx - 1);
+  }
+  while (ctx < start) {
+    const char* line = expect_ref + ctx;
+    const char* nl = memchr(line, '\n', start - ctx);
+    expect_print_line("    ", line, start - ctx);
+    ctx += (size_t)(nl - line) + 1;
+  }
+
+  if (pos < expect_size) {
+    expect_print_line("  - ", expect_ref + start, expect_size - start);
+  } else {
+    fprintf(stderr, "[EXPECT]:   - <end of reference>\n");
+  }
+  if (got_len > 0) {
+    // the matched part of the line was already compared, rebuild it from the reference
+    const char* nl = memchr(got, '\n', got_len);
+    int n = (int)(nl ? (size_t)(nl - got) : got_len);
+    fprintf(stderr, "[EXPECT]:   + %.*s%.*s\n", (int)(pos - start), expect_ref + start, n, got);
+  } else {
+    fprintf(stderr, "[EXPECT]:   + <end of output>\n");
+  }
+  _exit(-1);
+}
+
+static ssize_t expect_write(void* cookie, const char* buf, size_t size)
+{
+  size_t avail = expect_size - expect_pos;
+  size_t n = size < avail ? size : avail;
+  const char* ref = expect_ref + expect_pos;
+
+  if (n < size || memcmp(ref, buf, n) != 0) {
+    size_t i = 0;
+    while (i < n && ref[i] == buf[i]) {
+      i++;
+    }
+    expect_fail(expect_pos + i, buf + i, size - i);
+  }
+  expect_pos += size;
+  return size;
+}
+
+static void expect_close(void)
+{
+  fflush(stdout);
+  if (expect_pos != expect_size) {
+    expect_fail(expect_pos, NULL, 0);
+  }
+}
+
+void expect_open(const char* path)
+{
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    printf("Error: unable to open reference trace %s\n", path);
+    exit(-1);
+  }
+  expect_size = st.st_size;
+  if (expect_size > 0) {
+    void* ref = mmap(NULL, expect_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (ref == MAP_FAILED) {
+      printf("Error: unable to map reference trace %s\n", path);
+      exit(-1);
+    }
+    madvise(ref, expect_size, MADV_SEQUENTIAL);
+    expect_ref = ref;
+  } else {
+    expect_ref = "";
+  }
+  close(fd);
+  expect_path = path;
+  expect_pos = 0;
+
+  cookie_io_functions_t io = { .read = NULL, .write = expect_write, .seek = NULL, .close = NULL };
+  FILE* f = fopencookie(NULL, "w", io);
+  if (f == NULL) {
+    printf("Error: unable to redirect output for --expect\n");
+    exit(-1);
+  }
+  setvbuf(f, NULL, _IOFBF, EXPECT_BUFFER_SIZE);
+  fflush(stdout);
+  stdout = f;
+  atexit(expect_close);
+}
@@ -0,0 +1,22 @@
+#ifndef __EXPECT_H__
+#define __EXPECT_H__
+
+///////////////////////////////////////////////////////////////////////////////
+/// In-process comparison of stdout against a reference trace
+///////////////////////////////////////////////////////////////////////////////
+
+/**
+ * After expect_open(), everything printed to stdout is compared against the
+ * reference file (mapped read-only) instead of being written anywhere. The
+ * first differing byte ends the run with a report on stderr: line number,
+ * the cycle it belongs to and the surrounding lines. If the run ends early,
+ * that is reported as a mismatch as well. The exit status is 0 only when the
+ * output matched the whole reference.
+ */
+
+/**
+ * Redirects stdout into the comparator. Exits if the file can't be mapped.
+ **/
+void expect_open(const char* path);
+
+#endif  // __EXPECT_H__
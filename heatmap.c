@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "types.h"
+#include "cache.h"
+#include "heatmap.h"
+#include "utils.h"
+
+bool heatmap_active = false;
+
+enum
+{
+  HEAT_CODE,
+  HEAT_DATA,
+  HEAT_STACK,
+  HEAT_OTHER,
+  HEAT_REGIONS
+};
+
+static const char* const heat_region_names[HEAT_REGIONS] = { "code", "data", "stack", "other" };
+
+// the counters of one set or region
+typedef struct
+{
+  unsigned long long accesses;
+  unsigned long long misses;
+  unsigned long long evictions;
+}heat_counts_t;
+
+static struct
+{
+  heatmap_opts_t  opts;
+  const Cache*    cache;
+  FILE*           out;
+  Address         data_start;
+  Address         data_end;
+  Address         stack_start;
+  uint64_t        sets;
+  heat_counts_t*  last;          // per set, at the start of the interval
+  heat_counts_t   regions[HEAT_REGIONS];
+  uint64_t        accesses;      // in the current interval
+  uint64_t        interval;      // rows written
+}heat;
+
+static int heat_region(Address address)
+{
+  if (address >= heat.opts.code_start && address < heat.opts.code_end) {
+    return HEAT_CODE;
+  }
+  if (address >= heat.data_start && address < heat.data_end) {
+    return HEAT_DATA;
+  }
+  if (address >= heat.stack_start && address <= heat.opts.sp) {
+    return HEAT_STACK;
+  }
+  return HEAT_OTHER;
+}
+
+static const char* const heat_counter_names[] = { "accesses", "misses", "evictions" };
+
+static heat_counts_t heat_set_counts(const Set* set)
+{
+  return (heat_counts_t){ set->accesses + set->line_buffer_hits, set->misses, set->evictions };
+}
+
+static unsigned long long heat_counter(heat_counts_t counts, int which)
+{
+  return which == 0 ? counts.accesses : which == 1 ? counts.misses : counts.evictions;
+}
+
+// writes the interval's rows and starts the next one
+static void heat_flush(void)
+{
+  for (int which = 0; which < 3; which++) {
+    fprintf(heat.out, "sets,%lu,%s", (unsigned long)heat.interval, heat_counter_names[which]);
+    for (uint64_t s = 0; s < heat.sets; s++) {
+      heat_counts_t now = heat_set_counts(&heat.cache->sets[s]);
+      fprintf(heat.out, ",%llu", heat_counter(now, which) - heat_counter(heat.last[s], which));
+    }
+    fputc('\n', heat.out);
+  }
+  for (uint64_t s = 0; s < heat.sets; s++) {
+    heat.last[s] = heat_set_counts(&heat.cache->sets[s]);
+  }
+
+  for (int r = 0; r < HEAT_REGIONS; r++) {
+    fprintf(heat.out, "region,%lu,%s,%llu,%llu,%llu\n", (unsigned long)heat.interval, heat_region_names[r],
+            heat.regions[r].accesses, heat.regions[r].misses, heat.regions[r].evictions);
+  }
+  memset(heat.regions, 0, sizeof(heat.regions));
+
+  heat.accesses = 0;
+  heat.interval++;
+}
+
+void heatmap_open(const heatmap_opts_t* opts, const Cache* cache_p)
+{
+  memset(&heat, 0, sizeof(heat));
+  heat.opts = *opts;
+  heat.cache = cache_p;
+  heat.data_start = opts->gp > HEAT_DATA_WINDOW ? opts->gp - HEAT_DATA_WINDOW : 0;
+  heat.data_end = opts->gp + HEAT_DATA_WINDOW;
+  heat.stack_start = opts->sp > HEAT_STACK_WINDOW ? opts->sp - HEAT_STACK_WINDOW : 0;
+  heat.sets = cache_modeled_sets(heat.cache);
+
+  heat.out = fopen(opts->path, "w");
+  heat.last = malloc(heat.sets * sizeof(heat_counts_t));
+  if (heat.out == NULL || heat.last == NULL) {
+    printf("Error: unable to write %s\n", opts->path);
+    exit(-1);
+  }
+  // the counters may not start at zero after --restore
+  for (uint64_t s = 0; s < heat.sets; s++) {
+    heat.last[s] = heat_set_counts(&heat.cache->sets[s]);
+  }
+
+  heatmap_active = true;
+  close_at_exit(heatmap_close);
+}
+
+void heatmap_record(Address address, int status)
+{
+  heat_counts_t* region = &heat.regions[heat_region(address)];
+  region->accesses++;
+  if (status == CACHE_MISS || status == CACHE_EVICT) {
+    region->misses++;
+  }
+  if (status == CACHE_EVICT) {
+    region->evictions++;
+  }
+  if (++heat.accesses == heat.opts.interval) {
+    heat_flush();
+  }
+}
+
+void heatmap_close(void)
+{
+  if (!heatmap_active) {
+    return;
+  }
+  heatmap_active = false;
+  if (heat.accesses > 0) {
+    heat_flush();
+  }
+  fclose(heat.out);
+  free(heat.last);
+  printf("[HEATMAP]: %lu intervals of %lu cache accesses written to %s\n",
+         (unsigned long)heat.interval, (unsigned long)heat.opts.interval, heat.opts.path);
+}
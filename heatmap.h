@@ -0,0 +1,65 @@
+#ifndef __HEATMAP_H__
+#define __HEATMAP_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "types.h"
+#include "cache.h"
+
+///////////////////////////////////////////////////////////////////////////////
+/// Cache heatmaps: per-set and per-region activity over time
+///////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Every interval cache accesses, the accesses, misses and evictions of each
+ * set during the interval are written as one row per counter, and the same
+ * counters for each address region as one row per region. Sets that keep
+ * missing while their neighbours hit are the ones the program's arrays
+ * collide in.
+ *
+ * The regions follow the initial register state: code is the loaded
+ * program, data is the HEAT_DATA_WINDOW bytes on either side of gp (the
+ * static data segment) and stack the HEAT_STACK_WINDOW bytes below the
+ * initial sp. Code takes precedence where the data window overlaps it.
+ * Anything else is other.
+ *
+ * The report is a CSV with the record type in the first column:
+ *
+ *   sets,<interval>,<accesses|misses|evictions>,<set 0>,<set 1>,...
+ *   region,<interval>,<code|data|stack|other>,<accesses>,<misses>,<evictions>
+ */
+
+#define HEAT_DATA_WINDOW   0x10000  // bytes on either side of gp
+#define HEAT_STACK_WINDOW  0x10000  // bytes below the initial sp
+
+typedef struct
+{
+  const char* path;
+  uint64_t    interval;     // cache accesses per row
+  Address     code_start;   // the loaded program
+  Address     code_end;
+  Address     gp;           // initial global pointer
+  Address     sp;           // initial stack pointer
+}heatmap_opts_t;
+
+// true between heatmap_open() and heatmap_close()
+extern bool heatmap_active;
+
+/**
+ * Starts recording the cache at cache_p, which must model every set. The
+ * report is completed by heatmap_close(), at exit at the latest.
+ **/
+void heatmap_open(const heatmap_opts_t* opts, const Cache* cache_p);
+
+/**
+ * Accounts for one cache access; status is its enum status_enum outcome.
+ * Called by operateCache().
+ **/
+void heatmap_record(Address address, int status);
+
+/**
+ * Writes the last, partial interval and closes the report.
+ **/
+void heatmap_close(void);
+
+#endif  // __HEATMAP_H__
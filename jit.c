@@ -0,0 +1,554 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "types.h"
+#include "blockcache.h"
+#include "jit.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+
+#include <sys/mman.h>
+
+// Host register numbers as used in ModRM/REX encodings
+enum
+{
+  RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7,
+  R8 = 8, R9 = 9, R10 = 10, R11 = 11, R12 = 12, R13 = 13, R14 = 14, R15 = 15
+};
+
+/**
+ * Register usage inside compiled code:
+ *   rbp = guest register file, r11 = guest memory, r10 = retired counter
+ *   eax, ecx, edx, esi = scratch
+ *   rbx, r12-r15, r8, r9 = the most used guest registers of the block
+ */
+static const uint8_t jit_host_regs[] = { RBX, R12, R13, R14, R15, R8, R9 };
+#define JIT_NUM_HOST_REGS (sizeof(jit_host_regs) / sizeof(jit_host_regs[0]))
+
+static uint8_t* jit_buffer = NULL;
+static size_t   jit_used = 0;
+static bool     jit_failed = false;
+
+// Host instructions that access guest memory, in emission order
+typedef struct
+{
+  uint32_t offset;  // into jit_buffer
+  Address  pc;      // guest instruction it implements
+}jit_site_t;
+
+static jit_site_t* jit_sites = NULL;
+static size_t      jit_nsites = 0;
+static size_t      jit_sites_cap = 0;
+
+typedef struct
+{
+  uint8_t* p;          // emit cursor
+  int8_t   host[32];   // host register caching guest register, or -1
+  uint32_t written;    // cached guest registers modified so far
+}jit_ctx_t;
+
+static inline void emit8(jit_ctx_t* c, uint8_t v)   { *c->p++ = v; }
+static inline void emit32(jit_ctx_t* c, uint32_t v) { memcpy(c->p, &v, 4); c->p += 4; }
+static inline void emit64(jit_ctx_t* c, uint64_t v) { memcpy(c->p, &v, 8); c->p += 8; }
+
+static inline uint8_t* emit_jcc32(jit_ctx_t* c, uint8_t cc)
+{
+  emit8(c, 0x0F); emit8(c, cc);
+  emit32(c, 0);
+  return c->p;  // end of the instruction, rel32 sits in the 4 bytes before
+}
+
+static inline void patch_rel32(uint8_t* end, uint8_t* target)
+{
+  int32_t rel = (int32_t)(target - end);
+  memcpy(end - 4, &rel, 4);
+}
+
+// mov r32(dst), r32(src)
+static void emit_mov_rr(jit_ctx_t* c, uint8_t dst, uint8_t src)
+{
+  uint8_t rex = 0x40 | ((src >> 3) << 2) | (dst >> 3);
+  if (rex != 0x40) emit8(c, rex);
+  emit8(c, 0x89);
+  emit8(c, 0xC0 | ((src & 7) << 3) | (dst & 7));
+}
+
+// mov r32, [rbp + 4*g]  /  mov [rbp + 4*g], r32
+static void emit_regfile(jit_ctx_t* c, uint8_t opcode, uint8_t host, uint8_t g)
+{
+  if (host >= 8) emit8(c, 0x44);
+  emit8(c, opcode);
+  emit8(c, 0x40 | ((host & 7) << 3) | RBP);
+  emit8(c, 4 * g);
+}
+
+// scratch <- guest register g
+static void jit_get(jit_ctx_t* c, uint8_t scratch, uint8_t g)
+{
+  if (g == 0) {
+    emit8(c, 0x31); emit8(c, 0xC0 | (scratch << 3) | scratch);  // xor r, r
+  } else if (c->host[g] >= 0) {
+    emit_mov_rr(c, scratch, c->host[g]);
+  } else {
+    emit_regfile(c, 0x8B, scratch, g);
+  }
+}
+
+// guest register g <- scratch
+static void jit_put(jit_ctx_t* c, uint8_t g, uint8_t scratch)
+{
+  if (g == 0) {
+    return;
+  }
+  if (c->host[g] >= 0) {
+    emit_mov_rr(c, c->host[g], scratch);
+    c->written |= 1U << g;
+  } else {
+    emit_regfile(c, 0x89, scratch, g);
+  }
+}
+
+/**
+ * Leaves the block: eax already holds the next guest PC.
+ **/
+static void jit_exit(jit_ctx_t* c, uint32_t retired)
+{
+  for (int g = 1; g < 32; g++) {
+    if (c->written & (1U << g)) {
+      emit_regfile(c, 0x89, c->host[g], g);
+    }
+  }
+  emit8(c, 0x41); emit8(c, 0xC7); emit8(c, 0x02); emit32(c, retired);  // mov dword [r10], retired
+  emit8(c, 0x41); emit8(c, 0x5F);  // pop r15
+  emit8(c, 0x41); emit8(c, 0x5E);  // pop r14
+  emit8(c, 0x41); emit8(c, 0x5D);  // pop r13
+  emit8(c, 0x41); emit8(c, 0x5C);  // pop r12
+  emit8(c, 0x5D);                  // pop rbp
+  emit8(c, 0x5B);                  // pop rbx
+  emit8(c, 0xC3);                  // ret
+}
+
+static void jit_side_exit(jit_ctx_t* c, Address pc, uint32_t retired)
+{
+  emit8(c, 0xB8); emit32(c, pc);  // mov eax, pc
+  jit_exit(c, retired);
+}
+
+/**
+ * eax <- eax (div/divu/rem/remu) ecx. A zero divisor, and -1 for the signed
+ * ones (the overflow case), leave through the interpreter, which returns the
+ * results the specification defines instead of trapping like the host.
+ **/
+static void jit_divide(jit_ctx_t* c, uint8_t kind, Address pc, uint32_t retired)
+{
+  bool is_signed = (kind == BB_DIV || kind == BB_REM);
+  emit8(c, 0x85); emit8(c, 0xC9);                      // test ecx, ecx
+  uint8_t* slow = NULL;
+  if (is_signed) {
+    slow = emit_jcc32(c, 0x84);                        // jz slow
+    emit8(c, 0x83); emit8(c, 0xF9); emit8(c, 0xFF);    // cmp ecx, -1
+  }
+  uint8_t* ok = emit_jcc32(c, 0x85);                   // jnz/jne ok
+  if (slow) {
+    patch_rel32(slow, c->p);
+  }
+  jit_side_exit(c, pc, retired);
+  patch_rel32(ok, c->p);
+
+  if (is_signed) {
+    emit8(c, 0x99);                                    // cdq
+    emit8(c, 0xF7); emit8(c, 0xF9);                    // idiv ecx
+  } else {
+    emit8(c, 0x31); emit8(c, 0xD2);                    // xor edx, edx
+    emit8(c, 0xF7); emit8(c, 0xF1);                    // div ecx
+  }
+  if (kind == BB_REM || kind == BB_REMU) {
+    emit8(c, 0x89); emit8(c, 0xD0);                    // mov eax, edx
+  }
+}
+
+/**
+ * Guest address in eax. Misaligned accesses leave through the interpreter,
+ * which wraps them around the top of the address space correctly. Aligned
+ * ones go straight to memory; permissions are enforced by the host mapping.
+ **/
+static void jit_align_check(jit_ctx_t* c, uint8_t len, Address pc, uint32_t retired)
+{
+  if (len == 1) {
+    return;
+  }
+  emit8(c, 0xA8); emit8(c, len - 1);  // test al, len - 1
+  uint8_t* ok = emit_jcc32(c, 0x84);  // jz ok
+  jit_side_exit(c, pc, retired);
+  patch_rel32(ok, c->p);
+}
+
+/**
+ * Remembers that the next emitted instruction touches guest memory on behalf
+ * of the instruction at pc, for jit_fault_pc().
+ **/
+static void jit_fault_site(jit_ctx_t* c, Address pc)
+{
+  if (jit_nsites == jit_sites_cap) {
+    size_t cap = jit_sites_cap ? 2 * jit_sites_cap : 1024;
+    jit_site_t* sites = realloc(jit_sites, cap * sizeof(jit_site_t));
+    if (sites == NULL) {
+      printf("Error: Unable to grow the JIT fault table\n");
+      exit(-1);
+    }
+    jit_sites = sites;
+    jit_sites_cap = cap;
+  }
+  jit_sites[jit_nsites].offset = (uint32_t)(c->p - jit_buffer);
+  jit_sites[jit_nsites].pc = pc;
+  jit_nsites++;
+}
+
+/**
+ * Counts register uses so the busiest guest registers live in host registers.
+ **/
+static void jit_alloc_regs(const bb_block_t* blk, jit_ctx_t* c)
+{
+  uint32_t uses[32] = {0};
+
+  for (uint32_t i = 0; i < blk->ninsns; i++) {
+    const bb_op_t* op = &blk->ops[i];
+    if (op->kind == BB_ECALL || op->kind == BB_FALLBACK || op->kind == BB_NOP) {
+      continue;
+    }
+    if (op->kind != BB_LUI && op->kind != BB_JAL) uses[op->rs1]++;
+    if (op->kind <= BB_REMU || (op->kind >= BB_SB && op->kind <= BB_SW) ||
+        (op->kind >= BB_BEQ && op->kind <= BB_BGEU)) {
+      uses[op->rs2]++;
+    }
+    if (op->kind < BB_SB || op->kind == BB_LUI || op->kind == BB_JAL || op->kind == BB_JALR) {
+      uses[op->rd]++;
+    }
+  }
+  uses[0] = 0;
+
+  memset(c->host, -1, sizeof(c->host));
+  for (unsigned h = 0; h < JIT_NUM_HOST_REGS; h++) {
+    int best = 0;
+    for (int g = 1; g < 32; g++) {
+      if (c->host[g] < 0 && uses[g] > uses[best]) best = g;
+    }
+    if (uses[best] < 2) {
+      break;
+    }
+    c->host[best] = jit_host_regs[h];
+  }
+}
+
+// eax <- eax (op) ecx for the plain two-register ALU ops
+static bool jit_alu_rr(jit_ctx_t* c, uint8_t kind)
+{
+  switch (kind) {
+    case BB_ADD: emit8(c, 0x01); emit8(c, 0xC8); break;
+    case BB_SUB: emit8(c, 0x29); emit8(c, 0xC8); break;
+    case BB_AND: emit8(c, 0x21); emit8(c, 0xC8); break;
+    case BB_OR:  emit8(c, 0x09); emit8(c, 0xC8); break;
+    case BB_XOR: emit8(c, 0x31); emit8(c, 0xC8); break;
+    case BB_SLL: emit8(c, 0xD3); emit8(c, 0xE0); break;  // shl eax, cl
+    case BB_SRL: emit8(c, 0xD3); emit8(c, 0xE8); break;  // shr eax, cl
+    case BB_SRA: emit8(c, 0xD3); emit8(c, 0xF8); break;  // sar eax, cl
+    case BB_MUL: emit8(c, 0x0F); emit8(c, 0xAF); emit8(c, 0xC1); break;  // imul eax, ecx
+    case BB_SLT:
+      emit8(c, 0x39); emit8(c, 0xC8);                    // cmp eax, ecx
+      emit8(c, 0x0F); emit8(c, 0x9C); emit8(c, 0xC0);    // setl al
+      emit8(c, 0x0F); emit8(c, 0xB6); emit8(c, 0xC0);    // movzx eax, al
+      break;
+    case BB_MULH:
+      emit8(c, 0x48); emit8(c, 0x63); emit8(c, 0xC0);    // movsxd rax, eax
+      emit8(c, 0x48); emit8(c, 0x63); emit8(c, 0xC9);    // movsxd rcx, ecx
+      emit8(c, 0x48); emit8(c, 0x0F); emit8(c, 0xAF); emit8(c, 0xC1);  // imul rax, rcx
+      emit8(c, 0x48); emit8(c, 0xC1); emit8(c, 0xF8); emit8(c, 0x20);  // sar rax, 32
+      break;
+    case BB_MULHSU:  // ecx is zero-extended into rcx
+      emit8(c, 0x48); emit8(c, 0x63); emit8(c, 0xC0);    // movsxd rax, eax
+      emit8(c, 0x48); emit8(c, 0x0F); emit8(c, 0xAF); emit8(c, 0xC1);  // imul rax, rcx
+      emit8(c, 0x48); emit8(c, 0xC1); emit8(c, 0xF8); emit8(c, 0x20);  // sar rax, 32
+      break;
+    case BB_MULHU:   // both zero-extended, the low 64 bits of the product are exact
+      emit8(c, 0x48); emit8(c, 0x0F); emit8(c, 0xAF); emit8(c, 0xC1);  // imul rax, rcx
+      emit8(c, 0x48); emit8(c, 0xC1); emit8(c, 0xE8); emit8(c, 0x20);  // shr rax, 32
+      break;
+    default:
+      return false;
+  }
+  return true;
+}
+
+// eax <- eax (op) imm for the register-immediate ALU ops
+static bool jit_alu_ri(jit_ctx_t* c, uint8_t kind, int32_t imm)
+{
+  switch (kind) {
+    case BB_ADDI: if (imm != 0) { emit8(c, 0x05); emit32(c, imm); } break;
+    case BB_ANDI: emit8(c, 0x25); emit32(c, imm); break;
+    case BB_ORI:  emit8(c, 0x0D); emit32(c, imm); break;
+    case BB_XORI: emit8(c, 0x35); emit32(c, imm); break;
+    case BB_SLLI: emit8(c, 0xC1); emit8(c, 0xE0); emit8(c, imm); break;
+    case BB_SRLI: emit8(c, 0xC1); emit8(c, 0xE8); emit8(c, imm); break;
+    case BB_SRAI: emit8(c, 0xC1); emit8(c, 0xF8); emit8(c, imm); break;
+    case BB_SLTI:
+      emit8(c, 0x3D); emit32(c, imm);                    // cmp eax, imm
+      emit8(c, 0x0F); emit8(c, 0x9C); emit8(c, 0xC0);    // setl al
+      emit8(c, 0x0F); emit8(c, 0xB6); emit8(c, 0xC0);    // movzx eax, al
+      break;
+    default:
+      return false;
+  }
+  return true;
+}
+
+bool jit_available(void)
+{
+  if (jit_buffer == NULL && !jit_failed) {
+    void* buf = mmap(NULL, JIT_BUFFER_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buf == MAP_FAILED) {
+      fprintf(stderr, "[JIT]: unable to map executable memory, staying in the interpreter\n");
+      jit_failed = true;
+    } else {
+      jit_buffer = buf;
+      jit_used = 0;
+    }
+  }
+  return jit_buffer != NULL;
+}
+
+void jit_reset(void)
+{
+  jit_used = 0;
+  jit_nsites = 0;
+}
+
+bool jit_fault_pc(const void* host_pc, Address* pc)
+{
+  if (jit_buffer == NULL || (const uint8_t*)host_pc < jit_buffer ||
+      (const uint8_t*)host_pc >= jit_buffer + jit_used) {
+    return false;
+  }
+
+  // sites are sorted by offset, the buffer only grows between resets
+  uint32_t offset = (uint32_t)((const uint8_t*)host_pc - jit_buffer);
+  size_t lo = 0, hi = jit_nsites;
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    if (jit_sites[mid].offset < offset) lo = mid + 1;
+    else hi = mid;
+  }
+  if (lo == jit_nsites || jit_sites[lo].offset != offset) {
+    return false;
+  }
+  *pc = jit_sites[lo].pc;
+  return true;
+}
+
+void* jit_compile(const bb_block_t* blk)
+{
+  if (!jit_available()) {
+    return NULL;
+  }
+  // nothing worth compiling if the first instruction needs the interpreter
+  if (blk->ops[0].kind == BB_ECALL || blk->ops[0].kind == BB_FALLBACK) {
+    return NULL;
+  }
+  if (jit_used + JIT_BLOCK_RESERVE > JIT_BUFFER_SIZE) {
+    // out of space; already compiled blocks stay valid until the next flush
+    return NULL;
+  }
+
+  jit_ctx_t ctx;
+  jit_ctx_t* c = &ctx;
+  uint8_t* entry = jit_buffer + jit_used;
+
+  c->p = entry;
+  c->written = 0;
+  jit_alloc_regs(blk, c);
+
+  // prologue
+  emit8(c, 0x53);                  // push rbx
+  emit8(c, 0x55);                  // push rbp
+  emit8(c, 0x41); emit8(c, 0x54);  // push r12
+  emit8(c, 0x41); emit8(c, 0x55);  // push r13
+  emit8(c, 0x41); emit8(c, 0x56);  // push r14
+  emit8(c, 0x41); emit8(c, 0x57);  // push r15
+  emit8(c, 0x48); emit8(c, 0x89); emit8(c, 0xFD);  // mov rbp, rdi
+  emit8(c, 0x49); emit8(c, 0x89); emit8(c, 0xF3);  // mov r11, rsi
+  emit8(c, 0x49); emit8(c, 0x89); emit8(c, 0xD2);  // mov r10, rdx
+  for (int g = 1; g < 32; g++) {
+    if (c->host[g] >= 0) {
+      emit_regfile(c, 0x8B, c->host[g], g);
+    }
+  }
+
+  // blocks cut at BB_MAX_INSNS carry an extra BB_FALLTHRU record
+  uint32_t nops = (blk->ops[blk->ninsns - 1].kind < BB_BEQ) ? blk->ninsns + 1 : blk->ninsns;
+
+  for (uint32_t i = 0; i < nops; i++) {
+    const bb_op_t* op = &blk->ops[i];
+    Address pc = blk->start + 4 * i;
+
+    switch (op->kind) {
+      case BB_NOP:
+        break;
+
+      case BB_LUI:
+        emit8(c, 0xB8); emit32(c, op->imm);  // mov eax, imm
+        jit_put(c, op->rd, RAX);
+        break;
+
+      case BB_LB:
+      case BB_LH:
+      case BB_LW:
+        jit_get(c, RAX, op->rs1);
+        jit_alu_ri(c, BB_ADDI, op->imm);
+        jit_align_check(c, (op->kind == BB_LB) ? 1 : (op->kind == BB_LH) ? 2 : 4, pc, i);
+        jit_fault_site(c, pc);
+        emit8(c, 0x41);  // [r11 + rax]
+        if (op->kind == BB_LW) {
+          emit8(c, 0x8B);
+        } else {
+          emit8(c, 0x0F); emit8(c, op->kind == BB_LB ? 0xBE : 0xBF);  // movsx
+        }
+        emit8(c, 0x04); emit8(c, 0x03);
+        jit_put(c, op->rd, RAX);
+        break;
+
+      case BB_SB:
+      case BB_SH:
+      case BB_SW:
+      {
+        uint8_t len = (op->kind == BB_SB) ? 1 : (op->kind == BB_SH) ? 2 : 4;
+        jit_get(c, RAX, op->rs1);
+        jit_alu_ri(c, BB_ADDI, op->imm);
+        jit_align_check(c, len, pc, i);
+
+        // stores into translated code go back to the interpreter
+        emit8(c, 0x48); emit8(c, 0xBA); emit64(c, (uint64_t)(uintptr_t)&bb_code_range);  // mov rdx, &range
+        emit8(c, 0x3B); emit8(c, 0x42); emit8(c, 0x04);  // cmp eax, [rdx+4] (hi)
+        uint8_t* ok1 = emit_jcc32(c, 0x83);              // jae ok
+        emit8(c, 0x8D); emit8(c, 0x70); emit8(c, len);   // lea esi, [rax+len]
+        emit8(c, 0x3B); emit8(c, 0x32);                  // cmp esi, [rdx] (lo)
+        uint8_t* ok2 = emit_jcc32(c, 0x86);              // jbe ok
+        jit_side_exit(c, pc, i);
+        patch_rel32(ok1, c->p);
+        patch_rel32(ok2, c->p);
+
+        jit_get(c, RCX, op->rs2);
+        jit_fault_site(c, pc);
+        if (op->kind == BB_SH) emit8(c, 0x66);
+        emit8(c, 0x41);
+        emit8(c, op->kind == BB_SB ? 0x88 : 0x89);
+        emit8(c, 0x0C); emit8(c, 0x03);  // [r11 + rax], ecx/cx/cl
+        break;
+      }
+
+      case BB_BEQ:
+      case BB_BNE:
+      case BB_BLT:
+      case BB_BGE:
+      case BB_BLTU:
+      case BB_BGEU:
+      {
+        // cmovcc opcode for the not-taken condition
+        static const uint8_t not_taken[] = {
+          [BB_BEQ - BB_BEQ]  = 0x45,  // cmovne
+          [BB_BNE - BB_BEQ]  = 0x44,  // cmove
+          [BB_BLT - BB_BEQ]  = 0x4D,  // cmovge
+          [BB_BGE - BB_BEQ]  = 0x4C,  // cmovl
+          [BB_BLTU - BB_BEQ] = 0x43,  // cmovae
+          [BB_BGEU - BB_BEQ] = 0x42,  // cmovb
+        };
+        jit_get(c, RAX, op->rs1);
+        jit_get(c, RCX, op->rs2);
+        emit8(c, 0x39); emit8(c, 0xC8);                  // cmp eax, ecx
+        emit8(c, 0xB8); emit32(c, op->imm);              // mov eax, target
+        emit8(c, 0xBA); emit32(c, pc + 4);               // mov edx, pc+4
+        emit8(c, 0x0F); emit8(c, not_taken[op->kind - BB_BEQ]); emit8(c, 0xC2);  // cmovcc eax, edx
+        jit_exit(c, i + 1);
+        break;
+      }
+
+      case BB_JAL:
+        if (op->rd != 0) {
+          emit8(c, 0xB8); emit32(c, pc + 4);
+          jit_put(c, op->rd, RAX);
+        }
+        emit8(c, 0xB8); emit32(c, op->imm);
+        jit_exit(c, i + 1);
+        break;
+
+      case BB_JALR:
+        jit_get(c, RAX, op->rs1);
+        jit_alu_ri(c, BB_ADDI, op->imm);
+        emit8(c, 0x83); emit8(c, 0xE0); emit8(c, 0xFE);  // and eax, ~1
+        if (op->rd != 0) {
+          emit8(c, 0xB9); emit32(c, pc + 4);             // mov ecx, pc+4
+          jit_put(c, op->rd, RCX);
+        }
+        jit_exit(c, i + 1);
+        break;
+
+      case BB_FALLTHRU:
+        emit8(c, 0xB8); emit32(c, pc);
+        jit_exit(c, i);
+        break;
+
+      case BB_ECALL:
+      case BB_FALLBACK:
+        jit_side_exit(c, pc, i);
+        break;
+
+      case BB_DIV:
+      case BB_DIVU:
+      case BB_REM:
+      case BB_REMU:
+        jit_get(c, RAX, op->rs1);
+        jit_get(c, RCX, op->rs2);
+        jit_divide(c, op->kind, pc, i);
+        jit_put(c, op->rd, RAX);
+        break;
+
+      default:
+        if (op->kind >= BB_ADDI && op->kind <= BB_ANDI) {
+          jit_get(c, RAX, op->rs1);
+          jit_alu_ri(c, op->kind, op->imm);
+        } else {
+          jit_get(c, RAX, op->rs1);
+          jit_get(c, RCX, op->rs2);
+          jit_alu_rr(c, op->kind);
+        }
+        jit_put(c, op->rd, RAX);
+        break;
+    }
+  }
+
+  jit_used += (size_t)(c->p - entry);
+  jit_used = (jit_used + 15) & ~(size_t)15;
+  return entry;
+}
+
+#else  // no code generator for this host
+
+bool jit_available(void)
+{
+  return false;
+}
+
+void* jit_compile(const bb_block_t* blk)
+{
+  return NULL;
+}
+
+void jit_reset(void)
+{
+}
+
+bool jit_fault_pc(const void* host_pc, Address* pc)
+{
+  return false;
+}
+
+#endif
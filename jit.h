@@ -0,0 +1,46 @@
+#ifndef __JIT_H__
+#define __JIT_H__
+
+#include <stdbool.h>
+#include "types.h"
+#include "blockcache.h"
+
+///////////////////////////////////////////////////////////////////////////////
+/// x86-64 translation of hot basic blocks
+///////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Compiled blocks run straight against the guest register file and memory.
+ * They return the next guest PC and write the number of guest instructions
+ * they retired. A block stops early (a "side exit") in front of anything it
+ * leaves to the interpreter: ecall, unsupported encodings, misaligned memory
+ * accesses and stores into translated code. Aligned accesses are not checked;
+ * a fault in them is reported through jit_fault_pc().
+ */
+typedef Address (*jit_fn_t)(Register* R, Byte* memory, uint32_t* retired);
+
+#define JIT_BUFFER_SIZE   (16 * 1024 * 1024)  // executable code buffer
+#define JIT_BLOCK_RESERVE (16 * 1024)         // worst case for a single block
+
+/**
+ * true when host code can be generated on this machine
+ **/
+bool jit_available(void);
+
+/**
+ * Returns host code for blk, or NULL if the block is not worth compiling.
+ **/
+void* jit_compile(const bb_block_t* blk);
+
+/**
+ * Forget every compiled block (called from bb_flush()).
+ **/
+void jit_reset(void);
+
+/**
+ * If host_pc is a guest memory access inside compiled code, stores the guest
+ * PC of the instruction it belongs to and returns true.
+ **/
+bool jit_fault_pc(const void* host_pc, Address* pc);
+
+#endif  // __JIT_H__
@@ -0,0 +1,332 @@
+#define _GNU_SOURCE  // REG_RIP / REG_ERR in <ucontext.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include "types.h"
+#include "memory.h"
+#include "riscv.h"
+#include "utils.h"
+#include "jit.h"
+
+Byte mem_perm[GUEST_PAGES];
+volatile Address mem_fault_pc = 0;
+sigjmp_buf mem_fault_env;
+volatile sig_atomic_t mem_fault_armed = 0;
+
+// the fault the handler jumped back with
+static struct
+{
+  bool    valid;
+  bool    write;
+  Address address;
+  Address pc;
+}mem_fault;
+
+// pages given contents by the loader or a checkpoint, one byte per page
+static Byte mem_populated[GUEST_PAGES];
+
+// Base of the reservation, NULL until mem_init()
+static Byte* mem_base = NULL;
+
+// Whatever handled SIGSEGV/SIGBUS before us, for faults that are not ours
+static struct sigaction mem_prev_segv;
+static struct sigaction mem_prev_bus;
+
+static int mem_host_prot(Byte perms)
+{
+  int prot = PROT_NONE;
+  if (perms & MEM_PERM_R) prot |= PROT_READ;
+  if (perms & MEM_PERM_W) prot |= PROT_READ | PROT_WRITE;  // no write-only pages on the host
+  return prot;
+}
+
+/**
+ * true if the fault was a write. x86-64 tells us directly; elsewhere a fault
+ * on a readable page can only have been a write.
+ **/
+static bool mem_fault_is_write(Address address, void* context)
+{
+#if defined(__x86_64__) && defined(__linux__)
+  const ucontext_t* uc = context;
+  return (uc->uc_mcontext.gregs[REG_ERR] & 0x2) != 0;
+#else
+  (void)context;
+  return (mem_perm[address >> GUEST_PAGE_BITS] & MEM_PERM_R) != 0;
+#endif
+}
+
+static const void* mem_fault_host_pc(void* context)
+{
+#if defined(__x86_64__) && defined(__linux__)
+  const ucontext_t* uc = context;
+  return (const void*)uc->uc_mcontext.gregs[REG_RIP];
+#else
+  (void)context;
+  return NULL;
+#endif
+}
+
+// appends str to buf at n, returns the new length
+static size_t mem_fault_append(char* buf, size_t n, const char* str)
+{
+  while (*str) {
+    buf[n++] = *str++;
+  }
+  return n;
+}
+
+// appends value as 8 hex digits
+static size_t mem_fault_append_hex(char* buf, size_t n, Word value)
+{
+  for (int shift = 28; shift >= 0; shift -= 4) {
+    buf[n++] = "0123456789abcdef"[(value >> shift) & 0xF];
+  }
+  return n;
+}
+
+static void mem_fault_handler(int sig, siginfo_t* si, void* context)
+{
+  Byte* host = si->si_addr;
+  if (mem_base == NULL || host < mem_base || host >= mem_base + GUEST_SPACE_SIZE + GUEST_GUARD_SIZE) {
+    // not a guest access, hand it to the previous handler
+    struct sigaction* prev = (sig == SIGBUS) ? &mem_prev_bus : &mem_prev_segv;
+    if (prev->sa_flags & SA_SIGINFO) {
+      prev->sa_sigaction(sig, si, context);
+    } else if (prev->sa_handler != SIG_IGN && prev->sa_handler != SIG_DFL) {
+      prev->sa_handler(sig);
+    } else {
+      // returning re-executes the access and takes the default action
+      signal(sig, SIG_DFL);
+    }
+    return;
+  }
+
+  Address address = (Address)(host - mem_base);  // the guard wraps back to 0
+  Address pc = mem_fault_pc;
+  jit_fault_pc(mem_fault_host_pc(context), &pc);
+  bool is_write = mem_fault_is_write(address, context);
+
+  // the run loop reports it, outside the handler
+  if (mem_fault_armed) {
+    mem_fault_armed = 0;
+    mem_fault.valid = true;
+    mem_fault.write = is_write;
+    mem_fault.address = address;
+    mem_fault.pc = pc;
+    siglongjmp(mem_fault_env, 1);
+  }
+
+  // only write(2) and _exit() from here on, stdio is not async-signal-safe
+  char report[96];
+  size_t n = mem_fault_append(report, 0, is_write ? "Bad Write" : "Bad Read");
+  n = mem_fault_append(report, n, ". Address: 0x");
+  n = mem_fault_append_hex(report, n, address);
+  n = mem_fault_append(report, n, "\n");
+  if (mem_perm[pc >> GUEST_PAGE_BITS] & MEM_PERM_R) {
+    Word bits;
+    memcpy(&bits, mem_base + pc, sizeof(Word));
+    n = mem_fault_append_hex(report, n, pc);
+    n = mem_fault_append(report, n, ": ");
+    n = mem_fault_append_hex(report, n, bits);
+    n = mem_fault_append(report, n, "\n");
+  }
+  ssize_t written = write(STDOUT_FILENO, report, n);
+  (void)written;
+  _exit(-1);
+}
+
+void mem_fault_report(void)
+{
+  if (mem_fault.write) {
+    handle_invalid_write(mem_fault.address);
+  } else {
+    handle_invalid_read(mem_fault.address);
+  }
+}
+
+/**
+ * Prints the instruction that made the fault, disassembled, under the
+ * handle_invalid_read()/handle_invalid_write() report line.
+ **/
+static void mem_fault_print_instruction(void)
+{
+  if (mem_fault.valid && (mem_perm[mem_fault.pc >> GUEST_PAGE_BITS] & MEM_PERM_R)) {
+    printf("%08x: ", mem_fault.pc);
+    decode_instruction(load(mem_base, mem_fault.pc, LENGTH_WORD));
+  }
+}
+
+/**
+ * Maps one zero-filled guest address space with protection prot, followed by
+ * its guard.
+ **/
+static Byte* mem_map_space(int prot)
+{
+  // the guard is part of the reservation but never made accessible
+  size_t reserve = GUEST_SPACE_SIZE + GUEST_GUARD_SIZE;
+  void* base = mmap(NULL, reserve, PROT_NONE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (base == MAP_FAILED) {
+    printf("Error: unable to reserve %llu bytes of guest memory\n", (unsigned long long)reserve);
+    exit(-1);
+  }
+  if (prot != PROT_NONE && mprotect(base, GUEST_SPACE_SIZE, prot) != 0) {
+    printf("Error: unable to map guest memory\n");
+    exit(-1);
+  }
+  return base;
+}
+
+Byte* mem_init(void)
+{
+  if (mem_base != NULL) {
+    return mem_base;
+  }
+
+  // nothing is accessible until the loader gives pages their permissions
+  mem_base = mem_map_space(PROT_NONE);
+  memset(mem_perm, MEM_PERM_NONE, sizeof(mem_perm));
+  invalid_access_detail = mem_fault_print_instruction;
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(struct sigaction));
+  sigemptyset(&sa.sa_mask);
+  sa.sa_sigaction = mem_fault_handler;
+  sa.sa_flags = SA_SIGINFO;
+  sigaction(SIGSEGV, &sa, &mem_prev_segv);
+  sigaction(SIGBUS, &sa, &mem_prev_bus);
+  return mem_base;
+}
+
+Byte* mem_create(void)
+{
+  return mem_map_space(PROT_READ | PROT_WRITE);
+}
+
+void mem_reset(void)
+{
+  void* base = mmap(mem_base, GUEST_SPACE_SIZE, PROT_NONE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+  if (base == MAP_FAILED) {
+    printf("Error: unable to reset guest memory\n");
+    exit(-1);
+  }
+  memset(mem_perm, MEM_PERM_NONE, sizeof(mem_perm));
+  memset(mem_populated, 0, sizeof(mem_populated));
+}
+
+void mem_populate(Address address, uint64_t len)
+{
+  if (len == 0) {
+    return;
+  }
+  uint64_t first = address >> GUEST_PAGE_BITS;
+  uint64_t last  = ((uint64_t)address + len - 1) >> GUEST_PAGE_BITS;
+  if (last >= GUEST_PAGES) {
+    last = GUEST_PAGES - 1;
+  }
+  memset(mem_populated + first, 1, last - first + 1);
+}
+
+void mem_protect(Address address, uint64_t len, Byte perms)
+{
+  if (len == 0) {
+    return;
+  }
+
+  uint64_t first = address >> GUEST_PAGE_BITS;
+  uint64_t last  = ((uint64_t)address + len - 1) >> GUEST_PAGE_BITS;
+  if (last >= GUEST_PAGES) {
+    last = GUEST_PAGES - 1;
+  }
+
+  for (uint64_t page = first; page <= last; page++) {
+    mem_perm[page] = perms;
+  }
+
+  // host pages may be larger than guest pages; only tighten whole host pages
+  size_t host_page = sysconf(_SC_PAGESIZE);
+  uint64_t lo = first << GUEST_PAGE_BITS;
+  uint64_t hi = (last + 1) << GUEST_PAGE_BITS;
+  if (host_page > GUEST_PAGE_SIZE) {
+    lo = (lo + host_page - 1) & ~(uint64_t)(host_page - 1);
+    hi = hi & ~(uint64_t)(host_page - 1);
+  }
+  if (hi > lo && mprotect(mem_base + lo, hi - lo, mem_host_prot(perms)) != 0) {
+    printf("Error: unable to change protection of guest memory at 0x%08x\n", address);
+    exit(-1);
+  }
+}
+
+size_t mem_resident_bytes(void)
+{
+  size_t host_page = sysconf(_SC_PAGESIZE);
+  size_t pages = GUEST_SPACE_SIZE / host_page;
+  unsigned char* vec = malloc(pages);
+  if (vec == NULL || mincore(mem_base, GUEST_SPACE_SIZE, vec) != 0) {
+    free(vec);
+    return 0;
+  }
+
+  size_t resident = 0;
+  for (size_t i = 0; i < pages; i++) {
+    resident += vec[i] & 1;
+  }
+  free(vec);
+  return resident * host_page;
+}
+
+void mem_touched_pages(Byte* touched)
+{
+  size_t host_page = sysconf(_SC_PAGESIZE);
+  size_t pages = GUEST_SPACE_SIZE / host_page;
+  unsigned char* vec = malloc(pages);
+  if (vec == NULL || mincore(mem_base, GUEST_SPACE_SIZE, vec) != 0) {
+    // can't tell, report every page
+    free(vec);
+    memset(touched, 1, GUEST_PAGES);
+    return;
+  }
+
+  /* mincore() finds the anonymous pages guest stores created. For a page
+   * still mapped from a checkpoint it only tells whether the host caches
+   * the file, so those come from mem_populated */
+  if (host_page == GUEST_PAGE_SIZE) {
+    for (uint64_t page = 0; page < GUEST_PAGES; page += 8) {
+      uint64_t w, p;
+      memcpy(&w, vec + page, sizeof(w));
+      memcpy(&p, mem_populated + page, sizeof(p));
+      w = (w & 0x0101010101010101ULL) | p;  // the other bits are reserved
+      memcpy(touched + page, &w, sizeof(w));
+    }
+  } else {
+    for (uint64_t page = 0; page < GUEST_PAGES; page++) {
+      touched[page] = (vec[(page << GUEST_PAGE_BITS) / host_page] & 1) | mem_populated[page];
+    }
+  }
+  free(vec);
+}
+
+void mem_map_file(Address address, uint64_t len, int fd, off_t offset)
+{
+  mem_populate(address, len);
+  size_t host_page = sysconf(_SC_PAGESIZE);
+  if (host_page == GUEST_PAGE_SIZE) {
+    // pages are read from the file on first touch and copied on first write
+    void* at = mmap(mem_base + address, len, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_FIXED, fd, offset);
+    if (at != MAP_FAILED) {
+      return;
+    }
+  }
+
+  // host pages larger than guest pages can't be mapped one guest page at a time
+  if (pread(fd, mem_base + address, len, offset) != (ssize_t)len) {
+    printf("Error: unable to read guest memory at 0x%08x\n", address);
+    exit(-1);
+  }
+}
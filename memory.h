@@ -0,0 +1,137 @@
+#ifndef __MEMORY_H__
+#define __MEMORY_H__
+
+#include <setjmp.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include "types.h"
+
+///////////////////////////////////////////////////////////////////////////////
+/// Guest memory: the whole 32-bit address space, backed on demand
+///////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Guest memory is a single MAP_NORESERVE reservation of 4 GiB, so a guest
+ * address is still just an index into the Byte array handed back by
+ * mem_init(). The host kernel only backs the pages the program actually
+ * touches, which keeps the resident size equal to the program's footprint.
+ * The reservation is followed by an inaccessible guard region.
+ *
+ * Every 4 KiB guest page carries permission bits, enforced by the host MMU
+ * through the protection of the mapping. load()/store() therefore do no
+ * checking at all: a wild or disallowed access raises SIGSEGV. The handler
+ * installed by mem_init() only records the fault and siglongjmp()s to the
+ * recovery point the run loop set up in mem_fault_env. From there
+ * mem_fault_report() reports it through handle_invalid_read()/
+ * handle_invalid_write(), naming the faulting instruction, and exit()s, so
+ * the stdout redirections and atexit handlers (--expect, the traces) see
+ * the report like any other output. Before a recovery point is armed, and in
+ * forked workers, the handler writes a bare report itself and _exit()s.
+ * Faults outside guest memory are passed on to the previously installed
+ * handler (dogfault.h).
+ *
+ * Whoever executes guest instructions publishes the PC of the instruction
+ * about to access memory in mem_fault_pc so the report can name it. Compiled
+ * blocks do not need to, their faulting host address is mapped back by the
+ * JIT (jit_fault_pc()).
+ */
+
+#define GUEST_PAGE_BITS   12
+#define GUEST_PAGE_SIZE   (1U << GUEST_PAGE_BITS)
+#define GUEST_PAGES       (1U << (32 - GUEST_PAGE_BITS))
+#define GUEST_SPACE_SIZE  (1ULL << 32)          // bytes of guest address space
+#define GUEST_GUARD_SIZE  (64 * 1024)           // unmapped tail past the space
+
+// the program's data, heap and stack: [0, --mem-size), code pages read-only
+#define GUEST_DATA_DEFAULT  (256ULL << 20)
+#define GUEST_DATA_MAX      (1ULL << 31)        // the top half is always a guard
+
+// per-page permission bits
+#define MEM_PERM_NONE  0x0
+#define MEM_PERM_R     0x1
+#define MEM_PERM_W     0x2
+#define MEM_PERM_X     0x4
+#define MEM_PERM_RW    (MEM_PERM_R | MEM_PERM_W)
+#define MEM_PERM_RWX   (MEM_PERM_R | MEM_PERM_W | MEM_PERM_X)
+
+// permission bits, indexed by guest page number
+extern Byte mem_perm[GUEST_PAGES];
+
+// guest PC of the instruction currently accessing memory
+extern volatile Address mem_fault_pc;
+
+// where a guest fault resumes, once mem_fault_armed is set
+extern sigjmp_buf mem_fault_env;
+extern volatile sig_atomic_t mem_fault_armed;
+
+/**
+ * Reports the fault the handler jumped to mem_fault_env with and exits.
+ **/
+void mem_fault_report(void);
+
+/**
+ * Reserves the guest address space (zero filled, every page MEM_PERM_NONE),
+ * installs the fault handler and returns the base. The loader makes the
+ * pages the program uses accessible with mem_protect(). Exits if the host cannot
+ * provide the reservation.
+ **/
+Byte* mem_init(void);
+
+/**
+ * Maps a second, independent guest address space (e.g. for a reference
+ * model). It is always readable and writable; mem_protect() and the fault
+ * report only apply to the space from mem_init().
+ **/
+Byte* mem_create(void);
+
+/**
+ * Drops everything in the space from mem_init(): every page is zero,
+ * MEM_PERM_NONE and unpopulated again. Used to start over from a checkpoint.
+ **/
+void mem_reset(void);
+
+/**
+ * Sets the permissions of every page overlapping [address, address + len)
+ * and changes the host mapping to match. The host has no write-only pages,
+ * so MEM_PERM_W alone also allows reads.
+ **/
+void mem_protect(Address address, uint64_t len, Byte perms);
+
+/**
+ * Number of host bytes currently resident for guest memory.
+ **/
+size_t mem_resident_bytes(void);
+
+/**
+ * Records that [address, address + len) holds data written other than by
+ * a guest store, e.g. by the loader. Such pages are always reported by
+ * mem_touched_pages().
+ **/
+void mem_populate(Address address, uint64_t len);
+
+/**
+ * Sets touched[page] (one byte per guest page) for every page that may hold
+ * data: the ones given to mem_populate() or mapped by mem_map_file(), and
+ * any other page the host has backed with memory. A page mapped from a file
+ * is not reliably resident, so only the first kind is certain to be
+ * reported when it was never written. Pages not reported read as zero.
+ **/
+void mem_touched_pages(Byte* touched);
+
+/**
+ * Replaces [address, address + len) with the contents of fd at offset, both
+ * guest-page aligned. The file is mapped copy-on-write where the host allows
+ * it, so pages are only read when the program touches them. Permissions are
+ * reset to read/write on the host; apply mem_protect() afterwards. The
+ * pages count as populated (mem_populate()).
+ **/
+void mem_map_file(Address address, uint64_t len, int fd, off_t offset);
+
+static inline bool mem_allowed(Address address, Byte perm)
+{
+  return (mem_perm[address >> GUEST_PAGE_BITS] & perm) != 0;
+}
+
+#endif  // __MEMORY_H__
@@ -1,10 +1,16 @@
 #include <stdbool.h>
+#include <string.h>
 #include "cache.h"
 #include "riscv.h"
 #include "types.h"
 #include "utils.h"
 #include "pipeline.h"
 #include "stage_helpers.h"
+#include "memory.h"
+#include "cosim.h"
+#include "trace.h"
+#include "reuse.h"
+#include "csr.h"
 
 uint64_t total_cycle_counter = 0;
 uint64_t mem_access_counter = 0;
@@ -14,8 +20,76 @@ uint64_t stall_counter = 0;
 uint64_t branch_counter = 0;
 uint64_t fwd_exex_counter = 0;
 uint64_t fwd_exmem_counter = 0;
+uint64_t retired_counter = 0;
+uint64_t sb_store_counter = 0;
+uint64_t sb_occupancy_counter = 0;
+uint64_t sb_full_stall_counter = 0;
+uint64_t sb_forward_counter = 0;
+uint64_t sb_conflict_stall_counter = 0;
+uint64_t unit_stall_counter = 0;
+uint64_t unit_busy_counter = 0;
+
+// defaults come from config.h, riscv.c overrides them from the command line
+simulator_config_t sim_config = {
+#ifdef CACHE_ENABLE
+  .cache_en = true,
+#endif
+#ifdef FLUSH_BRANCHES
+  .flush_branches = true,
+#endif
+#ifdef DEBUG_CYCLE
+  .debug_cycle = true,
+#endif
+#ifdef DEBUG_REG_TRACE
+  .debug_reg_trace = true,
+#endif
+#ifdef PRINT_STATS
+  .print_stats = true,
+#endif
+#ifdef PRINT_CACHE_TRACES
+  .print_cache_traces = true,
+#endif
+#ifdef PRINT_CACHE_STATS
+  .print_cache_stats = true,
+#endif
+#ifdef PRINT_MEM_STATS
+  .print_mem_stats = true,
+#endif
+#ifdef MEM_LATENCY
+  .mem_latency = MEM_LATENCY,
+#endif
+  .cache_set_bits = CACHE_SET_BITS,
+  .cache_ways = CACHE_LINES_PER_SET,
+  .cache_block_bits = CACHE_BLOCK_BITS,
+  .cache_index = CACHE_INDEX_MOD,
+  .line_buffer_latency = 1,
+  .store_buffer = 0,
+  .mul_latency = 1,
+  .mul_interval = 1,
+  .div_latency = 1,
+};
 
-simulator_config_t sim_config = {0};
+/**
+ * Features each variant of cycle_pipeline() is compiled for. The stage
+ * functions below are inlined into every variant with a constant feature
+ * mask, so the checks on it fold away and a variant contains only the code
+ * for the features it was built with.
+ **/
+#define PIPE_DEBUG_CYCLE  0x1   // stage trace
+#define PIPE_REG_TRACE    0x2   // register trace
+#define PIPE_CACHE        0x4   // cache simulation
+#define PIPE_FWD          0x8   // forwarding unit
+#define PIPE_VARIANTS     16
+
+#define PIPE_INLINE static inline __attribute__((always_inline))
+
+static unsigned pipeline_features(void)
+{
+  return (sim_config.debug_cycle     ? PIPE_DEBUG_CYCLE : 0) |
+         (sim_config.debug_reg_trace ? PIPE_REG_TRACE   : 0) |
+         (sim_config.cache_en        ? PIPE_CACHE       : 0) |
+         (sim_config.fwd_en          ? PIPE_FWD         : 0);
+}
 
 ///////////////////////////////////////////////////////////////////////////////
 
@@ -25,6 +99,87 @@ void bootstrap(pipeline_wires_t* pwires_p, pipeline_regs_t* pregs_p, regfile_t*
   pwires_p->pc_src0 = regfile_p->PC;
 }
 
+/////////////////////
+/// STORE BUFFER ///
+/////////////////////
+
+/**
+ * Stores retire into the buffer at once and drain to the cache one after
+ * the other in the background, each taking the latency its cache access
+ * had. The cache itself is updated when the store enters the buffer, so
+ * its state stays in program order; only the timing is deferred.
+ **/
+
+static void store_buffer_pop(store_buffer_t* sb)
+{
+  sb->count--;
+  memmove(&sb->address[0], &sb->address[1], sb->count * sizeof(sb->address[0]));
+  memmove(&sb->size[0], &sb->size[1], sb->count * sizeof(sb->size[0]));
+  memmove(&sb->done[0], &sb->done[1], sb->count * sizeof(sb->done[0]));
+}
+
+static void store_buffer_drain(store_buffer_t* sb)
+{
+  while (sb->count > 0 && sb->done[0] <= total_cycle_counter) {
+    store_buffer_pop(sb);
+  }
+}
+
+/**
+ * Puts a store whose cache access takes latency cycles into the buffer.
+ * Returns the cycles the store waits for a free entry.
+ **/
+static uint64_t store_buffer_store(store_buffer_t* sb, uint32_t address, uint32_t size, long latency)
+{
+  store_buffer_drain(sb);
+  sb_store_counter++;
+  sb_occupancy_counter += sb->count;
+
+  uint64_t stall = 0;
+  if (sb->count == (uint32_t)sim_config.store_buffer) {
+    stall = sb->done[0] - total_cycle_counter;
+    sb_full_stall_counter += stall;
+    store_buffer_pop(sb);
+  }
+
+  // drains after everything ahead of it
+  uint64_t start = total_cycle_counter + stall;
+  if (sb->count > 0 && sb->done[sb->count - 1] > start) {
+    start = sb->done[sb->count - 1];
+  }
+  sb->address[sb->count] = address;
+  sb->size[sb->count] = size;
+  sb->done[sb->count] = start + latency;
+  sb->count++;
+  return stall;
+}
+
+/**
+ * Checks a load against the buffered stores. If the youngest store it
+ * overlaps covers it, the data is forwarded and *forwarded is set. If it
+ * only partly overlaps, the load waits until that store is in the cache.
+ * Returns the cycles waited.
+ **/
+static uint64_t store_buffer_load(store_buffer_t* sb, uint32_t address, uint32_t size, bool* forwarded)
+{
+  store_buffer_drain(sb);
+  *forwarded = false;
+  for (int i = (int)sb->count - 1; i >= 0; i--) {
+    if (address >= sb->address[i] + sb->size[i] || sb->address[i] >= address + size) {
+      continue;
+    }
+    if (sb->address[i] <= address && address + size <= sb->address[i] + sb->size[i]) {
+      sb_forward_counter++;
+      *forwarded = true;
+      return 0;
+    }
+    uint64_t stall = sb->done[i] - total_cycle_counter;
+    sb_conflict_stall_counter += stall;
+    return stall;
+  }
+  return 0;
+}
+
 ///////////////////////////
 /// STAGE FUNCTIONALITY ///
 ///////////////////////////
@@ -33,7 +188,7 @@ void bootstrap(pipeline_wires_t* pwires_p, pipeline_regs_t* pregs_p, regfile_t*
  * STAGE  : stage_fetch
  * output : ifid_reg_t
  **/ 
-ifid_reg_t stage_fetch(pipeline_wires_t* pwires_p, regfile_t* regfile_p, Byte* memory_p)
+PIPE_INLINE ifid_reg_t stage_fetch_impl(pipeline_wires_t* pwires_p, regfile_t* regfile_p, Byte* memory_p, const unsigned features)
 {
   ifid_reg_t ifid_reg = {0};  // Initialize the pipeline register
   /**
@@ -43,7 +198,7 @@ ifid_reg_t stage_fetch(pipeline_wires_t* pwires_p, regfile_t* regfile_p, Byte* m
   uint32_t instruction_bits;  // initialize the bits containing the instruction
 
   // MUX logic in the IF stage
-  if (pwires_p->p csrc) {  // branch taken ->  address to which the PC should jump to
+  if (pwires_p->pcsrc) {  // branch taken ->  address to which the PC should jump to
     regfile_p->PC = pwires_p->pc_src1;  // set to target address of the branch
     pwires_p->pc_src0 = pwires_p->pc_src1;
   } else {  // branch not taken
@@ -65,18 +220,24 @@ ifid_reg_t stage_fetch(pipeline_wires_t* pwires_p, regfile_t* regfile_p, Byte* m
  
   // Pass on current instruction address to if/id pipeline register
   ifid_reg.instr_addr = regfile_p->PC;
+  ifid_reg.valid = true;
+
+  // every fetch counts, also repeated ones while stalled and wrong-path ones
+  if (reuse_fetch_active) {
+    reuse_access(regfile_p->PC);
+  }
  
   // Increment pc counter for next cycle (Add block above instruction memory)
   pwires_p->pc_src0 += 4;
   
   // load instruction from memory and parse it
+  mem_fault_pc = regfile_p->PC;
   instruction_bits = load(memory_p, regfile_p->PC, LENGTH_WORD);
   ifid_reg.instr = parse_instruction(instruction_bits);
   
-  #ifdef DEBUG_CYCLE
-  printf("[IF ]: Instruction [%08x]@[%08x]: ", instruction_bits, regfile_p->PC);
-  decode_instruction(instruction_bits);
-  #endif
+  if (features & PIPE_DEBUG_CYCLE) {
+    trace_stage(TRACE_IF, instruction_bits, regfile_p->PC);
+  }
 
   return ifid_reg;
 }
@@ -85,7 +246,7 @@ ifid_reg_t stage_fetch(pipeline_wires_t* pwires_p, regfile_t* regfile_p, Byte* m
  * STAGE  : stage_decode
  * output : idex_reg_t
  **/ 
-idex_reg_t stage_decode(ifid_reg_t ifid_reg, pipeline_wires_t* pwires_p, regfile_t* regfile_p)
+PIPE_INLINE idex_reg_t stage_decode_impl(ifid_reg_t ifid_reg, pipeline_wires_t* pwires_p, regfile_t* regfile_p, const unsigned features)
 {
   idex_reg_t idex_reg = {0};
   /**
@@ -108,14 +269,19 @@ idex_reg_t stage_decode(ifid_reg_t ifid_reg, pipeline_wires_t* pwires_p, regfile
     idex_reg.mem_write = 0;
     idex_reg.reg_write = 0;
     idex_reg.mem_to_reg = 0;
+    idex_reg.csr = 0;
 
     // Reset control signal
     pwires_p->flush_control = 0;
+
+    // the stalled instruction is decoded again next cycle, this copy is a bubble
+    ifid_reg.valid = false;
   } 
   
   // Carry over instruction and PC from one pipeline reg to the next
   idex_reg.instr = ifid_reg.instr;
   idex_reg.instr_addr = ifid_reg.instr_addr;
+  idex_reg.valid = ifid_reg.valid;
 
   // Generate imm value (Imm Gen module)
   idex_reg.imm_val = gen_imm(ifid_reg.instr);
@@ -174,6 +340,30 @@ idex_reg_t stage_decode(ifid_reg_t ifid_reg, pipeline_wires_t* pwires_p, regfile
       idex_reg.rs1 = 0;     
       idex_reg.rs2 = 0; 
       break;
+    case 0x17:  //AUIPC
+      // rd, offset
+      idex_reg.read_data1 = ifid_reg.instr_addr;
+
+      idex_reg.rs1 = 0;
+      idex_reg.rs2 = 0;
+      break;
+    case 0x67:  //JALR
+      // rd, offset, rs1
+      idex_reg.read_data1 = regfile_p->R[ifid_reg.instr.itype.rs1];
+      idex_reg.funct3 = ifid_reg.instr.itype.funct3;
+
+      idex_reg.rs2 = 0;
+      break;
+    case 0x73:  //CSR access
+      // rd, csr, rs1 (or an immediate in its place)
+      idex_reg.read_data1 = regfile_p->R[ifid_reg.instr.itype.rs1];
+      idex_reg.funct3 = ifid_reg.instr.itype.funct3;
+
+      if (idex_reg.funct3 & 0x4) {
+        idex_reg.rs1 = 0;
+      }
+      idex_reg.rs2 = 0;
+      break;
     case 0x6F:  //UJ-type
       // rd, imm
       //idex_reg.rd = ifid_reg.instr.ujtype.rd;
@@ -186,10 +376,9 @@ idex_reg_t stage_decode(ifid_reg_t ifid_reg, pipeline_wires_t* pwires_p, regfile
       break;
   }
 
-  #ifdef DEBUG_CYCLE
-  printf("[ID ]: Instruction [%08x]@[%08x]: ", ifid_reg.instr.bits, ifid_reg.instr_addr);
-  decode_instruction(ifid_reg.instr.bits);
-  #endif
+  if (features & PIPE_DEBUG_CYCLE) {
+    trace_stage(TRACE_ID, ifid_reg.instr.bits, ifid_reg.instr_addr);
+  }
 
   return idex_reg;
 }
@@ -198,7 +387,7 @@ idex_reg_t stage_decode(ifid_reg_t ifid_reg, pipeline_wires_t* pwires_p, regfile
  * STAGE  : stage_execute
  * output : exmem_reg_t
  **/ 
-exmem_reg_t stage_execute(idex_reg_t idex_reg, pipeline_wires_t* pwires_p)
+PIPE_INLINE exmem_reg_t stage_execute_impl(idex_reg_t idex_reg, pipeline_wires_t* pwires_p, const unsigned features)
 {
   exmem_reg_t exmem_reg = {0};
   /**
@@ -221,11 +410,13 @@ exmem_reg_t stage_execute(idex_reg_t idex_reg, pipeline_wires_t* pwires_p)
   exmem_reg.mem_read = idex_reg.mem_read;
   exmem_reg.mem_write = idex_reg.mem_write;
   exmem_reg.branch = idex_reg.branch;
+  exmem_reg.csr = idex_reg.csr;
   ////////////////////////////////////////////////////////////
 
   // Carry over instruction and PC from one pipeline reg to the next
   exmem_reg.instr = idex_reg.instr;
   exmem_reg.instr_addr = idex_reg.instr_addr;
+  exmem_reg.valid = idex_reg.valid;
 
   // Carry over write_reg (On pipeline diagram, the bottom most data path, Instruction [11-7])
   exmem_reg.rd = idex_reg.rd;
@@ -266,10 +457,21 @@ exmem_reg_t stage_execute(idex_reg_t idex_reg, pipeline_wires_t* pwires_p)
 
   // Execute ALU with generated control signal, storing in ex/mem reg
   exmem_reg.alu_result = execute_alu(alu_inp1, alu_inp2, alu_control);
+
+  // Jumps: the ALU computed the target, rd gets the return address
+  if (idex_reg.instr.opcode == 0x67) {
+    exmem_reg.branch_addr = exmem_reg.alu_result & ~1U;
+  }
+  if (idex_reg.instr.opcode == 0x6F || idex_reg.instr.opcode == 0x67) {
+    exmem_reg.alu_result = idex_reg.instr_addr + 4;
+  }
   
   // Carry over result of alu to pwires for use in the Forwarding unit
   pwires_p->alu_result = exmem_reg.alu_result;
 
+  // multiply and divide results take their unit's latency (detect_hazard)
+  scoreboard_issue(idex_reg, &pwires_p->scoreboard);
+
   // Set zero signal of ALU (Dealt with in stage_mem() for now)
 
   #ifdef DEBUG_CYCLE_CONTENTS
@@ -278,10 +480,9 @@ exmem_reg_t stage_execute(idex_reg_t idex_reg, pipeline_wires_t* pwires_p)
   decode_instruction(idex_reg.instr.bits);
   #endif
 
-  #ifdef DEBUG_CYCLE
-  printf("[EX ]: Instruction [%08x]@[%08x]: ", idex_reg.instr.bits, idex_reg.instr_addr);
-  decode_instruction(idex_reg.instr.bits);
-  #endif
+  if (features & PIPE_DEBUG_CYCLE) {
+    trace_stage(TRACE_EX, idex_reg.instr.bits, idex_reg.instr_addr);
+  }
 
   return exmem_reg;
 }
@@ -290,7 +491,7 @@ exmem_reg_t stage_execute(idex_reg_t idex_reg, pipeline_wires_t* pwires_p)
  * STAGE  : stage_mem
  * output : memwb_reg_t
  **/ 
-memwb_reg_t stage_mem(exmem_reg_t exmem_reg, pipeline_wires_t* pwires_p, Byte* memory_p, Cache* cache_p)
+PIPE_INLINE memwb_reg_t stage_mem_impl(exmem_reg_t exmem_reg, pipeline_wires_t* pwires_p, Byte* memory_p, Cache* cache_p, const unsigned features)
 {
   memwb_reg_t memwb_reg = {0};
   /**
@@ -306,6 +507,8 @@ memwb_reg_t stage_mem(exmem_reg_t exmem_reg, pipeline_wires_t* pwires_p, Byte* m
   // Carry over instruction and PC from one pipeline reg to the next
   memwb_reg.instr = exmem_reg.instr;
   memwb_reg.instr_addr = exmem_reg.instr_addr;
+  memwb_reg.valid = exmem_reg.valid;
+  memwb_reg.write_data = exmem_reg.write_data;
 
   // Carry over write_reg (On pipeline diagram, the bottom most data path, Instruction [11-7])
   memwb_reg.rd = exmem_reg.rd;
@@ -320,6 +523,7 @@ memwb_reg_t stage_mem(exmem_reg_t exmem_reg, pipeline_wires_t* pwires_p, Byte* m
   pwires_p->pcsrc = gen_branch(exmem_reg);
 
   // Data memory access
+  mem_fault_pc = exmem_reg.instr_addr;  // named in the report if the access faults
   
   // loads data from memory using the address in exmem_reg.alu_result
   // essentially the top signal of the RHS of the data memory block (in the image)
@@ -363,6 +567,14 @@ memwb_reg_t stage_mem(exmem_reg_t exmem_reg, pipeline_wires_t* pwires_p, Byte* m
     }
   } 
 
+  // CSR access: nothing can squash the instruction from here on, so the
+  // write is safe and the read sees every older instruction retired
+  if (exmem_reg.csr) {
+    Word src = (exmem_reg.instr.itype.funct3 & 0x4) ? exmem_reg.instr.itype.rs1 : exmem_reg.alu_result;
+    memwb_reg.read_data = csr_execute(exmem_reg.instr, src,
+                                      (csr_clock_t){ total_cycle_counter, retired_counter });
+  }
+
   // For load-store data hazard, carry over WB stage MUX output
   if (exmem_reg.mem_to_reg) { // load instruction
     // data read from memory (memwb_reg.read_data) is forwarded
@@ -372,20 +584,33 @@ memwb_reg_t stage_mem(exmem_reg_t exmem_reg, pipeline_wires_t* pwires_p, Byte* m
     pwires_p->write_data = exmem_reg.alu_result;
   }
 
-  #ifdef DEBUG_CYCLE
-  printf("[MEM]: Instruction [%08x]@[%08x]: ", exmem_reg.instr.bits, exmem_reg.instr_addr);
-  decode_instruction(exmem_reg.instr.bits);
-  #endif
+  if (features & PIPE_DEBUG_CYCLE) {
+    trace_stage(TRACE_MEM, exmem_reg.instr.bits, exmem_reg.instr_addr);
+  }
+
+  if (reuse_active && (exmem_reg.mem_read == 1 || exmem_reg.mem_write == 1)) {
+    reuse_access(exmem_reg.alu_result);
+  }
 
   // Milestone 3 Cache access
 
   long int latency = 0; // latency in cycles
 
-  if (sim_config.cache_en) {  // Check if cache is enabled in the simulation configuration
+  // a load the store buffer forwards to doesn't reach the cache or memory
+  bool forwarded = false;
+  uint32_t access_size = 1U << (exmem_reg.instr.itype.funct3 & 0x3);
+  if (sim_config.store_buffer > 0 && exmem_reg.mem_read == 1) {
+    total_cycle_counter += store_buffer_load(&pwires_p->store_buffer, exmem_reg.alu_result, access_size, &forwarded);
+  }
+
+  if (forwarded) {
+    // costs no more than an ALU instruction
+  } else if (features & PIPE_CACHE) {  // Check if cache is enabled in the simulation configuration
     if(exmem_reg.mem_read == 1 || exmem_reg.mem_write == 1) {  // Check if there is a memory write or read operation
       
       // Process the cache operation and get the latency
       // simulates a cache access and returns the latency incurred
+      cache_p->pc = exmem_reg.instr_addr;
       latency = processCacheOperation(exmem_reg.alu_result, cache_p); 
 
       // Check if the latency indicates a cache miss
@@ -393,34 +618,39 @@ memwb_reg_t stage_mem(exmem_reg_t exmem_reg, pipeline_wires_t* pwires_p, Byte* m
         miss_count++;
       } 
 
-      // Check if the latency indicates a cache hit
-      if (latency == CACHE_HIT_LATENCY) {
+      // Check if the latency indicates a cache (or line buffer) hit
+      if (latency <= CACHE_HIT_LATENCY) {
         hit_count++;
       }
      
-      // Add the cache latency to the total cycle counter
-      total_cycle_counter += latency;
-
-      // Adjust the total cycle counter to account for the current operation
-      total_cycle_counter -= 1;
+      if (sim_config.store_buffer > 0 && exmem_reg.mem_write == 1) {
+        // the store retires into the buffer, only a full buffer holds it up
+        total_cycle_counter += store_buffer_store(&pwires_p->store_buffer, exmem_reg.alu_result, access_size, latency);
+      } else {
+        // Add the cache latency to the total cycle counter
+        total_cycle_counter += latency;
+
+        // Adjust the total cycle counter to account for the current operation
+        total_cycle_counter -= 1;
+      }
 
-      #ifdef PRINT_CACHE_TRACES 
-      printf("[MEM]: Cache latency at addr: 0x%.8x: %ld cycles\n", exmem_reg.alu_result, latency);
-      #endif
+      if (sim_config.print_cache_traces) {
+        printf("[MEM]: Cache latency at addr: 0x%.8x: %ld cycles\n", exmem_reg.alu_result, latency);
+      }
     }
     
   } else {  // If cache not enabled, use the default memory latency
 
-    if(exmem_reg.mem_read == 1 || exmem_reg.mem_write == 1) { // Check if there is a memory write or read operation
-
-      // Add the default memory latency to the total cycle counter
-      total_cycle_counter += MEM_LATENCY;
+    if (sim_config.store_buffer > 0 && exmem_reg.mem_write == 1) {
+      total_cycle_counter += store_buffer_store(&pwires_p->store_buffer, exmem_reg.alu_result, access_size, sim_config.mem_latency);
+      mem_access_counter++;
+    } else if(exmem_reg.mem_read == 1 || exmem_reg.mem_write == 1) { // Check if there is a memory write or read operation
 
-      // Adjust the total cycle counter to account for the current operation
-      // Enclosed in a macro because it messes with milestone 1 if it isnt
-      #ifdef PRINT_CACHE_STATS
-      total_cycle_counter = total_cycle_counter - 1;
-      #endif
+      // Add the default memory latency to the total cycle counter, less the
+      // cycle of the MEM stage itself, as for a cache access above
+      if (sim_config.mem_latency > 0) {
+        total_cycle_counter += sim_config.mem_latency - 1;
+      }
 
       // Incrememnt the memory access counter
       // tracks the number of memory accesses performed
@@ -433,14 +663,12 @@ memwb_reg_t stage_mem(exmem_reg_t exmem_reg, pipeline_wires_t* pwires_p, Byte* m
 }
 
 /**
- * STAGE  : stage_writeback
- * output : nothing - The state of the register file may be changed
- **/ 
-void stage_writeback(memwb_reg_t memwb_reg, pipeline_wires_t* pwires_p, regfile_t* regfile_p)
+ * Task   : The register file write of the writeback stage.
+ * input  : memwb_reg_t, regfile_t*
+ * output : None
+ **/
+PIPE_INLINE void regfile_write(memwb_reg_t memwb_reg, regfile_t* regfile_p)
 {
-  /**
-   * YOUR CODE HERE
-   */
   uint32_t write_data;
 
   // MUX in write back stage that determines if alu_result or read_data is used
@@ -455,11 +683,49 @@ void stage_writeback(memwb_reg_t memwb_reg, pipeline_wires_t* pwires_p, regfile_
       regfile_p->R[memwb_reg.rd] = write_data;  // write data to register
     }
   }
+}
 
-  #ifdef DEBUG_CYCLE
-  printf("[WB ]: Instruction [%08x]@[%08x]: ", memwb_reg.instr.bits, memwb_reg.instr_addr);
-  decode_instruction(memwb_reg.instr.bits);
-  #endif
+/**
+ * STAGE  : stage_writeback
+ * output : nothing - The state of the register file may be changed
+ **/ 
+PIPE_INLINE void stage_writeback_impl(memwb_reg_t memwb_reg, pipeline_wires_t* pwires_p, regfile_t* regfile_p, const unsigned features)
+{
+  /**
+   * YOUR CODE HERE
+   */
+  regfile_write(memwb_reg, regfile_p);
+
+  if (features & PIPE_DEBUG_CYCLE) {
+    trace_stage(TRACE_WB, memwb_reg.instr.bits, memwb_reg.instr_addr);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+ifid_reg_t stage_fetch(pipeline_wires_t* pwires_p, regfile_t* regfile_p, Byte* memory_p)
+{
+  return stage_fetch_impl(pwires_p, regfile_p, memory_p, pipeline_features());
+}
+
+idex_reg_t stage_decode(ifid_reg_t ifid_reg, pipeline_wires_t* pwires_p, regfile_t* regfile_p)
+{
+  return stage_decode_impl(ifid_reg, pwires_p, regfile_p, pipeline_features());
+}
+
+exmem_reg_t stage_execute(idex_reg_t idex_reg, pipeline_wires_t* pwires_p)
+{
+  return stage_execute_impl(idex_reg, pwires_p, pipeline_features());
+}
+
+memwb_reg_t stage_mem(exmem_reg_t exmem_reg, pipeline_wires_t* pwires_p, Byte* memory_p, Cache* cache_p)
+{
+  return stage_mem_impl(exmem_reg, pwires_p, memory_p, cache_p, pipeline_features());
+}
+
+void stage_writeback(memwb_reg_t memwb_reg, pipeline_wires_t* pwires_p, regfile_t* regfile_p)
+{
+  stage_writeback_impl(memwb_reg, pwires_p, regfile_p, pipeline_features());
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -467,18 +733,16 @@ void stage_writeback(memwb_reg_t memwb_reg, pipeline_wires_t* pwires_p, regfile_
 /** 
  * excite the pipeline with one clock cycle
  **/
-void cycle_pipeline(regfile_t* regfile_p, Byte* memory_p, Cache* cache_p, pipeline_regs_t* pregs_p, pipeline_wires_t* pwires_p, bool* ecall_exit)
+PIPE_INLINE void cycle_pipeline_impl(regfile_t* regfile_p, Byte* memory_p, Cache* cache_p, pipeline_regs_t* pregs_p, pipeline_wires_t* pwires_p, bool* ecall_exit, const unsigned features)
 {
-  #ifdef DEBUG_CYCLE
-  printf("v==============");
-  printf("Cycle Counter = %5ld", total_cycle_counter);
-  printf("==============v\n\n");
-  #endif
+  if (features & PIPE_DEBUG_CYCLE) {
+    trace_cycle(total_cycle_counter);
+  }
 
   // process each stage
 
   /* Output               |    Stage      |       Inputs  */
-  pregs_p->ifid_preg.inp  = stage_fetch     (pwires_p, regfile_p, memory_p);
+  pregs_p->ifid_preg.inp  = stage_fetch_impl     (pwires_p, regfile_p, memory_p, features);
   
   // hazard detection unit
   detect_hazard(pregs_p, pwires_p, regfile_p);
@@ -489,16 +753,31 @@ void cycle_pipeline(regfile_t* regfile_p, Byte* memory_p, Cache* cache_p, pipeli
     pwires_p->ifid_write = 0;
   }
 
-  pregs_p->idex_preg.inp  = stage_decode    (pregs_p->ifid_preg.out, pwires_p, regfile_p);
+  // the register file written in the first half of the cycle, read in the second
+  if (sim_config.regfile_write_first) {
+    regfile_write(pregs_p->memwb_preg.out, regfile_p);
+  }
+
+  pregs_p->idex_preg.inp  = stage_decode_impl    (pregs_p->ifid_preg.out, pwires_p, regfile_p, features);
 
   // forwarding unit
-  gen_forward(pregs_p, pwires_p);
+  if (features & PIPE_FWD) {
+    gen_forward(pregs_p, pwires_p);
+  }
+
+  pregs_p->exmem_preg.inp = stage_execute_impl   (pregs_p->idex_preg.out, pwires_p, features);
 
-  pregs_p->exmem_preg.inp = stage_execute   (pregs_p->idex_preg.out, pwires_p);
+  // the instruction in MEM/WB retires this cycle, a CSR read in MEM counts it
+  retired_counter += pregs_p->memwb_preg.out.valid;
 
-  pregs_p->memwb_preg.inp = stage_mem       (pregs_p->exmem_preg.out, pwires_p, memory_p, cache_p);
+  pregs_p->memwb_preg.inp = stage_mem_impl       (pregs_p->exmem_preg.out, pwires_p, memory_p, cache_p, features);
 
-                            stage_writeback (pregs_p->memwb_preg.out, pwires_p, regfile_p);
+                            stage_writeback_impl (pregs_p->memwb_preg.out, pwires_p, regfile_p, features);
+
+  // lockstep check of the instruction that just retired
+  if (sim_config.cosim_en && pregs_p->memwb_preg.out.valid) {
+    cosim_retire(&pregs_p->memwb_preg.out, regfile_p);
+  }
 
   // update all the output registers for the next cycle from the input registers in the current cycle
   pregs_p->ifid_preg.out  = pregs_p->ifid_preg.inp;
@@ -507,22 +786,28 @@ void cycle_pipeline(regfile_t* regfile_p, Byte* memory_p, Cache* cache_p, pipeli
   pregs_p->memwb_preg.out = pregs_p->memwb_preg.inp;
 
   // Flush registers if branch is taken
-  // Enclosed by this macro because milestone1 wont work
-  // This is because in milestone 2 everytime a branch is taken it is considered a hazard
-  #ifdef PRINT_STATS
-  if(pwires_p->pcsrc == 1) {
+  // Not in milestone 1, whose traces let the wrong path run on
+  // In milestone 2 everytime a branch is taken it is considered a hazard
+  // the bubbles unit_hazard() inserted move on with the registers
+  scoreboard_t* sb = &pwires_p->scoreboard;
+  sb->bubbles = ((sb->bubbles << 1) | sb->stalled) & 0x3;
+  sb->stalled = false;
+
+  if(pwires_p->pcsrc == 1 && sim_config.flush_branches) {
     flush_pipeline(pregs_p);
+    // a stall raised this cycle was for a squashed instruction, fetch the target
+    pwires_p->pc_write = 0;
+    sb->bubbles = 0;
   }
-  #endif
 
   /////////////////// NO CHANGES BELOW THIS ARE REQUIRED //////////////////////
 
   // increment the cycle
   total_cycle_counter++;
 
-  #ifdef DEBUG_REG_TRACE
-  print_register_trace(regfile_p);
-  #endif
+  if (features & PIPE_REG_TRACE) {
+    print_register_trace(regfile_p);
+  }
 
   /**
    * check ecall condition
@@ -548,3 +833,32 @@ void cycle_pipeline(regfile_t* regfile_p, Byte* memory_p, Cache* cache_p, pipeli
   }
 }
 
+// one specialization of cycle_pipeline_impl() per feature mask
+#define PIPELINE_VARIANT(f)                                                       \
+  static void cycle_pipeline_##f(regfile_t* regfile_p, Byte* memory_p, Cache* cache_p, \
+                                 pipeline_regs_t* pregs_p, pipeline_wires_t* pwires_p, bool* ecall_exit) \
+  {                                                                               \
+    cycle_pipeline_impl(regfile_p, memory_p, cache_p, pregs_p, pwires_p, ecall_exit, f); \
+  }
+
+PIPELINE_VARIANT(0)  PIPELINE_VARIANT(1)  PIPELINE_VARIANT(2)  PIPELINE_VARIANT(3)
+PIPELINE_VARIANT(4)  PIPELINE_VARIANT(5)  PIPELINE_VARIANT(6)  PIPELINE_VARIANT(7)
+PIPELINE_VARIANT(8)  PIPELINE_VARIANT(9)  PIPELINE_VARIANT(10) PIPELINE_VARIANT(11)
+PIPELINE_VARIANT(12) PIPELINE_VARIANT(13) PIPELINE_VARIANT(14) PIPELINE_VARIANT(15)
+
+static const pipeline_fn_t pipeline_variants[PIPE_VARIANTS] = {
+  cycle_pipeline_0,  cycle_pipeline_1,  cycle_pipeline_2,  cycle_pipeline_3,
+  cycle_pipeline_4,  cycle_pipeline_5,  cycle_pipeline_6,  cycle_pipeline_7,
+  cycle_pipeline_8,  cycle_pipeline_9,  cycle_pipeline_10, cycle_pipeline_11,
+  cycle_pipeline_12, cycle_pipeline_13, cycle_pipeline_14, cycle_pipeline_15,
+};
+
+pipeline_fn_t pipeline_variant(void)
+{
+  return pipeline_variants[pipeline_features()];
+}
+
+void cycle_pipeline(regfile_t* regfile_p, Byte* memory_p, Cache* cache_p, pipeline_regs_t* pregs_p, pipeline_wires_t* pwires_p, bool* ecall_exit)
+{
+  pipeline_variant()(regfile_p, memory_p, cache_p, pregs_p, pwires_p, ecall_exit);
+}
@@ -13,7 +13,6 @@
 /// Functionality
 ///////////////////////////////////////////////////////////////////////////////
 
-extern simulator_config_t sim_config;
 extern uint64_t miss_count;
 extern uint64_t hit_count;
 extern uint64_t total_cycle_counter;
@@ -22,6 +21,14 @@ extern uint64_t stall_counter;
 extern uint64_t branch_counter;
 extern uint64_t fwd_exex_counter;
 extern uint64_t fwd_exmem_counter;
+extern uint64_t retired_counter;    // instructions through writeback
+extern uint64_t sb_store_counter;           // stores through the store buffer
+extern uint64_t sb_occupancy_counter;       // entries in use, summed over those stores
+extern uint64_t sb_full_stall_counter;      // cycles stores waited for a free entry
+extern uint64_t sb_forward_counter;         // loads served from the store buffer
+extern uint64_t sb_conflict_stall_counter;  // cycles loads waited for an overlapping store
+extern uint64_t unit_stall_counter;         // cycles dependents waited for a multiply/divide result
+extern uint64_t unit_busy_counter;          // cycles multiplies/divides waited for their unit
 
 ///////////////////////////////////////////////////////////////////////////////
 /// RISC-V Pipeline Register Types
@@ -31,6 +38,7 @@ typedef struct
 {
   Instruction instr;
   uint32_t    instr_addr; // instruction address
+  bool        valid;      // false for bubbles and flushed slots
   /**
    * Add other fields here
    */
@@ -41,6 +49,7 @@ typedef struct
 {
   Instruction instr;
   uint32_t    instr_addr;
+  bool        valid;
   /**
    * Add other fields here
    */
@@ -71,6 +80,7 @@ typedef struct
   bool mem_read;
   bool mem_write;
   bool branch;
+  bool csr;         // CSR access, done in place of the memory access
 
   // Execution/address calculation stage control lines
   uint8_t alu_op0;
@@ -88,6 +98,7 @@ typedef struct
 {
   Instruction instr;
   uint32_t    instr_addr;
+  bool        valid;
   /**
    * Add other fields here
    */
@@ -116,6 +127,7 @@ typedef struct
   bool mem_read;
   bool mem_write;
   bool branch;
+  bool csr;         // CSR access, done in place of the memory access
 
 }exmem_reg_t;
 
@@ -123,12 +135,16 @@ typedef struct
 {
   Instruction instr;
   uint32_t    instr_addr;
+  bool        valid;
   /**
    * Add other fields here
    */
 
   // output of the data memory block
   uint32_t read_data;
+
+  // value written by a store (checked by the co-simulator)
+  uint32_t write_data;
  
   // ALU result that bypasses data memory block
   uint32_t alu_result;
@@ -184,6 +200,35 @@ typedef struct
   memwb_reg_pair_t memwb_preg;
 }pipeline_regs_t;
 
+#define STORE_BUFFER_MAX 64
+
+// stores waiting to drain to the cache (--store-buffer), oldest first
+typedef struct
+{
+  uint32_t address[STORE_BUFFER_MAX];
+  uint32_t size[STORE_BUFFER_MAX];   // bytes
+  uint64_t done[STORE_BUFFER_MAX];   // total_cycle_counter once it is in the cache
+  uint32_t count;
+}store_buffer_t;
+
+// execution units; multiply and divide take --mul-latency/--div-latency cycles
+enum exec_unit_enum
+{
+  UNIT_ALU,
+  UNIT_MUL,
+  UNIT_DIV,
+  UNITS
+};
+
+// when results and units become available, in total_cycle_counter cycles
+typedef struct
+{
+  uint64_t ready[32];     // a dependent of the register can execute from this cycle on
+  uint64_t free[UNITS];   // the unit accepts its next operation from this cycle on
+  bool     stalled;       // unit_hazard() stalled this cycle
+  uint8_t  bubbles;       // bit 0: ID/EX, bit 1: EX/MEM holds a bubble unit_hazard() put there
+}scoreboard_t;
+
 typedef struct
 {
   bool      pcsrc;
@@ -211,7 +256,9 @@ typedef struct
   uint8_t rs1;
   uint8_t rs2;
   uint8_t rd;
-  
+
+  store_buffer_t store_buffer;
+  scoreboard_t scoreboard;
 
 }pipeline_wires_t;
 
@@ -247,6 +294,16 @@ void stage_writeback(memwb_reg_t memwb_reg, pipeline_wires_t* pwires_p, regfile_
 
 void cycle_pipeline(regfile_t* regfile_p, Byte* memory_p, Cache* cache_p, pipeline_regs_t* pregs_p, pipeline_wires_t* pwires_p, bool* ecall_exit);
 
+typedef void (*pipeline_fn_t)(regfile_t* regfile_p, Byte* memory_p, Cache* cache_p, pipeline_regs_t* pregs_p, pipeline_wires_t* pwires_p, bool* ecall_exit);
+
+/**
+ * Returns the variant of cycle_pipeline() compiled for the current sim_config
+ * (trace, register trace, cache and forwarding on or off). Pick it once after
+ * the configuration is final and call it every cycle instead of
+ * cycle_pipeline(), which looks the variant up again each time.
+ **/
+pipeline_fn_t pipeline_variant(void);
+
 void bootstrap(pipeline_wires_t* pwires_p, pipeline_regs_t* pregs_p, regfile_t* regfile_p);
 
 #endif  // __PIPELINE_H__
@@ -0,0 +1,248 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "types.h"
+#include "reuse.h"
+#include "utils.h"
+
+#define REUSE_MIN_POSITIONS  (1ULL << 16)  // smallest Fenwick tree
+#define REUSE_BUCKETS        65            // 0, then one per power of two
+
+bool reuse_active = false;
+bool reuse_fetch_active = false;
+
+// a block's last access, open addressing, key 0 is empty
+typedef struct
+{
+  uint64_t key;      // block number + 1
+  uint64_t pos;      // position of the last access in the tree
+  uint64_t window;   // working-set window of the last access
+}reuse_entry_t;
+
+// the analysis for one block size
+typedef struct
+{
+  uint32_t       shift;     // log2 of the block size
+  reuse_entry_t* table;
+  uint64_t       slots;
+  uint64_t       blocks;
+
+  // Fenwick tree over positions, 1 where some block was last accessed
+  uint32_t*      tree;      // 1-based, tree[0] unused
+  uint64_t       size;      // positions
+  uint64_t       now;       // position of the next access
+
+  uint64_t       hist[REUSE_BUCKETS];
+  uint64_t       cold;
+
+  uint64_t       window;    // current working-set window
+  uint64_t       window_blocks;
+  uint64_t*      ws;        // blocks per completed window
+  uint64_t       nws, max_ws;
+}reuse_analyser_t;
+
+static struct
+{
+  reuse_opts_t      opts;
+  reuse_analyser_t  an[REUSE_MAX_BLOCKS];
+  uint64_t          accesses;
+}reuse;
+
+// named in allocation failures
+static const char reuse_what[] = "the reuse-distance analysis";
+
+static uint64_t reuse_hash(uint64_t key, uint64_t slots)
+{
+  return ((key * 0x9E3779B97F4A7C15ULL) >> 20) & (slots - 1);
+}
+
+static void fenwick_add(reuse_analyser_t* a, uint64_t i, int32_t delta)
+{
+  for (; i <= a->size; i += i & -i) {
+    a->tree[i] += delta;
+  }
+}
+
+static uint64_t fenwick_sum(const reuse_analyser_t* a, uint64_t i)
+{
+  uint64_t sum = 0;
+  for (; i > 0; i -= i & -i) {
+    sum += a->tree[i];
+  }
+  return sum;
+}
+
+static void reuse_grow_table(reuse_analyser_t* a)
+{
+  reuse_entry_t* old = a->table;
+  uint64_t slots = a->slots;
+
+  a->slots = slots ? slots * 2 : 1024;
+  a->table = checked_realloc(NULL, a->slots * sizeof(reuse_entry_t), reuse_what);
+  memset(a->table, 0, a->slots * sizeof(reuse_entry_t));
+  for (uint64_t i = 0; i < slots; i++) {
+    if (old[i].key != 0) {
+      uint64_t h = reuse_hash(old[i].key, a->slots);
+      while (a->table[h].key != 0) h = (h + 1) & (a->slots - 1);
+      a->table[h] = old[i];
+    }
+  }
+  free(old);
+}
+
+static int reuse_compare_pos(const void* x, const void* y)
+{
+  const reuse_entry_t* a = *(reuse_entry_t* const*)x;
+  const reuse_entry_t* b = *(reuse_entry_t* const*)y;
+  return (a->pos > b->pos) - (a->pos < b->pos);
+}
+
+/**
+ * Renumbers the last accesses 0..blocks-1 in their order and rebuilds the
+ * tree with room for as many accesses again.
+ **/
+static void reuse_compact(reuse_analyser_t* a)
+{
+  reuse_entry_t** live = checked_realloc(NULL, (a->blocks + 1) * sizeof(reuse_entry_t*), reuse_what);
+  uint64_t n = 0;
+  for (uint64_t i = 0; i < a->slots; i++) {
+    if (a->table[i].key != 0) {
+      live[n++] = &a->table[i];
+    }
+  }
+  qsort(live, n, sizeof(reuse_entry_t*), reuse_compare_pos);
+  for (uint64_t i = 0; i < n; i++) {
+    live[i]->pos = i;
+  }
+  free(live);
+
+  a->size = 2 * n > REUSE_MIN_POSITIONS ? 2 * n : REUSE_MIN_POSITIONS;
+  a->tree = checked_realloc(a->tree, (a->size + 1) * sizeof(uint32_t), reuse_what);
+  memset(a->tree, 0, (a->size + 1) * sizeof(uint32_t));
+  // positions 0..n-1 are marked, build the sums bottom up in O(size)
+  for (uint64_t i = 1; i <= n; i++) {
+    a->tree[i] = 1;
+  }
+  for (uint64_t i = 1; i <= a->size; i++) {
+    uint64_t parent = i + (i & -i);
+    if (parent <= a->size) {
+      a->tree[parent] += a->tree[i];
+    }
+  }
+  a->now = n;
+}
+
+static void reuse_push_window(reuse_analyser_t* a)
+{
+  if (a->nws == a->max_ws) {
+    a->max_ws = a->max_ws ? a->max_ws * 2 : 256;
+    a->ws = checked_realloc(a->ws, a->max_ws * sizeof(uint64_t), reuse_what);
+  }
+  a->ws[a->nws++] = a->window_blocks;
+  a->window_blocks = 0;
+}
+
+static void reuse_analyse(reuse_analyser_t* a, Address address, uint64_t window)
+{
+  if (window != a->window) {
+    reuse_push_window(a);
+    a->window = window;
+  }
+  if (a->now == a->size) {
+    reuse_compact(a);
+  }
+  if (2 * (a->blocks + 1) > a->slots) {
+    reuse_grow_table(a);
+  }
+
+  uint64_t key = ((uint64_t)address >> a->shift) + 1;
+  uint64_t h = reuse_hash(key, a->slots);
+  while (a->table[h].key != 0 && a->table[h].key != key) {
+    h = (h + 1) & (a->slots - 1);
+  }
+  reuse_entry_t* e = &a->table[h];
+
+  if (e->key == 0) {
+    e->key = key;
+    e->window = window;
+    a->blocks++;
+    a->cold++;
+    a->window_blocks++;
+  } else {
+    // marks strictly between the previous access and this one
+    uint64_t distance = fenwick_sum(a, a->now) - fenwick_sum(a, e->pos + 1);
+    a->hist[distance ? 64 - __builtin_clzll(distance) : 0]++;
+    fenwick_add(a, e->pos + 1, -1);
+    if (e->window != window) {
+      e->window = window;
+      a->window_blocks++;
+    }
+  }
+  e->pos = a->now++;
+  fenwick_add(a, e->pos + 1, 1);
+}
+
+void reuse_open(const reuse_opts_t* opts)
+{
+  memset(&reuse, 0, sizeof(reuse));
+  reuse.opts = *opts;
+  for (int i = 0; i < opts->nblocks; i++) {
+    reuse.an[i].shift = __builtin_ctz(opts->block_bytes[i]);
+  }
+  reuse_active = true;
+  reuse_fetch_active = opts->fetch;
+  close_at_exit(reuse_close);
+}
+
+void reuse_access(Address address)
+{
+  uint64_t window = reuse.accesses++ / reuse.opts.window;
+  for (int i = 0; i < reuse.opts.nblocks; i++) {
+    reuse_analyse(&reuse.an[i], address, window);
+  }
+}
+
+void reuse_close(void)
+{
+  if (!reuse_active) {
+    return;
+  }
+  reuse_active = false;
+  reuse_fetch_active = false;
+
+  FILE* out = fopen(reuse.opts.path, "w");
+  if (out == NULL) {
+    printf("Error: unable to write %s\n", reuse.opts.path);
+    exit(-1);
+  }
+  for (int i = 0; i < reuse.opts.nblocks; i++) {
+    reuse_analyser_t* a = &reuse.an[i];
+    uint32_t bytes = 1U << a->shift;
+
+    int last = REUSE_BUCKETS - 1;
+    while (last > 0 && a->hist[last] == 0) last--;
+    uint64_t cumulative = 0;
+    for (int b = 0; b <= last; b++) {
+      uint64_t lo = b ? 1ULL << (b - 1) : 0;
+      uint64_t hi = b ? (1ULL << b) - 1 : 0;
+      cumulative += a->hist[b];
+      fprintf(out, "reuse,%u,%lu,%lu,%lu,%.6f\n", bytes, (unsigned long)lo, (unsigned long)hi,
+              (unsigned long)a->hist[b], reuse.accesses ? (double)cumulative / reuse.accesses : 0.0);
+    }
+    fprintf(out, "cold,%u,%lu\n", bytes, (unsigned long)a->cold);
+
+    if (reuse.accesses) {
+      reuse_push_window(a);
+    }
+    for (uint64_t w = 0; w < a->nws; w++) {
+      fprintf(out, "ws,%u,%lu,%lu,%lu\n", bytes, (unsigned long)w,
+              (unsigned long)(w * reuse.opts.window), (unsigned long)a->ws[w]);
+    }
+
+    free(a->table);
+    free(a->tree);
+    free(a->ws);
+  }
+  fclose(out);
+  printf("[REUSE]: %lu accesses analysed, written to %s\n", (unsigned long)reuse.accesses, reuse.opts.path);
+}
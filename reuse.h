@@ -0,0 +1,70 @@
+#ifndef __REUSE_H__
+#define __REUSE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "types.h"
+
+///////////////////////////////////////////////////////////////////////////////
+/// Reuse-distance and working-set analysis of the guest's memory accesses
+///////////////////////////////////////////////////////////////////////////////
+
+/**
+ * The reuse distance of an access is the number of distinct blocks touched
+ * since the previous access to the same block, or cold if there was none. A
+ * fully associative LRU cache of C blocks hits exactly the accesses with a
+ * distance below C, so the cumulative histogram is its hit ratio for every
+ * C at once.
+ *
+ * Each access is stamped with its position in the stream and only the last
+ * access to every block stays marked in a Fenwick tree over the positions;
+ * the distance is the number of marks after the block's previous position,
+ * O(log n) per access. When the positions run out the live ones are
+ * renumbered, so the tree stays proportional to the number of blocks
+ * touched rather than to the length of the run.
+ *
+ * The working set of a window of consecutive accesses is the number of
+ * distinct blocks it touches.
+ *
+ * The report is a CSV with the record type in the first column:
+ *
+ *   reuse,<block bytes>,<min distance>,<max distance>,<accesses>,<cumulative fraction>
+ *   cold,<block bytes>,<accesses>
+ *   ws,<block bytes>,<window>,<first access>,<blocks>
+ *
+ * Distances are grouped in powers of two.
+ */
+
+#define REUSE_MAX_BLOCKS  8   // block sizes analysed at once
+
+typedef struct
+{
+  const char* path;             // the report
+  uint32_t    block_bytes[REUSE_MAX_BLOCKS];
+  int         nblocks;
+  uint64_t    window;           // accesses per working-set window
+  bool        fetch;            // also instruction fetches
+}reuse_opts_t;
+
+// true between reuse_open() and reuse_close()
+extern bool reuse_active;
+// true if instruction fetches are analysed too
+extern bool reuse_fetch_active;
+
+/**
+ * Starts the analysis. The report is written by reuse_close(), at exit at
+ * the latest.
+ **/
+void reuse_open(const reuse_opts_t* opts);
+
+/**
+ * Accounts for one access to address, a load/store or instruction fetch.
+ **/
+void reuse_access(Address address);
+
+/**
+ * Writes the report and stops the analysis.
+ **/
+void reuse_close(void);
+
+#endif  // __REUSE_H__
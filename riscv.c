@@ -11,6 +11,15 @@
 #include <unistd.h>
 #include "cache.h"
 #include "pipeline.h"
+#include "blockcache.h"
+#include "memory.h"
+#include "cosim.h"
+#include "expect.h"
+#include "trace.h"
+#include "checkpoint.h"
+#include "simpoint.h"
+#include "reuse.h"
+#include "heatmap.h"
 
 /* WARNING: DO NOT CHANGE THIS FILE.
  YOU PROBABLY DON'T EVEN NEED TO LOOK AT IT... */
@@ -19,8 +28,309 @@
 Byte *memory;
 #define MAX_SIZE 50
 
+// long-only options
+enum
+{
+  OPT_COSIM = 256,
+  OPT_EXPECT,
+  OPT_TRACE_BIN,
+  OPT_SYNC_TRACE,
+  OPT_TRACE,
+  OPT_STATS,
+  OPT_MEM_LATENCY,
+  OPT_MILESTONE,
+  OPT_CHECKPOINT,
+  OPT_CHECKPOINT_AT,
+  OPT_RESTORE,
+  OPT_FFWD,
+  OPT_FFWD_WARM,
+  OPT_BBV,
+  OPT_INTERVAL,
+  OPT_SIMPOINT,
+  OPT_WARMUP,
+  OPT_PARALLEL,
+  OPT_CACHE_SETS,
+  OPT_CACHE_WAYS,
+  OPT_CACHE_BLOCK,
+  OPT_CACHE_SAMPLE,
+  OPT_CACHE_INDEX,
+  OPT_LINE_BUFFER,
+  OPT_LINE_BUFFER_LATENCY,
+  OPT_STORE_BUFFER,
+  OPT_MUL_LATENCY,
+  OPT_MUL_INTERVAL,
+  OPT_DIV_LATENCY,
+  OPT_REGFILE_WRITE_FIRST,
+  OPT_REUSE,
+  OPT_REUSE_BLOCKS,
+  OPT_REUSE_WINDOW,
+  OPT_REUSE_FETCH,
+  OPT_HEATMAP,
+  OPT_HEATMAP_INTERVAL,
+  OPT_MEM_SIZE,
+};
+
+static const struct option long_options[] = {
+  {"cosim", no_argument, NULL, OPT_COSIM},
+  {"expect", required_argument, NULL, OPT_EXPECT},
+  {"trace-bin", required_argument, NULL, OPT_TRACE_BIN},
+  {"sync-trace", no_argument, NULL, OPT_SYNC_TRACE},
+  {"trace", required_argument, NULL, OPT_TRACE},
+  {"stats", required_argument, NULL, OPT_STATS},
+  {"mem-latency", required_argument, NULL, OPT_MEM_LATENCY},
+  {"milestone", required_argument, NULL, OPT_MILESTONE},
+  {"checkpoint", required_argument, NULL, OPT_CHECKPOINT},
+  {"checkpoint-at", required_argument, NULL, OPT_CHECKPOINT_AT},
+  {"restore", required_argument, NULL, OPT_RESTORE},
+  {"ffwd", required_argument, NULL, OPT_FFWD},
+  {"ffwd-warm", no_argument, NULL, OPT_FFWD_WARM},
+  {"bbv", required_argument, NULL, OPT_BBV},
+  {"interval", required_argument, NULL, OPT_INTERVAL},
+  {"simpoint", required_argument, NULL, OPT_SIMPOINT},
+  {"warmup", required_argument, NULL, OPT_WARMUP},
+  {"parallel", required_argument, NULL, OPT_PARALLEL},
+  {"cache-sets", required_argument, NULL, OPT_CACHE_SETS},
+  {"cache-ways", required_argument, NULL, OPT_CACHE_WAYS},
+  {"cache-block", required_argument, NULL, OPT_CACHE_BLOCK},
+  {"cache-sample", required_argument, NULL, OPT_CACHE_SAMPLE},
+  {"cache-index", required_argument, NULL, OPT_CACHE_INDEX},
+  {"line-buffer", required_argument, NULL, OPT_LINE_BUFFER},
+  {"line-buffer-latency", required_argument, NULL, OPT_LINE_BUFFER_LATENCY},
+  {"store-buffer", required_argument, NULL, OPT_STORE_BUFFER},
+  {"mul-latency", required_argument, NULL, OPT_MUL_LATENCY},
+  {"mul-interval", required_argument, NULL, OPT_MUL_INTERVAL},
+  {"div-latency", required_argument, NULL, OPT_DIV_LATENCY},
+  {"regfile-write-first", no_argument, NULL, OPT_REGFILE_WRITE_FIRST},
+  {"reuse", required_argument, NULL, OPT_REUSE},
+  {"reuse-blocks", required_argument, NULL, OPT_REUSE_BLOCKS},
+  {"reuse-window", required_argument, NULL, OPT_REUSE_WINDOW},
+  {"reuse-fetch", no_argument, NULL, OPT_REUSE_FETCH},
+  {"heatmap", required_argument, NULL, OPT_HEATMAP},
+  {"heatmap-interval", required_argument, NULL, OPT_HEATMAP_INTERVAL},
+  {"mem-size", required_argument, NULL, OPT_MEM_SIZE},
+  {NULL, 0, NULL, 0}
+};
+
+// names accepted by --trace and --stats, "all" and "none" also work
+typedef struct
+{
+  const char *name;
+  bool *flag;
+}named_flag_t;
+
+static const named_flag_t trace_flags[] = {
+  {"cycle", &sim_config.debug_cycle},
+  {"regs", &sim_config.debug_reg_trace},
+  {"cache", &sim_config.print_cache_traces},
+  {NULL, NULL}
+};
+
+static const named_flag_t stats_flags[] = {
+  {"pipeline", &sim_config.print_stats},
+  {"cache", &sim_config.print_cache_stats},
+  {"mem", &sim_config.print_mem_stats},
+  {"3c", &sim_config.print_miss_classes},
+  {NULL, NULL}
+};
+
+/**
+ * Turns on exactly the flags named in the comma-separated list.
+ **/
+static void set_flags(const char *option, const named_flag_t *flags, const char *list) {
+  for (const named_flag_t *f = flags; f->name; f++) {
+    *f->flag = false;
+  }
+
+  char *copy = strdup(list);
+  for (char *name = strtok(copy, ","); name; name = strtok(NULL, ",")) {
+    bool all = strcmp(name, "all") == 0;
+    bool found = all || strcmp(name, "none") == 0;
+    for (const named_flag_t *f = flags; f->name; f++) {
+      if (all || strcmp(name, f->name) == 0) {
+        *f->flag = true;
+        found = true;
+      }
+    }
+    if (!found) {
+      fprintf(stderr, "Unknown --%s setting %s\n", option, name);
+      exit(-1);
+    }
+  }
+  free(copy);
+}
+
+/**
+ * The config.h settings each milestone's tests were written for. The cache
+ * itself is still switched on with -c. Apart from the flush and the memory
+ * latency, these only choose what is printed.
+ **/
+static void set_milestone(const char *arg) {
+  int milestone = atoi(arg);
+  if (milestone < 1 || milestone > 3) {
+    fprintf(stderr, "--milestone must be 1, 2 or 3\n");
+    exit(-1);
+  }
+  set_flags("trace", trace_flags, milestone == 3 ? "all" : "cycle,regs");
+  set_flags("stats", stats_flags, milestone == 1 ? "none" : milestone == 2 ? "pipeline" : "pipeline,cache");
+  sim_config.mem_latency = (milestone == 3) ? 100 : 0;
+  sim_config.flush_branches = (milestone != 1);
+}
+
+/**
+ * log2 of an option that must be a power of two.
+ **/
+static int log2_option(const char *name, const char *arg) {
+  unsigned long long value = strtoull(arg, NULL, 0);
+  if (value == 0 || (value & (value - 1)) != 0) {
+    fprintf(stderr, "--%s must be a power of two\n", name);
+    exit(-1);
+  }
+  int bits = 0;
+  while ((1ULL << bits) < value) bits++;
+  return bits;
+}
+
+/**
+ * The --cache-index set index function.
+ **/
+static int parse_cache_index(const char *name) {
+  static const char *const names[] = {
+    [CACHE_INDEX_MOD] = "mod",
+    [CACHE_INDEX_XOR] = "xor",
+    [CACHE_INDEX_PRIME] = "prime",
+    [CACHE_INDEX_SKEW] = "skew",
+  };
+  for (int i = 0; i < (int)(sizeof(names) / sizeof(names[0])); i++) {
+    if (strcmp(name, names[i]) == 0) {
+      return i;
+    }
+  }
+  fprintf(stderr, "Unknown --cache-index %s, use mod, xor, prime or skew\n", name);
+  exit(-1);
+}
+
+/**
+ * The address the load or store at the PC is about to access. false for
+ * other instructions.
+ **/
+static bool data_address_emu(const regfile_t *regfile, Address *address) {
+  Instruction instruction = parse_instruction(load(memory, regfile->PC, LENGTH_WORD));
+  if (instruction.opcode == 0x03) {
+    *address = regfile->R[instruction.itype.rs1] + sign_extend_number(instruction.itype.imm, 12);
+    return true;
+  } else if (instruction.opcode == 0x23) {
+    *address = regfile->R[instruction.stype.rs1] + get_store_offset(instruction);
+    return true;
+  }
+  return false;
+}
+
+/**
+ * Sends the load or store at the PC through the cache before it executes
+ * (-m -c and --ffwd-warm).
+ **/
+static void cache_access_emu(regfile_t *regfile, Cache *cache) {
+  Address address;
+  cache->pc = regfile->PC;
+  if (data_address_emu(regfile, &address)) {
+    processCacheOperation(address, cache);
+  }
+}
+
+/**
+ * Parses the --reuse-blocks list of block sizes in bytes.
+ **/
+static void parse_reuse_blocks(reuse_opts_t *opts, const char *list) {
+  char *copy = strdup(list);
+  opts->nblocks = 0;
+  for (char *size = strtok(copy, ","); size; size = strtok(NULL, ",")) {
+    if (opts->nblocks == REUSE_MAX_BLOCKS) {
+      fprintf(stderr, "--reuse-blocks takes at most %d sizes\n", REUSE_MAX_BLOCKS);
+      exit(-1);
+    }
+    opts->block_bytes[opts->nblocks++] = 1U << log2_option("reuse-blocks", size);
+  }
+  free(copy);
+}
+
+/**
+ * Statistics of the functional cache model (-m -c). With --cache-sample the
+ * counts are estimated from the modeled sets.
+ **/
+static void print_cache_model(const Cache *cache) {
+  double bound;
+  double ratio = cache_miss_ratio(cache, &bound);
+  unsigned long long misses = (unsigned long long)(ratio * cache->accesses + 0.5);
+  if (cache->lineBufferSize > 0) {
+    /* these never reach the cache */
+    unsigned long long total = cache->lineBufferHits + cache->accesses;
+    printf("#Line buffer hits  = %5llu (%.1f%% of accesses)\n", cache->lineBufferHits,
+           total ? 100.0 * cache->lineBufferHits / total : 0.0);
+  }
+  printf("#Cache accesses    = %5llu\n", cache->accesses);
+  printf("#Cache hits        = %5llu\n", cache->accesses - misses);
+  printf("#Cache misses      = %5llu\n", misses);
+  if (cache->sampleBits) {
+    printf("#Cache miss ratio  = %.4f +/- %.4f (95%%, %llu of %llu sets)\n", ratio, bound,
+           cache_modeled_sets(cache), 1ULL << cache->setBits);
+  } else {
+    printf("#Cache miss ratio  = %.4f\n", ratio);
+  }
+  cache_print_miss_classes(cache);
+}
+
+/**
+ * The statistics at the end of a -s run, as selected with --stats.
+ **/
+static void print_pipeline_stats(const Cache *cache) {
+  if (sim_config.print_stats) {
+    printf("#Cycles            = %5ld\n", total_cycle_counter);
+    printf("#Forwards (EX-EX)  = %5ld\n", fwd_exex_counter);
+    printf("#Forwards (EX-MEM) = %5ld\n", fwd_exmem_counter);
+    printf("#Branches taken    = %5ld\n", branch_counter);
+    printf("#Stalls            = %5ld\n", stall_counter);
+    if (sim_config.store_buffer > 0) {
+      printf("#Buffered stores   = %5ld\n", sb_store_counter);
+      printf("#Store buffer use  = %5.2f entries on average\n",
+             sb_store_counter ? (double)sb_occupancy_counter / sb_store_counter : 0.0);
+      printf("#Store buffer full = %5ld cycles\n", sb_full_stall_counter);
+      printf("#Stores forwarded  = %5ld\n", sb_forward_counter);
+      printf("#Store conflicts   = %5ld cycles\n", sb_conflict_stall_counter);
+    }
+    if (sim_config.mul_latency > 1 || sim_config.div_latency > 1) {
+      /* included in #Stalls */
+      printf("#MUL/DIV stalls    = %5ld\n", unit_stall_counter);
+      printf("#MUL/DIV unit busy = %5ld\n", unit_busy_counter);
+    }
+  }
+  if (sim_config.print_cache_stats) {
+    if (sim_config.cache_en) {
+      printf("#MEM   stalls      = %5ld\n", ((miss_count*sim_config.mem_latency) + ((hit_count+miss_count) * (CACHE_HIT_LATENCY-1))));
+    } else {
+      printf("#MEM   stalls      = %5ld\n", (mem_access_counter*(sim_config.mem_latency-1)));
+    }
+    printf("#Cache accesses    = %5ld\n", hit_count+miss_count);
+    printf("#Cache hits        = %5ld\n", hit_count);
+    printf("#Cache misses      = %5ld\n", miss_count);
+    if (sim_config.cache_en && cache->lineBufferSize > 0) {
+      /* counted as hits above */
+      printf("#Line buffer hits  = %5llu (%.1f%% of accesses)\n", cache->lineBufferHits,
+             hit_count + miss_count ? 100.0 * cache->lineBufferHits / (hit_count + miss_count) : 0.0);
+    }
+  }
+  if (sim_config.cache_en) {
+    cache_print_miss_classes(cache);
+  }
+  if (sim_config.print_mem_stats) {
+    printf("#Resident memory   = %5zu KiB\n", mem_resident_bytes() / 1024);
+  }
+}
+
+uint64_t emu_retired_counter = 0;
+
 void execute_emu(regfile_t *regfile, int prompt, int print) {
   /* fetch an instruction */
+  mem_fault_pc = regfile->PC;
   uint32_t instruction_bits = load(memory, regfile->PC, LENGTH_WORD);
 
   /* interactive-mode prompt */
@@ -36,24 +346,47 @@ void execute_emu(regfile_t *regfile, int prompt, int print) {
   }
 
   execute_instruction(instruction_bits, regfile, memory);
+  emu_retired_counter++;
 
   // enforce $0 being hard-wired to 0
   regfile->R[0] = 0;
 
   // print trace
   if (print) {
-    int i, j;
-
-    for (i = 0; i < 8; i++) {
-      for (j = 0; j < 4; j++) {
-        printf("r%2d=%08x ", i * 4 + j, regfile->R[i * 4 + j]);
-      }
+    trace_regs(regfile);
+  }
+}
 
-      puts("");
+/**
+ * Runs up to n instructions functionally (--ffwd) so the pipeline can start
+ * at the region of interest. With warm_cache every load and store also goes
+ * through the cache; its counters are cleared afterwards so the statistics
+ * only cover the pipeline run. Returns the number of instructions executed.
+ **/
+static uint64_t fast_forward(regfile_t *regfile, Cache *cache, uint64_t n,
+                             int blocks, int jit, int warm_cache) {
+  if (blocks && !warm_cache) {
+    bool halted = false;
+    bb_set_jit(jit);
+    uint64_t done = bb_run(regfile, memory, n, &halted);
+    if (halted) {
+      /* the program ends before the region of interest */
+      execute_emu(regfile, 0, 0);
     }
+    return done;
+  }
 
-    printf("\n");
+  bool cache_traces = sim_config.print_cache_traces;
+  sim_config.print_cache_traces = false;
+  for (uint64_t i = 0; i < n; i++) {
+    if (warm_cache) {
+      cache_access_emu(regfile, cache);
+    }
+    execute_emu(regfile, 0, 0);
   }
+  sim_config.print_cache_traces = cache_traces;
+  cache_clear_stats(cache);
+  return n;
 }
 
 int load_program(uint8_t *mem, size_t memsize, int startaddr,
@@ -82,6 +415,17 @@ int load_program(uint8_t *mem, size_t memsize, int startaddr,
   return programsize;
 }
 
+/**
+ * Loads code through the read/write window with load_program() and then
+ * makes its pages read-only, so a store into the program faults.
+ **/
+static int load_code(uint8_t *mem, int startaddr, const char *filename, int disasm) {
+  int numins = load_program(mem, GUEST_SPACE_SIZE, startaddr, filename, disasm);
+  mem_populate(startaddr, 4 * (uint64_t)numins);
+  mem_protect(startaddr, 4 * (uint64_t)numins, MEM_PERM_R | MEM_PERM_X);
+  return numins;
+}
+
 int main(int argc, char **argv) {
   /* options */
   int opt_disasm = 0,
@@ -93,9 +437,32 @@ int main(int argc, char **argv) {
       opt_init_reg = 0,
       opt_cache = 0,
       opt_forwarding = 0,
+      opt_blocks = 0,
+      opt_jit = 0,
+      opt_cosim = 0,
+      opt_sync_trace = 0,
+      opt_ffwd_warm = 0,
       opt_printmem = 0;
 
   uint32_t print_mem_startaddr = 0, print_mem_stopaddr = 0;
+  const char *expect_path = NULL;
+  const char *trace_bin_path = NULL;
+  const char *checkpoint_path = "riscv.ckpt";
+  const char *restore_path = NULL;
+  uint64_t checkpoint_at = UINT64_MAX;  // instructions (-m) or cycles (-s)
+  uint64_t ffwd = 0;                    // instructions to run before -s
+  uint64_t mem_size = GUEST_DATA_DEFAULT; // bytes the program can access
+  const char *bbv_path = NULL;
+  int simpoint_k = 0;                   // clusters for sampled simulation
+  uint64_t interval = 10000;            // instructions per BBV interval
+  uint64_t warmup = 2000;               // detailed warm-up per sample
+  int jobs = 0;                         // worker processes for intervals
+  reuse_opts_t reuse_opts = {           // --reuse analysis, off without a path
+    .window = 10000,
+  };
+  heatmap_opts_t heat_opts = {          // --heatmap, off without a path
+    .interval = 10000,
+  };
 
 
   /* the architectural state of the CPU */
@@ -103,7 +470,7 @@ int main(int argc, char **argv) {
 
   /* parse the command-line args */
   int c;
-  while ((c = getopt(argc, argv, "dvritesmpcf")) != -1) {
+  while ((c = getopt_long(argc, argv, "dvritesmpcfbj", long_options, NULL)) != -1) {
     switch (c) {
     case 'd':
       opt_disasm = 1; break;
@@ -125,6 +492,85 @@ int main(int argc, char **argv) {
       opt_cache = 1; break;
     case 'f':
       opt_forwarding = 1; break;
+    case 'b':
+      opt_blocks = 1; break;
+    case 'j':
+      opt_blocks = 1;
+      opt_jit = 1; break;
+    case OPT_COSIM:
+      opt_cosim = 1; break;
+    case OPT_EXPECT:
+      expect_path = optarg; break;
+    case OPT_TRACE_BIN:
+      trace_bin_path = optarg; break;
+    case OPT_SYNC_TRACE:
+      opt_sync_trace = 1; break;
+    case OPT_TRACE:
+      set_flags("trace", trace_flags, optarg); break;
+    case OPT_STATS:
+      set_flags("stats", stats_flags, optarg); break;
+    case OPT_MEM_LATENCY:
+      sim_config.mem_latency = atoi(optarg); break;
+    case OPT_MILESTONE:
+      set_milestone(optarg); break;
+    case OPT_CHECKPOINT:
+      checkpoint_path = optarg; break;
+    case OPT_CHECKPOINT_AT:
+      checkpoint_at = strtoull(optarg, NULL, 0); break;
+    case OPT_RESTORE:
+      restore_path = optarg; break;
+    case OPT_FFWD:
+      ffwd = strtoull(optarg, NULL, 0); break;
+    case OPT_FFWD_WARM:
+      opt_ffwd_warm = 1; break;
+    case OPT_BBV:
+      bbv_path = optarg; break;
+    case OPT_INTERVAL:
+      interval = strtoull(optarg, NULL, 0); break;
+    case OPT_SIMPOINT:
+      simpoint_k = atoi(optarg); break;
+    case OPT_WARMUP:
+      warmup = strtoull(optarg, NULL, 0); break;
+    case OPT_PARALLEL:
+      jobs = atoi(optarg); break;
+    case OPT_CACHE_SETS:
+      sim_config.cache_set_bits = log2_option("cache-sets", optarg); break;
+    case OPT_CACHE_WAYS:
+      sim_config.cache_ways = atoi(optarg); break;
+    case OPT_CACHE_BLOCK:
+      sim_config.cache_block_bits = log2_option("cache-block", optarg); break;
+    case OPT_CACHE_SAMPLE:
+      sim_config.cache_sample_bits = log2_option("cache-sample", optarg); break;
+    case OPT_CACHE_INDEX:
+      sim_config.cache_index = parse_cache_index(optarg); break;
+    case OPT_LINE_BUFFER:
+      sim_config.line_buffer = atoi(optarg); break;
+    case OPT_LINE_BUFFER_LATENCY:
+      sim_config.line_buffer_latency = atoi(optarg); break;
+    case OPT_STORE_BUFFER:
+      sim_config.store_buffer = atoi(optarg); break;
+    case OPT_MUL_LATENCY:
+      sim_config.mul_latency = atoi(optarg); break;
+    case OPT_MUL_INTERVAL:
+      sim_config.mul_interval = atoi(optarg); break;
+    case OPT_DIV_LATENCY:
+      sim_config.div_latency = atoi(optarg); break;
+    case OPT_REGFILE_WRITE_FIRST:
+      sim_config.regfile_write_first = true; break;
+    case OPT_REUSE:
+      reuse_opts.path = optarg; break;
+    case OPT_REUSE_BLOCKS:
+      parse_reuse_blocks(&reuse_opts, optarg); break;
+    case OPT_REUSE_WINDOW:
+      reuse_opts.window = strtoull(optarg, NULL, 0); break;
+    case OPT_REUSE_FETCH:
+      reuse_opts.fetch = true; break;
+    case OPT_HEATMAP:
+      heat_opts.path = optarg; break;
+    case OPT_HEATMAP_INTERVAL:
+      heat_opts.interval = strtoull(optarg, NULL, 0); break;
+    case OPT_MEM_SIZE:
+      mem_size = strtoull(optarg, NULL, 0); break;
     case 'p':
       opt_printmem = 1;
       if (optind < argc - 1) { // Ensure there are two more arguments
@@ -142,22 +588,137 @@ int main(int argc, char **argv) {
   }
 
   /* make sure we got an executable filename on the command line */
-  if (argc <= optind) {
+  if (argc <= optind && !restore_path) {
     fprintf(stderr, "Give me an executable file to run!\n");
     return -1;
   }
+
+  if (ffwd && (!opt_sim || opt_cosim || restore_path)) {
+    fprintf(stderr, "--ffwd needs -s and can't be combined with --cosim or --restore\n");
+    return -1;
+  }
+
+  if ((simpoint_k || jobs) && (!opt_sim || !opt_exit || opt_mulator || opt_cosim || restore_path || ffwd)) {
+    fprintf(stderr, "--simpoint and --parallel need -s -e and can't be combined with -m, --cosim, --restore or --ffwd\n");
+    return -1;
+  }
+  if (jobs && (sim_config.debug_cycle || sim_config.debug_reg_trace ||
+               sim_config.print_cache_traces || trace_bin_path || opt_interactive)) {
+    fprintf(stderr, "--parallel needs --trace=none\n");
+    return -1;
+  }
+  if (jobs < 0) {
+    fprintf(stderr, "--parallel must be at least 1\n");
+    return -1;
+  }
+  if (sim_config.cache_ways < 1 || sim_config.cache_set_bits + sim_config.cache_block_bits > 32 ||
+      sim_config.cache_sample_bits > sim_config.cache_set_bits) {
+    fprintf(stderr, "Bad cache geometry: needs a way, at most 4 GiB and no more sampled sets than sets\n");
+    return -1;
+  }
+  if (sim_config.store_buffer < 0 || sim_config.store_buffer > STORE_BUFFER_MAX) {
+    fprintf(stderr, "--store-buffer takes 0 to %d entries\n", STORE_BUFFER_MAX);
+    return -1;
+  }
+  if (sim_config.mul_latency < 1 || sim_config.div_latency < 1) {
+    fprintf(stderr, "--mul-latency and --div-latency must be at least 1\n");
+    return -1;
+  }
+  if (sim_config.mul_interval < 1 || sim_config.mul_interval > sim_config.mul_latency) {
+    /* from pipelined (1) to iterative (the latency) */
+    fprintf(stderr, "--mul-interval must be 1 to --mul-latency cycles\n");
+    return -1;
+  }
+  if (sim_config.line_buffer < 0 || sim_config.line_buffer > 64) {
+    fprintf(stderr, "--line-buffer takes 0 to 64 blocks\n");
+    return -1;
+  }
+  if (sim_config.line_buffer_latency < 1 || sim_config.line_buffer_latency > CACHE_HIT_LATENCY) {
+    fprintf(stderr, "--line-buffer-latency must be 1 to %d cycles, at most a cache hit\n", CACHE_HIT_LATENCY);
+    return -1;
+  }
+  if (sim_config.cache_sample_bits && sim_config.cache_index == CACHE_INDEX_SKEW) {
+    /* a block's ways are spread over sets, sampled or not */
+    fprintf(stderr, "--cache-sample can't be combined with --cache-index=skew\n");
+    return -1;
+  }
+  if (sim_config.cache_sample_bits && opt_sim) {
+    /* the pipeline needs the latency of every access */
+    fprintf(stderr, "--cache-sample only estimates statistics and works with -m -c, not -s\n");
+    return -1;
+  }
+  if (interval == 0) {
+    fprintf(stderr, "--interval must be at least 1\n");
+    return -1;
+  }
+  if (reuse_opts.path && (simpoint_k || jobs)) {
+    fprintf(stderr, "--reuse can't be combined with --simpoint or --parallel\n");
+    return -1;
+  }
+  if (reuse_opts.window == 0) {
+    fprintf(stderr, "--reuse-window must be at least 1\n");
+    return -1;
+  }
+  if (heat_opts.path && (!opt_cache || sim_config.cache_sample_bits || simpoint_k || jobs)) {
+    fprintf(stderr, "--heatmap needs -c with every set modeled and can't be combined with --simpoint or --parallel\n");
+    return -1;
+  }
+  if (heat_opts.interval == 0) {
+    fprintf(stderr, "--heatmap-interval must be at least 1\n");
+    return -1;
+  }
+  if (mem_size < MEMORY_SPACE || mem_size > GUEST_DATA_MAX || mem_size % GUEST_PAGE_SIZE) {
+    /* the stack starts just below 1 MiB */
+    fprintf(stderr, "--mem-size takes whole pages from 1 MiB to 2 GiB\n");
+    return -1;
+  }
+  if (reuse_opts.nblocks == 0) {
+    /* the cache's block size */
+    reuse_opts.block_bytes[reuse_opts.nblocks++] = 1U << sim_config.cache_block_bits;
+  }
+
+  /* compare stdout against a reference trace instead of printing it */
+  if (expect_path) {
+    expect_open(expect_path);
+  }
+
+  /* record the trace in binary form (expand it with trace2txt) */
+  if (trace_bin_path) {
+    trace_open_bin(trace_bin_path);
+  }
+
+  /* format and write the text trace on a separate thread (interactive
+   * prompts must appear before we block on stdin, so not for those, and the
+   * --parallel workers are forked without the writer thread) */
+  if (!trace_bin_path && !opt_interactive && !opt_sync_trace && !jobs) {
+    trace_open_async();
+  }
   
+  if (simpoint_k || jobs) {
+    /* intervals are simulated from checkpoints, there's no one 3C breakdown */
+    sim_config.print_miss_classes = false;
+  }
   Cache cache;
   cacheSetUp(&cache, "L1");
   /* load the executable into memory */
   assert(memory == NULL);
-  memory = calloc(MEMORY_SPACE, sizeof(uint8_t)); // allocate zeroed memory
+  memory = mem_init(); // zeroed, backed on first touch
   assert(memory != NULL);
+  /* the program gets the first --mem-size bytes for the data around gp, its
+   * heap and arrays and the stack below sp; load_code() then makes its code
+   * pages read-only. Everything from --mem-size up, including the top half
+   * of the address space whatever the size, stays unmapped as a guard, so a
+   * wild access faults. Page 0 can't be a null guard, the test programs keep
+   * data at small addresses off x0. */
+  if (!restore_path) {
+    mem_protect(0, mem_size, MEM_PERM_RW);
+  }
   int prog_numins = 0;
   /* set the PC to 0x1000 */
   regfile.PC = 0x1000;
-  prog_numins = load_program(memory, MEMORY_SPACE, regfile.PC, argv[optind],
-                             opt_disasm);
+  if (!restore_path) {
+    prog_numins = load_code(memory, regfile.PC, argv[optind], opt_disasm);
+  }
   /* if we're just disassembling, exit here */
   if (opt_disasm) {
     return 0;
@@ -181,6 +742,11 @@ int main(int argc, char **argv) {
   /* Set the stack pointer near the top of the memory array */
   regfile.R[2] = 0xEFFFF;
 
+  /* the --heatmap regions */
+  heat_opts.code_start = regfile.PC;
+  heat_opts.gp = regfile.R[3];
+  heat_opts.sp = regfile.R[2];
+
   int simins = 0;
 
   pipeline_regs_t pipeline_regs = {0};
@@ -190,68 +756,192 @@ int main(int argc, char **argv) {
 
   bootstrap(&pipeline_wires, &pipeline_regs, &regfile);
 
+  /* everything a checkpoint is taken from or restored into */
+  ckpt_state_t ckpt = {
+    .mode = opt_mulator ? CKPT_EMULATOR : CKPT_PIPELINE,
+    .progress = 0,
+    .prog_numins = prog_numins,
+    .regfile_p = &regfile,
+    .pregs_p = &pipeline_regs,
+    .pwires_p = &pipeline_wires,
+    .cache_p = &cache,
+    .memory_p = memory,
+  };
+  if (restore_path) {
+    if (opt_cosim) {
+      fprintf(stderr, "--cosim can't start from a checkpoint\n");
+      return -1;
+    }
+    ckpt_restore(restore_path, &ckpt);
+    prog_numins = ckpt.prog_numins;
+  }
+  heat_opts.code_end = heat_opts.code_start + 4 * prog_numins;
+
+  /* a guest fault lands back here and is reported like any other output */
+  if (sigsetjmp(mem_fault_env, 1) != 0) {
+    mem_fault_report();
+  }
+  mem_fault_armed = 1;
+
   // EMULATOR
   if(opt_mulator)
   {
-    if (opt_exit) {
-      /* simulate forever! */
-      while (1) {
-        execute_emu(&regfile, opt_interactive, opt_regdump);
+    emu_retired_counter = ckpt.progress;  // nonzero after --restore
+    /* simulate forever (-e) or for program instructions */
+    uint64_t limit = opt_exit ? UINT64_MAX : (uint64_t)prog_numins;
+    if (bbv_path) {
+      bbv_open(interval, bbv_path);
+    }
+    if (reuse_opts.path) {
+      reuse_open(&reuse_opts);
+    }
+    if (heat_opts.path) {
+      heatmap_open(&heat_opts, &cache);
+    }
+    if (opt_blocks && !opt_interactive && !opt_regdump && !bbv_path && !opt_cache && !reuse_opts.path) {
+      /* translated basic blocks, no per-instruction tracing */
+      bool halted = false;
+      bb_set_jit(opt_jit);
+      if (checkpoint_at >= ckpt.progress && checkpoint_at < limit) {
+        ckpt.progress += bb_run(&regfile, memory, checkpoint_at - ckpt.progress, &halted);
+        if (!halted) {
+          ckpt_save(checkpoint_path, &ckpt);
+        }
+      }
+      if (!halted) {
+        ckpt.progress += bb_run(&regfile, memory, limit - ckpt.progress, &halted);
+      }
+      if (halted) {
+        /* let the interpreter perform the exit ecall */
+        execute_emu(&regfile, 0, 0);
       }
     } else {
-      /* Either simulate for program instructions */
-      while (simins < prog_numins) {
+      while (ckpt.progress < limit) {
+        if (ckpt.progress == checkpoint_at) {
+          ckpt_save(checkpoint_path, &ckpt);
+        }
+        if (bbv_path) {
+          bbv_record(regfile.PC, load(memory, regfile.PC, LENGTH_WORD));
+        }
+        if (opt_cache) {
+          /* functional cache model, report before the exit ecall ends us */
+          if (load(memory, regfile.PC, LENGTH_WORD) == 0x00000073 && regfile.R[10] == 10) {
+            print_cache_model(&cache);
+          }
+          cache_access_emu(&regfile, &cache);
+        }
+        if (reuse_active) {
+          Address address;
+          if (reuse_fetch_active) {
+            reuse_access(regfile.PC);
+          }
+          if (data_address_emu(&regfile, &address)) {
+            reuse_access(address);
+          }
+        }
         execute_emu(&regfile, opt_interactive, opt_regdump);
-        simins++;
+        ckpt.progress++;
+      }
+      if (opt_cache) {
+        print_cache_model(&cache);
       }
     }
   }
 
+  if(opt_cache) sim_config.cache_en = true;
+  if(opt_forwarding) sim_config.fwd_en = true;
+
+  // SAMPLED CYCLE ACCURATE SIMULATION
+  if(opt_sim && simpoint_k)
+  {
+    simpoint_opts_t opts = {
+      .interval = interval,
+      .warmup = warmup,
+      .max_k = simpoint_k,
+      .ckpt_prefix = checkpoint_path,
+      .bbv_path = bbv_path,
+      .blocks = opt_blocks,
+      .jit = opt_jit,
+      .jobs = jobs,
+    };
+    simpoint_run(&opts, &ckpt, pipeline_variant());
+  }
+
+  // CYCLE ACCURATE SIMULATION OF ALL INTERVALS IN PARALLEL
+  else if(opt_sim && jobs)
+  {
+    simpoint_opts_t opts = {
+      .interval = interval,
+      .warmup = warmup,
+      .ckpt_prefix = checkpoint_path,
+      .blocks = opt_blocks,
+      .jit = opt_jit,
+      .jobs = jobs,
+    };
+    interval_run(&opts, &ckpt, pipeline_variant());
+    print_pipeline_stats(&cache);
+  }
+
   // CYCLE ACCURATE SIMULATOR
-  if(opt_sim)
+  else if(opt_sim)
   {
-    if(opt_cache) sim_config.cache_en = true;
-    if(opt_forwarding) sim_config.fwd_en = true;
+    if(ffwd) {
+      /* skip the start of the program, then fetch from where it got to */
+      uint64_t done = fast_forward(&regfile, &cache, ffwd, opt_blocks, opt_jit, opt_ffwd_warm);
+      bootstrap(&pipeline_wires, &pipeline_regs, &regfile);
+      printf("\n========\n[MAIN]: Fast-forwarded %lu instructions\n========\n", (unsigned long)done);
+    }
+    Byte* cosim_memory = NULL;
+    if(opt_cosim) {
+      /* the reference model starts from the same program image. It never
+       * runs the wrong path, so neither may the pipeline */
+      sim_config.cosim_en = true;
+      sim_config.flush_branches = true;
+      cosim_memory = cosim_init(&regfile);
+      load_program(cosim_memory, GUEST_SPACE_SIZE, regfile.PC, argv[optind], 0);
+    }
+    /* the pipeline compiled for exactly this configuration */
+    pipeline_fn_t cycle = pipeline_variant();
+    if (reuse_opts.path) {
+      reuse_open(&reuse_opts);
+    }
+    if (heat_opts.path) {
+      heatmap_open(&heat_opts, &cache);
+    }
     bool ecall_exit = false;
-    if (opt_exit) {
-      /* simulate forever! */
-      while (1) {
-        cycle_pipeline(&regfile, memory, &cache, &pipeline_regs, &pipeline_wires, &ecall_exit);
-        if(ecall_exit) break;
-      }
-    } else {
-      /* Either simulate for program instructions */
-      while (simins < prog_numins) {
-        cycle_pipeline(&regfile, memory, &cache, &pipeline_regs, &pipeline_wires, &ecall_exit);
-        simins++;
+    bool checkpoint_pending = (checkpoint_at != UINT64_MAX);
+    /* simulate until the exit ecall (-e) or for program instructions */
+    uint64_t limit = opt_exit ? UINT64_MAX : (uint64_t)prog_numins;
+    ckpt.mode = CKPT_PIPELINE;
+    while (ckpt.progress < limit) {
+      if (checkpoint_pending && total_cycle_counter >= checkpoint_at) {
+        ckpt_save(checkpoint_path, &ckpt);
+        checkpoint_pending = false;
       }
+      cycle(&regfile, memory, &cache, &pipeline_regs, &pipeline_wires, &ecall_exit);
+      ckpt.progress++;
+      if (opt_exit && ecall_exit) break;
     }
+    /* the flush isn't part of the program */
+    reuse_close();
+    heatmap_close();
     printf("\n========\n[MAIN]: Flushing pipeline\n========\n");
     simins = 0;
-    prog_numins = load_program(memory, MEMORY_SPACE, pipeline_wires.pc_src0, "./code/input/FLUSH.input",
-                            opt_disasm);
+    /* the flush may share a page with the program's code */
+    mem_protect(pipeline_wires.pc_src0, GUEST_PAGE_SIZE, MEM_PERM_RW);
+    prog_numins = load_code(memory, pipeline_wires.pc_src0, "./code/input/FLUSH.input", opt_disasm);
+    if(opt_cosim) {
+      load_program(cosim_memory, GUEST_SPACE_SIZE, pipeline_wires.pc_src0, "./code/input/FLUSH.input", 0);
+    }
     while (simins < prog_numins) {
-      cycle_pipeline(&regfile, memory, &cache, &pipeline_regs, &pipeline_wires, &ecall_exit);
+      cycle(&regfile, memory, &cache, &pipeline_regs, &pipeline_wires, &ecall_exit);
       simins++;
     }
+    if(opt_cosim) {
+      printf("[COSIM]: %lu instructions retired in lockstep\n", (unsigned long)cosim_retired());
+    }
 
-    #ifdef PRINT_STATS
-    printf("#Cycles            = %5ld\n", total_cycle_counter);
-    printf("#Forwards (EX-EX)  = %5ld\n", fwd_exex_counter);
-    printf("#Forwards (EX-MEM) = %5ld\n", fwd_exmem_counter);
-    printf("#Branches taken    = %5ld\n", branch_counter);
-    printf("#Stalls            = %5ld\n", stall_counter);
-    #endif
-    #ifdef PRINT_CACHE_STATS
-      #if defined(CACHE_ENABLE)
-      printf("#MEM   stalls      = %5ld\n", ((miss_count*MEM_LATENCY) + ((hit_count+miss_count) * (CACHE_HIT_LATENCY-1))));
-      #else
-      printf("#MEM   stalls      = %5ld\n", (mem_access_counter*(MEM_LATENCY-1)));
-      #endif
-      printf("#Cache accesses    = %5ld\n", hit_count+miss_count);
-      printf("#Cache hits        = %5ld\n", hit_count);
-      printf("#Cache misses      = %5ld\n", miss_count);
-    #endif
+    print_pipeline_stats(&cache);
 
   }
 
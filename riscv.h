@@ -12,11 +12,48 @@ void execute_instruction(uint32_t instruction_bits, regfile_t* regfile, Byte *me
 void store(Byte *memory, Address address, Alignment alignment, Word value);
 Word load(Byte *memory, Address address, Alignment alignment);
 
-// Settings for cycle accurate simulator
+/* see riscv.c, runs one instruction on the emulator's memory */
+void execute_emu(regfile_t *regfile, int prompt, int print);
+
+/* see riscv.c, instructions the emulator has executed (execute_emu() and
+ * bb_run()), its cycle and instret counters */
+extern uint64_t emu_retired_counter;
+
+// Settings for cycle accurate simulator, defaults from config.h
 typedef struct
 {
     bool cache_en;
     bool fwd_en;
+    bool cosim_en;   // check every retirement against the emulator (cosim.c)
+    bool flush_branches;  // squash the wrong path after a taken branch (FLUSH_BRANCHES)
+    bool regfile_write_first;  // writeback writes the register file before decode reads it
+
+    // tracing and statistics, named after their config.h macros
+    bool debug_cycle;
+    bool debug_reg_trace;
+    bool print_stats;
+    bool print_cache_traces;
+    bool print_cache_stats;
+    bool print_mem_stats;
+    bool print_miss_classes;  // 3C breakdown of the cache misses
+    int mem_latency;       // cycles per memory access (MEM_LATENCY)
+
+    // cache geometry (cache.h defaults), log2 of sets/block bytes
+    int cache_set_bits;
+    int cache_ways;
+    int cache_block_bits;
+    int cache_sample_bits;  // model 1 in 2^cache_sample_bits sets (-m -c only)
+    int cache_index;        // set index function, enum cache_index_enum
+    int line_buffer;        // blocks in the line buffer in front of the cache, 0 for none
+    int line_buffer_latency;
+    int store_buffer;       // store buffer entries, 0 for none (STORE_BUFFER_MAX at most)
+
+    // multiply and divide units, latency and initiation interval in cycles
+    int mul_latency;
+    int mul_interval;       // 1 for a pipelined multiplier, mul_latency for an iterative one
+    int div_latency;        // iterative, one divide at a time
 }simulator_config_t;
 
+extern simulator_config_t sim_config;
+
 #endif
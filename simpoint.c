@@ -0,0 +1,803 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "types.h"
+#include "riscv.h"
+#include "cache.h"
+#include "memory.h"
+#include "blockcache.h"
+#include "simpoint.h"
+#include "utils.h"
+
+// one interval of the profile, projected
+typedef struct
+{
+  uint64_t insns;
+  double   proj[SP_DIMS];
+}sp_interval_t;
+
+// statistics counters measured per interval (pipeline.c)
+enum sp_counter_enum
+{
+  SP_CYCLES,
+  SP_MEM_ACCESSES,
+  SP_MISSES,
+  SP_HITS,
+  SP_STALLS,
+  SP_BRANCHES,
+  SP_FWD_EXEX,
+  SP_FWD_EXMEM,
+  SP_RETIRED,
+  SP_SB_STORES,
+  SP_SB_OCCUPANCY,
+  SP_SB_FULL_STALLS,
+  SP_SB_FORWARDS,
+  SP_SB_CONFLICT_STALLS,
+  SP_UNIT_STALLS,
+  SP_UNIT_BUSY,
+  SP_COUNTERS
+};
+
+static uint64_t* const sp_counters[SP_COUNTERS] = {
+  [SP_CYCLES]             = &total_cycle_counter,
+  [SP_MEM_ACCESSES]       = &mem_access_counter,
+  [SP_MISSES]             = &miss_count,
+  [SP_HITS]               = &hit_count,
+  [SP_STALLS]             = &stall_counter,
+  [SP_BRANCHES]           = &branch_counter,
+  [SP_FWD_EXEX]           = &fwd_exex_counter,
+  [SP_FWD_EXMEM]          = &fwd_exmem_counter,
+  [SP_RETIRED]            = &retired_counter,
+  [SP_SB_STORES]          = &sb_store_counter,
+  [SP_SB_OCCUPANCY]       = &sb_occupancy_counter,
+  [SP_SB_FULL_STALLS]     = &sb_full_stall_counter,
+  [SP_SB_FORWARDS]        = &sb_forward_counter,
+  [SP_SB_CONFLICT_STALLS] = &sb_conflict_stall_counter,
+  [SP_UNIT_STALLS]        = &unit_stall_counter,
+  [SP_UNIT_BUSY]          = &unit_busy_counter,
+};
+
+// named in allocation failures
+static const char sp_what[] = "the sampled simulation";
+
+// an interval chosen for detailed simulation
+typedef struct
+{
+  uint64_t index;    // interval number
+  int      cluster;
+  uint64_t insns;
+  uint64_t counters[SP_COUNTERS];  // over the interval, without the warm-up
+}sp_sample_t;
+
+// BBV collection state
+static struct
+{
+  uint64_t       interval;   // 0 until bbv_open()
+  FILE*          out;
+
+  // block leader PC -> block id, open addressing, key 0 is empty
+  Address*       keys;
+  uint32_t*      ids;
+  uint32_t       slots;
+  uint32_t       blocks;
+
+  // instructions per block in the current interval, and which are non-zero
+  uint64_t*      counts;
+  uint32_t*      touched;
+  uint32_t       ntouched;
+  uint32_t       capacity;   // of counts and touched
+
+  Address        leader;     // first PC of the current block
+  uint64_t       len;        // its instructions not yet counted
+  bool           in_block;
+  uint64_t       insns;      // instructions in the current interval so far
+
+  sp_interval_t* intervals;
+  size_t         nintervals;
+  size_t         max_intervals;
+}bbv;
+
+// splitmix64, the source of every random number here
+static uint64_t sp_mix(uint64_t x)
+{
+  x += 0x9E3779B97F4A7C15ULL;
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+  return x ^ (x >> 31);
+}
+
+// uniform in [0, 1)
+static double sp_uniform(uint64_t x)
+{
+  return (double)(sp_mix(x) >> 11) / (double)(1ULL << 53);
+}
+
+// the projection matrix, one fixed value in [-1, 1) per block and dimension
+static double sp_projection(uint32_t id, int dim)
+{
+  return 2.0 * sp_uniform(((uint64_t)id * SP_DIMS + dim) ^ 0x5350ULL) - 1.0;
+}
+
+static uint32_t bbv_hash(Address pc)
+{
+  return (uint32_t)(sp_mix(pc) & (bbv.slots - 1));
+}
+
+static void bbv_grow_table(void)
+{
+  Address* keys = bbv.keys;
+  uint32_t* ids = bbv.ids;
+  uint32_t slots = bbv.slots;
+
+  bbv.slots = slots ? slots * 2 : 1024;
+  bbv.keys = checked_realloc(NULL, bbv.slots * sizeof(Address), sp_what);
+  bbv.ids = checked_realloc(NULL, bbv.slots * sizeof(uint32_t), sp_what);
+  memset(bbv.keys, 0, bbv.slots * sizeof(Address));
+  for (uint32_t i = 0; i < slots; i++) {
+    if (keys[i] != 0) {
+      uint32_t h = bbv_hash(keys[i] - 1);
+      while (bbv.keys[h] != 0) h = (h + 1) & (bbv.slots - 1);
+      bbv.keys[h] = keys[i];
+      bbv.ids[h] = ids[i];
+    }
+  }
+  free(keys);
+  free(ids);
+}
+
+static uint32_t bbv_block_id(Address pc)
+{
+  if (2 * (bbv.blocks + 1) > bbv.slots) {
+    bbv_grow_table();
+  }
+  uint32_t h = bbv_hash(pc);
+  while (bbv.keys[h] != 0) {
+    if (bbv.keys[h] == pc + 1) {
+      return bbv.ids[h];
+    }
+    h = (h + 1) & (bbv.slots - 1);
+  }
+
+  bbv.keys[h] = pc + 1;
+  bbv.ids[h] = bbv.blocks;
+  if (bbv.blocks == bbv.capacity) {
+    bbv.capacity = bbv.capacity ? bbv.capacity * 2 : 1024;
+    bbv.counts = checked_realloc(bbv.counts, bbv.capacity * sizeof(uint64_t), sp_what);
+    bbv.touched = checked_realloc(bbv.touched, bbv.capacity * sizeof(uint32_t), sp_what);
+  }
+  bbv.counts[bbv.blocks] = 0;
+  return bbv.blocks++;
+}
+
+// counts the instructions of the current block, which may continue
+static void bbv_count_block(void)
+{
+  if (bbv.len == 0) {
+    return;
+  }
+  uint32_t id = bbv_block_id(bbv.leader);
+  if (bbv.counts[id] == 0) {
+    bbv.touched[bbv.ntouched++] = id;
+  }
+  bbv.counts[id] += bbv.len;
+  bbv.len = 0;
+}
+
+static void bbv_end_interval(void)
+{
+  bbv_count_block();
+  if (bbv.insns == 0) {
+    return;
+  }
+
+  if (bbv.nintervals == bbv.max_intervals) {
+    bbv.max_intervals = bbv.max_intervals ? bbv.max_intervals * 2 : 256;
+    bbv.intervals = checked_realloc(bbv.intervals, bbv.max_intervals * sizeof(sp_interval_t), sp_what);
+  }
+  sp_interval_t* iv = &bbv.intervals[bbv.nintervals++];
+  memset(iv, 0, sizeof(*iv));
+  iv->insns = bbv.insns;
+
+  if (bbv.out != NULL) {
+    fputc('T', bbv.out);
+  }
+  for (uint32_t i = 0; i < bbv.ntouched; i++) {
+    uint32_t id = bbv.touched[i];
+    double share = (double)bbv.counts[id] / (double)bbv.insns;
+    for (int d = 0; d < SP_DIMS; d++) {
+      iv->proj[d] += share * sp_projection(id, d);
+    }
+    if (bbv.out != NULL) {
+      fprintf(bbv.out, ":%u:%lu ", id + 1, (unsigned long)bbv.counts[id]);
+    }
+    bbv.counts[id] = 0;
+  }
+  if (bbv.out != NULL) {
+    fputc('\n', bbv.out);
+  }
+  bbv.ntouched = 0;
+  bbv.insns = 0;
+}
+
+void bbv_open(uint64_t interval, const char* path)
+{
+  bbv.interval = interval;
+  bbv.nintervals = 0;
+  bbv.ntouched = 0;
+  bbv.len = 0;
+  bbv.in_block = false;
+  bbv.insns = 0;
+  bbv.out = NULL;
+  if (path != NULL) {
+    bbv.out = fopen(path, "w");
+    if (bbv.out == NULL) {
+      printf("Error: unable to create %s\n", path);
+      exit(-1);
+    }
+  }
+  close_at_exit(bbv_close);
+}
+
+void bbv_record(Address pc, Word bits)
+{
+  if (!bbv.in_block) {
+    bbv.leader = pc;
+    bbv.in_block = true;
+  }
+  bbv.len++;
+  bbv.insns++;
+
+  switch (bits & 0x7F) {
+    case 0x63:  // branches
+    case 0x6F:  // jal
+    case 0x67:  // jalr
+    case 0x73:  // ecall
+      bbv_count_block();
+      bbv.in_block = false;
+      break;
+  }
+  if (bbv.insns == bbv.interval) {
+    bbv_end_interval();
+  }
+}
+
+void bbv_close(void)
+{
+  if (bbv.interval == 0) {
+    return;
+  }
+  bbv_end_interval();
+  if (bbv.out != NULL) {
+    fclose(bbv.out);
+    bbv.out = NULL;
+  }
+  bbv.interval = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Clustering
+///////////////////////////////////////////////////////////////////////////////
+
+static double sp_distance(const double* a, const double* b)
+{
+  double sum = 0;
+  for (int d = 0; d < SP_DIMS; d++) {
+    sum += (a[d] - b[d]) * (a[d] - b[d]);
+  }
+  return sum;
+}
+
+static int sp_nearest(const double* point, double (*centers)[SP_DIMS], int k, double* distance)
+{
+  int best = 0;
+  double best_distance = INFINITY;
+  for (int c = 0; c < k; c++) {
+    double dist = sp_distance(point, centers[c]);
+    if (dist < best_distance) {
+      best_distance = dist;
+      best = c;
+    }
+  }
+  if (distance != NULL) {
+    *distance = best_distance;
+  }
+  return best;
+}
+
+/**
+ * One k-means run (k-means++ seeding, then Lloyd iterations), intervals
+ * weighted by their length. Returns the number of clusters used, which is
+ * smaller than k when there are fewer distinct vectors, and sets *cost to the
+ * weighted sum of squared distances.
+ **/
+static int sp_kmeans(const sp_interval_t* iv, size_t n, int k, uint64_t seed,
+                     double (*centers)[SP_DIMS], int* assign, double* cost)
+{
+  double* dist = checked_realloc(NULL, n * sizeof(double), sp_what);
+  uint64_t draw = seed * 1000003;
+
+  memcpy(centers[0], iv[(size_t)(sp_uniform(draw++) * n)].proj, sizeof(centers[0]));
+  int used = 1;
+  while (used < k) {
+    double total = 0;
+    for (size_t i = 0; i < n; i++) {
+      sp_nearest(iv[i].proj, centers, used, &dist[i]);
+      total += dist[i] * iv[i].insns;
+    }
+    if (total <= 0) {
+      break;  // every interval already sits on a centre
+    }
+    double pick = sp_uniform(draw++) * total;
+    size_t i = 0;
+    for (; i < n - 1; i++) {
+      pick -= dist[i] * iv[i].insns;
+      if (pick < 0 && dist[i] > 0) break;
+    }
+    memcpy(centers[used++], iv[i].proj, sizeof(centers[0]));
+  }
+
+  double (*sums)[SP_DIMS] = checked_realloc(NULL, used * sizeof(*sums), sp_what);
+  double* weights = checked_realloc(NULL, used * sizeof(double), sp_what);
+  for (size_t i = 0; i < n; i++) {
+    assign[i] = -1;
+  }
+  for (int iter = 0; iter < SP_MAX_ITER; iter++) {
+    bool changed = false;
+    for (size_t i = 0; i < n; i++) {
+      int c = sp_nearest(iv[i].proj, centers, used, NULL);
+      changed |= (c != assign[i]);
+      assign[i] = c;
+    }
+    if (!changed) {
+      break;
+    }
+
+    memset(sums, 0, used * sizeof(*sums));
+    memset(weights, 0, used * sizeof(double));
+    for (size_t i = 0; i < n; i++) {
+      for (int d = 0; d < SP_DIMS; d++) {
+        sums[assign[i]][d] += iv[i].proj[d] * iv[i].insns;
+      }
+      weights[assign[i]] += iv[i].insns;
+    }
+    for (int c = 0; c < used; c++) {
+      if (weights[c] > 0) {  // an emptied cluster keeps its old centre
+        for (int d = 0; d < SP_DIMS; d++) {
+          centers[c][d] = sums[c][d] / weights[c];
+        }
+      }
+    }
+  }
+
+  *cost = 0;
+  for (size_t i = 0; i < n; i++) {
+    *cost += sp_distance(iv[i].proj, centers[assign[i]]) * iv[i].insns;
+  }
+  free(weights);
+  free(sums);
+  free(dist);
+  return used;
+}
+
+/**
+ * Clusters the profile and picks up to SP_SAMPLES intervals nearest to each
+ * centre. Fills weights[] (share of all instructions per cluster) and
+ * returns the samples in program order.
+ **/
+static size_t sp_choose(int max_k, int* k_out, double* weights, size_t* sizes, sp_sample_t* samples)
+{
+  size_t n = bbv.nintervals;
+  int k = (size_t)max_k < n ? max_k : (int)n;
+  double (*centers)[SP_DIMS] = checked_realloc(NULL, k * sizeof(*centers), sp_what);
+  double (*best_centers)[SP_DIMS] = checked_realloc(NULL, k * sizeof(*centers), sp_what);
+  int* assign = checked_realloc(NULL, n * sizeof(int), sp_what);
+  int* best_assign = checked_realloc(NULL, n * sizeof(int), sp_what);
+  double best_cost = INFINITY;
+  int best_k = 0;
+
+  for (int seed = 1; seed <= SP_SEEDS; seed++) {
+    double cost;
+    int used = sp_kmeans(bbv.intervals, n, k, seed, centers, assign, &cost);
+    if (cost < best_cost) {
+      best_cost = cost;
+      best_k = used;
+      memcpy(best_centers, centers, used * sizeof(*centers));
+      memcpy(best_assign, assign, n * sizeof(int));
+    }
+  }
+
+  uint64_t total = 0;
+  for (size_t i = 0; i < n; i++) {
+    total += bbv.intervals[i].insns;
+  }
+  for (int c = 0; c < best_k; c++) {
+    weights[c] = 0;
+    sizes[c] = 0;
+  }
+  for (size_t i = 0; i < n; i++) {
+    weights[best_assign[i]] += (double)bbv.intervals[i].insns / (double)total;
+    sizes[best_assign[i]]++;
+  }
+
+  // nearest intervals to each centre
+  size_t nsamples = 0;
+  for (int c = 0; c < best_k; c++) {
+    size_t picked[SP_SAMPLES];
+    int npicked = 0;
+    for (; npicked < SP_SAMPLES; npicked++) {
+      double best_distance = INFINITY;
+      size_t best = n;
+      for (size_t i = 0; i < n; i++) {
+        bool taken = false;
+        for (int p = 0; p < npicked; p++) taken |= (picked[p] == i);
+        double dist = sp_distance(bbv.intervals[i].proj, best_centers[c]);
+        if (best_assign[i] == c && !taken && dist < best_distance) {
+          best_distance = dist;
+          best = i;
+        }
+      }
+      if (best == n) break;
+      picked[npicked] = best;
+      samples[nsamples++] = (sp_sample_t){ best, c, bbv.intervals[best].insns, {0} };
+    }
+  }
+
+  // program order, so one functional pass can write every checkpoint
+  for (size_t i = 1; i < nsamples; i++) {
+    sp_sample_t s = samples[i];
+    size_t j = i;
+    for (; j > 0 && samples[j - 1].index > s.index; j--) samples[j] = samples[j - 1];
+    samples[j] = s;
+  }
+
+  *k_out = best_k;
+  free(best_assign);
+  free(assign);
+  free(best_centers);
+  free(centers);
+  return nsamples;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Driver
+///////////////////////////////////////////////////////////////////////////////
+
+static void sp_ckpt_path(char* path, size_t size, const char* prefix, long n)
+{
+  if (n < 0) {
+    snprintf(path, size, "%s.start", prefix);
+  } else {
+    snprintf(path, size, "%s.%ld", prefix, n);
+  }
+}
+
+// runs n instructions functionally, stops early at the exit ecall
+static uint64_t sp_advance(const simpoint_opts_t* opts, regfile_t* regfile_p, Byte* memory_p, uint64_t n)
+{
+  if (opts->blocks) {
+    bool halted = false;
+    return bb_run(regfile_p, memory_p, n, &halted);
+  }
+  for (uint64_t i = 0; i < n; i++) {
+    if (load(memory_p, regfile_p->PC, LENGTH_WORD) == 0x00000073 && regfile_p->R[10] == 10) {
+      return i;
+    }
+    execute_emu(regfile_p, 0, 0);
+  }
+  return n;
+}
+
+static void sp_reset_counters(void)
+{
+  for (size_t i = 0; i < SP_COUNTERS; i++) {
+    *sp_counters[i] = 0;
+  }
+}
+
+/**
+ * Puts the simulator into the state a detailed run starts from (empty
+ * pipeline at the current PC, cold cache, zero counters) and writes it to
+ * checkpoint n.
+ **/
+static void sp_checkpoint(const simpoint_opts_t* opts, ckpt_state_t* state, long n)
+{
+  char path[4096];
+  pipeline_regs_t pregs = {0};
+  pipeline_wires_t pwires = {0};
+  *state->pregs_p = pregs;
+  *state->pwires_p = pwires;
+  bootstrap(state->pwires_p, state->pregs_p, state->regfile_p);
+  deallocate(state->cache_p);
+  cacheSetUp(state->cache_p, state->cache_p->name);
+  sp_reset_counters();
+  state->mode = CKPT_PIPELINE;
+  state->progress = 0;
+  sp_ckpt_path(path, sizeof(path), opts->ckpt_prefix, n);
+  ckpt_save(path, state);
+}
+
+/**
+ * Detailed simulation of one sample from its checkpoint. The counters of the
+ * warm-up are not part of the sample.
+ **/
+static void sp_simulate(const simpoint_opts_t* opts, ckpt_state_t* state, pipeline_fn_t cycle,
+                        sp_sample_t* sample, long n)
+{
+  char path[4096];
+  sp_ckpt_path(path, sizeof(path), opts->ckpt_prefix, n);
+  mem_reset();
+  state->mode = CKPT_PIPELINE;
+  ckpt_restore(path, state);
+  unlink(path);
+
+  uint64_t start = sample->index * opts->interval;
+  uint64_t warm = start < opts->warmup ? start : opts->warmup;
+  uint64_t begin[SP_COUNTERS] = {0};
+  bool measuring = (warm == 0);
+  bool ecall_exit = false;
+  while (retired_counter < warm + sample->insns && !ecall_exit) {
+    cycle(state->regfile_p, state->memory_p, state->cache_p, state->pregs_p, state->pwires_p, &ecall_exit);
+    if (!measuring && retired_counter >= warm) {
+      for (size_t i = 0; i < SP_COUNTERS; i++) {
+        begin[i] = *sp_counters[i];
+      }
+      measuring = true;
+    }
+  }
+  for (size_t i = 0; i < SP_COUNTERS; i++) {
+    sample->counters[i] = measuring ? *sp_counters[i] - begin[i] : 0;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Worker processes
+///////////////////////////////////////////////////////////////////////////////
+
+// a detailed simulation running in its own process
+typedef struct
+{
+  pid_t  pid;
+  int    fd;      // its result comes back on this pipe
+  size_t sample;
+}sp_worker_t;
+
+typedef struct
+{
+  const simpoint_opts_t* opts;
+  ckpt_state_t*          state;
+  pipeline_fn_t          cycle;
+  sp_sample_t*           samples;  // the caller updates this if it moves
+  sp_worker_t*           workers;
+  int                    busy;
+}sp_pool_t;
+
+static void sp_pool_init(sp_pool_t* pool, const simpoint_opts_t* opts, ckpt_state_t* state, pipeline_fn_t cycle)
+{
+  pool->opts = opts;
+  pool->state = state;
+  pool->cycle = cycle;
+  pool->samples = NULL;
+  pool->workers = checked_realloc(NULL, opts->jobs * sizeof(sp_worker_t), sp_what);
+  pool->busy = 0;
+}
+
+// waits for any worker and collects its sample
+static void sp_pool_reap(sp_pool_t* pool)
+{
+  int status;
+  pid_t pid = waitpid(-1, &status, 0);
+  int w = 0;
+  while (w < pool->busy && pool->workers[w].pid != pid) w++;
+  if (pid < 0 || w == pool->busy) {
+    printf("Error: lost track of an interval worker\n");
+    exit(-1);
+  }
+
+  sp_worker_t worker = pool->workers[w];
+  sp_sample_t* sample = &pool->samples[worker.sample];
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 ||
+      read(worker.fd, sample->counters, sizeof(sample->counters)) != sizeof(sample->counters)) {
+    printf("Error: detailed simulation of interval %lu failed\n", (unsigned long)sample->index);
+    exit(-1);
+  }
+  close(worker.fd);
+  pool->workers[w] = pool->workers[--pool->busy];
+}
+
+/**
+ * Simulates sample s from checkpoint s in a new process, once one of the
+ * opts->jobs workers is free. The checkpoint must already be written.
+ **/
+static void sp_pool_start(sp_pool_t* pool, size_t s)
+{
+  if (pool->busy == pool->opts->jobs) {
+    sp_pool_reap(pool);
+  }
+
+  int fds[2];
+  if (pipe(fds) != 0) {
+    printf("Error: unable to create a pipe for an interval worker\n");
+    exit(-1);
+  }
+  fflush(stdout);  // or the worker would repeat it if it fails
+  pid_t pid = fork();
+  if (pid < 0) {
+    printf("Error: unable to start an interval worker\n");
+    exit(-1);
+  }
+  if (pid == 0) {
+    close(fds[0]);
+    mem_fault_armed = 0;  // a fault must not run the parent's atexit handlers
+    sp_sample_t* sample = &pool->samples[s];
+    sp_simulate(pool->opts, pool->state, pool->cycle, sample, (long)s);
+    ssize_t n = write(fds[1], sample->counters, sizeof(sample->counters));
+    _exit(n == sizeof(sample->counters) ? 0 : 1);
+  }
+  close(fds[1]);
+  pool->workers[pool->busy++] = (sp_worker_t){ pid, fds[0], s };
+}
+
+static void sp_pool_finish(sp_pool_t* pool)
+{
+  while (pool->busy > 0) {
+    sp_pool_reap(pool);
+  }
+  free(pool->workers);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Sampled and interval simulation
+///////////////////////////////////////////////////////////////////////////////
+
+void simpoint_run(const simpoint_opts_t* opts, ckpt_state_t* state, pipeline_fn_t cycle)
+{
+  char path[4096];
+  regfile_t* regfile_p = state->regfile_p;
+
+  // profile: one functional pass collecting the BBVs
+  sp_ckpt_path(path, sizeof(path), opts->ckpt_prefix, -1);
+  state->mode = CKPT_EMULATOR;
+  state->progress = 0;
+  ckpt_save(path, state);
+  bbv_open(opts->interval, opts->bbv_path);
+  uint64_t total = 0;
+  while (true) {
+    Word bits = load(state->memory_p, regfile_p->PC, LENGTH_WORD);
+    if (bits == 0x00000073 && regfile_p->R[10] == 10) {
+      break;
+    }
+    bbv_record(regfile_p->PC, bits);
+    execute_emu(regfile_p, 0, 0);
+    total++;
+  }
+  bbv_close();
+  if (bbv.nintervals == 0) {
+    printf("[SIMPOINT]: the program executed no instructions\n");
+    unlink(path);
+    return;
+  }
+
+  int k = 0;
+  double* weights = checked_realloc(NULL, opts->max_k * sizeof(double), sp_what);
+  size_t* sizes = checked_realloc(NULL, opts->max_k * sizeof(size_t), sp_what);
+  sp_sample_t* samples = checked_realloc(NULL, (size_t)opts->max_k * SP_SAMPLES * sizeof(sp_sample_t), sp_what);
+  size_t nsamples = sp_choose(opts->max_k, &k, weights, sizes, samples);
+
+  // second functional pass from the start, stopping to checkpoint each sample
+  mem_reset();
+  bb_flush();
+  bb_set_jit(opts->jit);
+  ckpt_restore(path, state);
+  unlink(path);
+  sp_pool_t pool;
+  if (opts->jobs > 0) {
+    sp_pool_init(&pool, opts, state, cycle);
+    pool.samples = samples;
+  }
+  uint64_t done = 0;
+  for (size_t s = 0; s < nsamples; s++) {
+    uint64_t start = samples[s].index * opts->interval;
+    uint64_t begin = start - (start < opts->warmup ? start : opts->warmup);
+    done += sp_advance(opts, regfile_p, state->memory_p, begin - done);
+    sp_checkpoint(opts, state, (long)s);
+    if (opts->jobs > 0) {
+      sp_pool_start(&pool, s);
+    }
+  }
+
+  if (opts->jobs > 0) {
+    sp_pool_finish(&pool);
+  } else {
+    for (size_t s = 0; s < nsamples; s++) {
+      sp_simulate(opts, state, cycle, &samples[s], (long)s);
+    }
+  }
+
+  // stratified estimate: per cluster the mean CPI of its samples
+  double cpi = 0;
+  double variance = 0;
+  for (int c = 0; c < k; c++) {
+    double sum = 0, sum2 = 0;
+    int count = 0;
+    for (size_t s = 0; s < nsamples; s++) {
+      if (samples[s].cluster == c) {
+        double x = (double)samples[s].counters[SP_CYCLES] / (double)samples[s].insns;
+        sum += x;
+        sum2 += x * x;
+        count++;
+      }
+    }
+    double mean = sum / count;
+    cpi += weights[c] * mean;
+    if (count > 1 && (size_t)count < sizes[c]) {
+      double s2 = (sum2 - count * mean * mean) / (count - 1);
+      double fpc = 1.0 - (double)count / (double)sizes[c];
+      variance += weights[c] * weights[c] * (s2 > 0 ? s2 : 0) * fpc / count;
+    }
+  }
+  double bound = 1.96 * sqrt(variance);
+
+  for (size_t s = 0; s < nsamples; s++) {
+    printf("[SIMPOINT]: interval %5lu  cluster %2d  weight %.4f  CPI %.4f\n",
+           (unsigned long)samples[s].index, samples[s].cluster, weights[samples[s].cluster],
+           (double)samples[s].counters[SP_CYCLES] / (double)samples[s].insns);
+  }
+  printf("[SIMPOINT]: %lu instructions, %lu intervals of %lu, %d clusters, %lu intervals simulated\n",
+         (unsigned long)total, (unsigned long)bbv.nintervals, (unsigned long)opts->interval,
+         k, (unsigned long)nsamples);
+  printf("#Estimated CPI     = %.4f +/- %.4f (95%%)\n", cpi, bound);
+  printf("#Estimated cycles  = %5lu +/- %lu\n",
+         (unsigned long)(cpi * total + 0.5), (unsigned long)(bound * total + 0.5));
+
+  free(samples);
+  free(sizes);
+  free(weights);
+}
+
+void interval_run(const simpoint_opts_t* opts, ckpt_state_t* state, pipeline_fn_t cycle)
+{
+  sp_pool_t pool;
+  sp_pool_init(&pool, opts, state, cycle);
+  bb_set_jit(opts->jit);
+
+  // run ahead functionally, handing each interval to a worker as it's reached
+  size_t nsamples = 0, max_samples = 0;
+  sp_sample_t* samples = NULL;
+  uint64_t done = 0;
+  for (uint64_t index = 0; ; index++) {
+    uint64_t start = index * opts->interval;
+    uint64_t begin = start - (start < opts->warmup ? start : opts->warmup);
+    if (sp_advance(opts, state->regfile_p, state->memory_p, begin - done) < begin - done) {
+      break;  // the program ended
+    }
+    done = begin;
+
+    if (nsamples == max_samples) {
+      max_samples = max_samples ? max_samples * 2 : 256;
+      samples = checked_realloc(samples, max_samples * sizeof(sp_sample_t), sp_what);
+      pool.samples = samples;
+    }
+    samples[nsamples] = (sp_sample_t){ index, 0, opts->interval, {0} };
+    sp_checkpoint(opts, state, (long)nsamples);
+    sp_pool_start(&pool, nsamples);
+    nsamples++;
+  }
+  sp_pool_finish(&pool);
+
+  // the whole program is the sum of its intervals
+  sp_reset_counters();
+  uint64_t measured = 0;
+  for (size_t s = 0; s < nsamples; s++) {
+    for (size_t i = 0; i < SP_COUNTERS; i++) {
+      *sp_counters[i] += samples[s].counters[i];
+    }
+    measured += (samples[s].counters[SP_RETIRED] != 0);
+  }
+  printf("[INTERVALS]: %lu intervals of %lu instructions on %d workers, %lu instructions retired\n",
+         (unsigned long)measured, (unsigned long)opts->interval, opts->jobs,
+         (unsigned long)retired_counter);
+  free(samples);
+}
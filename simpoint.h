@@ -0,0 +1,96 @@
+#ifndef __SIMPOINT_H__
+#define __SIMPOINT_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "types.h"
+#include "pipeline.h"
+#include "checkpoint.h"
+
+///////////////////////////////////////////////////////////////////////////////
+/// Sampled simulation: basic-block vectors, clustering and SimPoints
+///////////////////////////////////////////////////////////////////////////////
+
+/**
+ * The functional emulator cuts the program into intervals of a fixed number
+ * of instructions and records, for every interval, how many instructions it
+ * executed in each basic block (its basic-block vector, BBV). Blocks are
+ * named by the PC of their first instruction and end at a branch, jump or
+ * ecall. The vectors can be written in the SimPoint .bb text format, one
+ * line per interval:
+ *
+ *   T:<block>:<instructions> :<block>:<instructions> ...
+ *
+ * For clustering each vector is normalised to the interval length and
+ * reduced to SP_DIMS dimensions by a fixed random projection. k-means then
+ * groups intervals that spend their time in the same code. Intervals close
+ * to the centre of each cluster are simulated in detail, each from its own
+ * checkpoint and after a short detailed warm-up, and the cluster's share of
+ * the instructions weights their CPI into the whole-program estimate.
+ *
+ * Up to SP_SAMPLES intervals are simulated per cluster. The spread between
+ * them gives a stratified-sampling standard error, reported as a 95% bound.
+ * A cluster whose intervals were all simulated contributes no error.
+ *
+ * interval_run() instead simulates every interval, opts->jobs at a time. The
+ * emulator runs ahead and writes a checkpoint at each interval boundary (less
+ * the warm-up), and a worker process picks it up straight away. The workers
+ * are processes, not threads, because the simulator's state is global. The
+ * per-interval counters add up to the whole-program statistics. What the
+ * parallelism costs in accuracy is the pipeline and cache state each interval
+ * would have inherited; the warm-up makes up for most of it.
+ */
+
+#define SP_DIMS      15    // dimensions after the random projection
+#define SP_SAMPLES   2     // intervals simulated per cluster
+#define SP_SEEDS     5     // k-means restarts, the best clustering is kept
+#define SP_MAX_ITER  100   // k-means iterations per restart
+
+typedef struct
+{
+  uint64_t    interval;     // instructions per interval
+  uint64_t    warmup;       // detailed warm-up before each interval
+  int         max_k;        // clusters
+  const char* ckpt_prefix;  // checkpoints are <prefix>.start, <prefix>.<n>
+  const char* bbv_path;     // also write the BBVs here, may be NULL
+  bool        blocks;       // fast-forward with the block cache (-b)
+  bool        jit;
+  int         jobs;         // worker processes, 0 simulates in this one
+}simpoint_opts_t;
+
+/**
+ * Starts collecting BBVs, one per interval instructions. path may be NULL to
+ * only keep them in memory. The file is completed at exit if the program
+ * ends inside the emulator.
+ **/
+void bbv_open(uint64_t interval, const char* path);
+
+/**
+ * Accounts for one instruction, called before it executes.
+ **/
+void bbv_record(Address pc, Word bits);
+
+/**
+ * Ends the last (partial) interval and closes the file.
+ **/
+void bbv_close(void);
+
+/**
+ * Runs the program functionally to collect BBVs, picks the intervals to
+ * simulate, writes a checkpoint for each and simulates them in detail with
+ * cycle, then prints the estimated whole-program CPI and cycle count.
+ * state must hold the freshly loaded program, which runs to its exit ecall
+ * (-e): without it plain -s stops after a number of cycles, and there is no
+ * instruction count that would match.
+ **/
+void simpoint_run(const simpoint_opts_t* opts, ckpt_state_t* state, pipeline_fn_t cycle);
+
+/**
+ * Simulates the whole program as consecutive intervals on opts->jobs worker
+ * processes and leaves the summed statistics in the pipeline.c counters.
+ * Nothing may be printed by the simulation itself (no tracing). The program
+ * runs to its exit ecall, as for simpoint_run().
+ **/
+void interval_run(const simpoint_opts_t* opts, ckpt_state_t* state, pipeline_fn_t cycle);
+
+#endif  // __SIMPOINT_H__
@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include "utils.h"
 #include "pipeline.h"
+#include "trace.h"
 
 /// EXECUTE STAGE HELPERS ///
 
@@ -31,7 +32,10 @@ uint32_t gen_alu_control(idex_reg_t idex_reg)
       1000 = LUI
       1001 = SRA
       1010 = MUL
+      1011 = SLTU //branches only (bltu, bgeu)
       1100 = NOR  //not used for our simulator
+      1 0fff = the other RV32M instructions, fff is funct3:
+               MULH, MULHSU, MULHU, DIV, DIVU, REM, REMU (0x11-0x17)
    */
   
   // #ifdef DEBUG_CYCLE_CONTENTS
@@ -41,17 +45,29 @@ uint32_t gen_alu_control(idex_reg_t idex_reg)
   // #endif
 
   switch (idex_reg.alu_op1) {
-    case 0x0: // ld, sd, beq, bne, lui
+    case 0x0: // ld, sd, branches, lui, auipc, jal, jalr
       switch (idex_reg.alu_op0) {
         case 0x0: 
           if (idex_reg.alu_op2 == 1) { 
             alu_control = 0x8;  // lui
-          } else {  // ld, sd, jal
+          } else {  // ld, sd, auipc, jal, jalr
             alu_control = 0x2;  // add
           }
           break;
-        case 0x1: // beq, bne
-          alu_control = 0x6;  // sub
+        case 0x1: // branches, gen_branch() tests the result
+          switch (idex_reg.funct3) {
+            case 0x4: // blt
+            case 0x5: // bge
+              alu_control = 0x7;  // slt
+              break;
+            case 0x6: // bltu
+            case 0x7: // bgeu
+              alu_control = 0xB;  // sltu
+              break;
+            default:  // beq, bne
+              alu_control = 0x6;  // sub
+              break;
+          }
           break; 
         default: 
           break;
@@ -61,6 +77,10 @@ uint32_t gen_alu_control(idex_reg_t idex_reg)
       switch (idex_reg.alu_op0) {
         /////////////////////////// R-Type //////////////////////////////
         case 0x0: // R-type
+          if (idex_reg.funct7_25 == 0x1 && idex_reg.funct3 != 0x0) {
+            alu_control = 0x10 | idex_reg.funct3;  // mulh ... remu
+            break;
+          }
           switch (idex_reg.funct3) {
             case 0x0:
               switch (idex_reg.funct7_30) {
@@ -189,7 +209,9 @@ uint32_t execute_alu(uint32_t alu_inp1, uint32_t alu_inp2, uint32_t alu_control)
     1000 = LUI
     1001 = SRA
     1010 = MUL
+    1011 = SLTU
     1100 = NOR  //not used for our simulator (i think)
+    1 0fff = MULH ... REMU, fff is funct3
   */
 
   uint32_t result;
@@ -233,6 +255,18 @@ uint32_t execute_alu(uint32_t alu_inp1, uint32_t alu_inp2, uint32_t alu_control)
     case 0xA: //MUL
       result = (sWord)alu_inp1 * (sWord)alu_inp2;
       break;
+    case 0xB: //SLTU
+      result = (alu_inp1 < alu_inp2) ? 1 : 0;
+      break;
+    case 0x11: //MULH
+    case 0x12: //MULHSU
+    case 0x13: //MULHU
+    case 0x14: //DIV
+    case 0x15: //DIVU
+    case 0x16: //REM
+    case 0x17: //REMU
+      result = muldiv_result(alu_control & 0x7, alu_inp1, alu_inp2);
+      break;
     default:  //UNDEFINED
       result = 0xBADCAFFE;
       break;
@@ -240,6 +274,69 @@ uint32_t execute_alu(uint32_t alu_inp1, uint32_t alu_inp2, uint32_t alu_control)
   return result;
 }
 
+/**
+ * input  : Instruction
+ * output : enum exec_unit_enum, the unit the instruction executes in
+ **/
+int gen_exec_unit(Instruction instruction)
+{
+  // RV32M: funct7 0x01 of the R-type opcode, funct3 4-7 divide and remainder
+  if (instruction.opcode == 0x33 && instruction.rtype.funct7 == 0x01) {
+    return (instruction.rtype.funct3 & 0x4) ? UNIT_DIV : UNIT_MUL;
+  }
+  return UNIT_ALU;
+}
+
+/**
+ * input  : enum exec_unit_enum
+ * output : cycles from issue until a dependent can execute
+ **/
+uint64_t unit_latency(int unit)
+{
+  switch (unit) {
+    case UNIT_MUL:
+      return sim_config.mul_latency;
+    case UNIT_DIV:
+      return sim_config.div_latency;
+    default:
+      return 1;
+  }
+}
+
+/**
+ * input  : enum exec_unit_enum
+ * output : cycles from issue until the unit accepts the next operation
+ **/
+uint64_t unit_interval(int unit)
+{
+  switch (unit) {
+    case UNIT_MUL:
+      return sim_config.mul_interval;
+    case UNIT_DIV:
+      return sim_config.div_latency;  // iterative
+    default:
+      return 1;
+  }
+}
+
+/**
+ * Task   : Records in the scoreboard when the result of the instruction
+ *           issued this cycle is ready and when its unit is free again.
+ * input  : idex_reg_t, scoreboard_t*
+ * output : None
+ **/
+void scoreboard_issue(idex_reg_t idex_reg, scoreboard_t* sb)
+{
+  int unit = gen_exec_unit(idex_reg.instr);
+  if (idex_reg.reg_write && idex_reg.rd != 0) {
+    // also a single-cycle result, it supersedes an older multi-cycle one
+    sb->ready[idex_reg.rd] = total_cycle_counter + unit_latency(unit);
+  }
+  if (idex_reg.valid) {
+    sb->free[unit] = total_cycle_counter + unit_interval(unit);
+  }
+}
+
 /// DECODE STAGE HELPERS ///
 
 /**
@@ -277,11 +374,15 @@ uint32_t gen_imm(Instruction instruction)
       imm_val = get_store_offset(instruction);
       break;
     case 0x3: //Load
+    case 0x67: //JALR
       imm_val = sign_extend_number(instruction.itype.imm, 12);
       break;
     case 0x6F: //UJ-type
       imm_val = get_jump_offset(instruction);
       break;
+    case 0x17:  //AUIPC, added to the PC as it is
+      imm_val = instruction.utype.imm << 12;
+      break;
     case 0x37:  //U-type
       imm_val = sign_extend_number(instruction.utype.imm, 20);
     default: // R and undefined opcode
@@ -365,7 +466,19 @@ idex_reg_t gen_control(Instruction instruction)
         idex_reg.reg_write = 1;
         idex_reg.mem_to_reg = 0;
         break;
+      case 0x17:  //AUIPC
+        idex_reg.alu_op2 = 0;
+        idex_reg.alu_op1 = 0;
+        idex_reg.alu_op0 = 0;
+        idex_reg.alu_src = 1;
+        idex_reg.branch = 0;
+        idex_reg.mem_read = 0;
+        idex_reg.mem_write = 0;
+        idex_reg.reg_write = 1;
+        idex_reg.mem_to_reg = 0;
+        break;
       case 0x6F:  //UJ-type
+      case 0x67:  //JALR
         idex_reg.alu_op2 = 0;
         idex_reg.alu_op1 = 0;
         idex_reg.alu_op0 = 0;
@@ -376,6 +489,21 @@ idex_reg_t gen_control(Instruction instruction)
         idex_reg.reg_write = 1;
         idex_reg.mem_to_reg = 0;
         break;
+      case 0x73:  //CSR access, read like a load in the memory stage (not ecall)
+        if (instruction.itype.funct3 == 0x0) {
+          break;
+        }
+        idex_reg.alu_op2 = 0;
+        idex_reg.alu_op1 = 0;
+        idex_reg.alu_op0 = 0;
+        idex_reg.alu_src = 1;   // imm is 0, rs1 passes through the ALU
+        idex_reg.branch = 0;
+        idex_reg.mem_read = 0;
+        idex_reg.mem_write = 0;
+        idex_reg.reg_write = 1;
+        idex_reg.mem_to_reg = 1;
+        idex_reg.csr = 1;
+        break;
       default:
           break;
   }
@@ -403,19 +531,19 @@ bool gen_branch(exmem_reg_t exmem_reg)
 
   if (exmem_reg.branch == 1) {  // if the branch control signal is set
 
-    if (exmem_reg.instr.opcode == 0x6F) { //UJ-type
+    if (exmem_reg.instr.opcode == 0x6F || exmem_reg.instr.opcode == 0x67) { //jal, jalr
       branch_taken = 1;
-    } else if (exmem_reg.instr.sbtype.funct3 == 0x0) { //beq
-      if (exmem_reg.alu_result == 0) {
-        branch_taken = 1; // jumping to next address
-      } else {
-        branch_taken = 0;
-      }
-    } else { //bne for now (Looks like test cases dont use blt or bge)
-       if (exmem_reg.alu_result != 0) {
-        branch_taken = 1;
-      } else {
-        branch_taken = 0; // bne invalid, variables are equal
+    } else {
+      // the ALU did a sub for beq/bne and an slt/sltu for the others
+      switch (exmem_reg.instr.sbtype.funct3) {
+        case 0x0: //beq
+        case 0x5: //bge
+        case 0x7: //bgeu
+          branch_taken = (exmem_reg.alu_result == 0);
+          break;
+        default:  //bne, blt, bltu
+          branch_taken = (exmem_reg.alu_result != 0);
+          break;
       }
     }
   } else {
@@ -476,9 +604,9 @@ void gen_forward(pipeline_regs_t* pregs_p, pipeline_wires_t* pwires_p)
       forward_a = 0x2; // 10
       fwd_exex_counter++;
       
-      #ifdef DEBUG_CYCLE
-      printf("[FWD]: Resolving EX hazard on rs1: x%d\n", idex_rs1);
-      #endif
+      if (sim_config.debug_cycle) {
+        printf("[FWD]: Resolving EX hazard on rs1: x%d\n", idex_rs1);
+      }
     }  
 
     // ForwardB:
@@ -486,9 +614,9 @@ void gen_forward(pipeline_regs_t* pregs_p, pipeline_wires_t* pwires_p)
       forward_b = 0x2; // 10
       fwd_exex_counter++;
 
-      #ifdef DEBUG_CYCLE
-      printf("[FWD]: Resolving EX hazard on rs2: x%d\n", idex_rs2);
-      #endif
+      if (sim_config.debug_cycle) {
+        printf("[FWD]: Resolving EX hazard on rs2: x%d\n", idex_rs2);
+      }
     } 
   
   }
@@ -501,9 +629,9 @@ void gen_forward(pipeline_regs_t* pregs_p, pipeline_wires_t* pwires_p)
       forward_a = 0x1; // 01
       fwd_exmem_counter++;
 
-      #ifdef DEBUG_CYCLE
-      printf("[FWD]: Resolving MEM hazard on rs1: x%d\n", idex_rs1);
-      #endif   
+      if (sim_config.debug_cycle) {
+        printf("[FWD]: Resolving MEM hazard on rs1: x%d\n", idex_rs1);
+      }
     }
 
     // ForwardB: 
@@ -511,9 +639,9 @@ void gen_forward(pipeline_regs_t* pregs_p, pipeline_wires_t* pwires_p)
       forward_b = 0x1; // 01
       fwd_exmem_counter++;
       
-      #ifdef DEBUG_CYCLE
-      printf("[FWD]: Resolving MEM hazard on rs2: x%d\n", idex_rs2);
-      #endif
+      if (sim_config.debug_cycle) {
+        printf("[FWD]: Resolving MEM hazard on rs2: x%d\n", idex_rs2);
+      }
     }
 
   }
@@ -523,9 +651,94 @@ void gen_forward(pipeline_regs_t* pregs_p, pipeline_wires_t* pwires_p)
   pwires_p->forward_b = forward_b;
 }
 
+/**
+ * input  : Instruction, register
+ * output : bool, whether the instruction reads the register
+ **/
+bool reads_reg(Instruction instruction, uint8_t reg)
+{
+  if (reg == 0) {
+    return false;
+  }
+  switch (instruction.opcode) {
+    case 0x33:  //R-type
+    case 0x23:  //S-type
+    case 0x63:  //SB-type
+      return instruction.rtype.rs1 == reg || instruction.rtype.rs2 == reg;
+    case 0x13:  //I-type
+    case 0x3:   //Load
+    case 0x67:  //JALR
+      return instruction.itype.rs1 == reg;
+    case 0x73:  //CSR access, funct3 5-7 have an immediate in rs1
+      return !(instruction.itype.funct3 & 0x4) && instruction.itype.rs1 == reg;
+    default:
+      return false;
+  }
+}
+
+/**
+ * Task   : Checks whether the instruction in IF/ID has to wait for a
+ *           multiply or divide: for an operand still being computed or for
+ *           an iterative unit that is still busy. It would execute in the
+ *           next cycle, after the instruction in ID/EX executes in this one.
+ *           An instruction that those stalls brought closer to a writer in
+ *           MEM/WB than it is in the program waits for the write, since
+ *           decode reads the register file before writeback writes it
+ *           (unless --regfile-write-first). Without that, whether it reads
+ *           the old value would depend on the unit latencies.
+ * input  : pipeline_regs_t*, scoreboard_t*
+ * output : bool, true to stall
+ **/
+bool unit_hazard(pipeline_regs_t* pregs_p, scoreboard_t* sb)
+{
+  Instruction instr = pregs_p->ifid_preg.out.instr;
+  idex_reg_t ex = pregs_p->idex_preg.out;
+  exmem_reg_t mem = pregs_p->exmem_preg.out;
+  memwb_reg_t wb = pregs_p->memwb_preg.out;
+  uint64_t issue = total_cycle_counter + 1;
+
+  // the ID/EX instruction isn't on the scoreboard until it executes
+  uint64_t ready[2] = { 0, 0 };
+  uint8_t srcs[2] = { instr.rtype.rs1, instr.rtype.rs2 };
+  for (int i = 0; i < 2; i++) {
+    if (!reads_reg(instr, srcs[i])) {
+      continue;
+    }
+    ready[i] = sb->ready[srcs[i]];
+    if (ex.reg_write && ex.rd == srcs[i]) {
+      ready[i] = total_cycle_counter + unit_latency(gen_exec_unit(ex.instr));
+    }
+  }
+  if (ready[0] > issue || ready[1] > issue) {
+    unit_stall_counter++;
+    return sb->stalled = true;
+  }
+
+  // without the bubbles between them the writer would still forward
+  if (sb->bubbles && !sim_config.regfile_write_first && wb.reg_write && reads_reg(instr, wb.rd) &&
+      !(ex.reg_write && ex.rd == wb.rd) && !(mem.reg_write && mem.rd == wb.rd)) {
+    unit_stall_counter++;
+    return sb->stalled = true;
+  }
+
+  int unit = gen_exec_unit(instr);
+  if (unit != UNIT_ALU) {
+    uint64_t free = sb->free[unit];
+    if (ex.valid && gen_exec_unit(ex.instr) == unit) {
+      free = total_cycle_counter + unit_interval(unit);
+    }
+    if (free > issue) {
+      unit_busy_counter++;
+      return sb->stalled = true;
+    }
+  }
+  return false;
+}
+
 /**
  * Task   : Sets the pipeline wires for the hazard unit's control signals
- *           based on the pipeline register values.
+ *           based on the pipeline register values: stalls on a load-use
+ *           hazard and while unit_hazard() holds a multiply/divide back.
  * input  : pipeline_regs_t*, pipeline_wires_t*
  * output : None
 */
@@ -539,18 +752,25 @@ void detect_hazard(pipeline_regs_t* pregs_p, pipeline_wires_t* pwires_p, regfile
   uint8_t rd = pregs_p->idex_preg.out.rd;
   uint8_t rs1 = (pregs_p->ifid_preg.out.instr.rest >> 8) & ((1U << 5) - 1);
   uint8_t rs2 = (pregs_p->ifid_preg.out.instr.rest >> 13) & ((1U << 5) - 1);
-  bool mem_read = pregs_p->idex_preg.out.mem_read;
+  // a CSR read is only there after the memory stage as well (csrw writes x0)
+  bool mem_read = pregs_p->idex_preg.out.mem_read || (pregs_p->idex_preg.out.csr && rd != 0);
+
+  bool stall = mem_read && ((rd == rs1) || (rd == rs2));
 
-  if (mem_read && ((rd == rs1) || (rd == rs2))) {
+  if (!stall && unit_hazard(pregs_p, &pwires_p->scoreboard)) {
+    stall = true;
+  }
+
+  if (stall) {
   
     pwires_p->flush_control = 1;
     pwires_p->ifid_write = 1;
     pwires_p->pc_write = 1;
     stall_counter++;
 
-    #ifdef DEBUG_CYCLE
-    printf("[HZD]: Stalling and rewriting PC: 0x%08x\n", pregs_p->ifid_preg.inp.instr_addr);
-    #endif
+    if (sim_config.debug_cycle) {
+      printf("[HZD]: Stalling and rewriting PC: 0x%08x\n", pregs_p->ifid_preg.inp.instr_addr);
+    }
   } 
 }
 
@@ -587,9 +807,9 @@ void flush_pipeline(pipeline_regs_t* pregs_p)
   // keep track of # of branches taken during execution
   branch_counter++;
   
-  #ifdef DEBUG_CYCLE
-  printf("[CPL]: Pipeline Flushed\n");
-  #endif
+  if (sim_config.debug_cycle) {
+    printf("[CPL]: Pipeline Flushed\n");
+  }
 }
 
 
@@ -599,16 +819,8 @@ void flush_pipeline(pipeline_regs_t* pregs_p)
 /// RESERVED FOR PRINTING REGISTER TRACE AFTER EACH CLOCK CYCLE ///
 void print_register_trace(regfile_t* regfile_p)
 {
-  // print
-  for (uint8_t i = 0; i < 8; i++)       // 8 columns
-  {
-    for (uint8_t j = 0; j < 4; j++)     // of 4 registers each
-    {
-      printf("r%2d=%08x ", i * 4 + j, regfile_p->R[i * 4 + j]);
-    }
-    printf("\n");
-  }
-  printf("\n");
+  // printed (or recorded) by trace.c
+  trace_regs(regfile_p);
 }
 
 #endif // __STAGE_HELPERS_H__
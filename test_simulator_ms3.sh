@@ -18,19 +18,19 @@ run1() {
     echo -e "${RED_BOLD}Please make sure you are following the important note #1 in the milestone 3 description${RESET}"
        
    
-    ./riscv -s -f -c   code/ms3/input/LS/LS.input > ./code/ms3/out/LS/LS.trace 
+    ./riscv --milestone=3 -s -f -c   code/ms3/input/LS/LS.input > ./code/ms3/out/LS/LS.trace 
     echo "diff ./code/ms3/ref/LS/LS.trace ./code/ms3/out/LS/LS.trace"
     diff       ./code/ms3/ref/LS/LS.trace ./code/ms3/out/LS/LS.trace 
 
-    ./riscv -s -f -c -e  ./code/ms3/input/multiply.input > ./code/ms3/out/multiply.trace 
+    ./riscv --milestone=3 -s -f -c -e  ./code/ms3/input/multiply.input > ./code/ms3/out/multiply.trace 
     echo "diff ./code/ms3/ref/multiply.trace ./code/ms3/out/multiply.trace "
     diff       ./code/ms3/ref/multiply.trace ./code/ms3/out/multiply.trace  
 
-    ./riscv -s -f -c -e  ./code/ms3/input/random.input > ./code/ms3/out/random.trace 
+    ./riscv --milestone=3 -s -f -c -e  ./code/ms3/input/random.input > ./code/ms3/out/random.trace 
     echo "diff ./code/ms3/ref/random.trace ./code/ms3/out/random.trace"
     diff       ./code/ms3/ref/random.trace ./code/ms3/out/random.trace 
 
-     ./riscv -s -f -c -e  ./code/ms3/input/testset_1.input > ./code/ms3/out/testset_1.trace 
+     ./riscv --milestone=3 -s -f -c -e  ./code/ms3/input/testset_1.input > ./code/ms3/out/testset_1.trace 
     echo "diff ./code/ms3/ref/testset_1.trace  ./code/ms3/out/testset_1.trace"
     diff       ./code/ms3/ref/testset_1.trace  ./code/ms3/out/testset_1.trace 
     
@@ -39,26 +39,142 @@ run1() {
 # Function to run the second set of commands
 run2() {
     echo -e "${YELLOW_BOLD}Please make sure you are following the important note #2 in the milestone 3 description${RESET}"
-    echo -e "${ORANGE_ITALIC}If it takes more than 3 seconds, you probably have not followed the above message! Abort with Ctrl+C to save 1GB! ${RESET}"
+    echo -e "${ORANGE_ITALIC}The output is compared in-process (--expect) and the run stops at the first difference; nothing is written to disk. ${RESET}"
     
     
 
-    ./riscv -s -f -c -e  ./code/ms3/input/vec_xprod.input > ./code/ms3/out/vec_xprod.trace 
-    echo "diff ./code/ms3/ref/vec_xprod.trace ./code/ms3/out/vec_xprod.trace"
-    diff       ./code/ms3/ref/vec_xprod.trace ./code/ms3/out/vec_xprod.trace 
+    echo "./riscv --milestone=3 --trace=none -s -f -c -e --expect ./code/ms3/ref/vec_xprod.trace ./code/ms3/input/vec_xprod.input"
+    ./riscv --milestone=3 --trace=none -s -f -c -e --expect ./code/ms3/ref/vec_xprod.trace ./code/ms3/input/vec_xprod.input
 }
 
 
 # Function to run the third set of commands
 run3() {
     echo -e "${YELLOW_BOLD}Please make sure you are following the important note #3 in the milestone 3 description${RESET}"
-    echo -e "${ORANGE_ITALIC}If it takes more than 5 seconds, you probably have not followed the above message! Abort with Ctrl+C to save 1GB! ${RESET}"
+    echo -e "${ORANGE_ITALIC}The output is compared in-process (--expect) and the run stops at the first difference; nothing is written to disk. ${RESET}"
     
     
 
-    ./riscv -s -f -e  ./code/ms3/input/vec_xprod.input > ./code/ms3/out/vec_xprod.nocache.trace 
-    echo "diff ./code/ms3/ref/vec_xprod.nocache.trace ./code/ms3/out/vec_xprod.nocache.trace"
-    diff       ./code/ms3/ref/vec_xprod.nocache.trace ./code/ms3/out/vec_xprod.nocache.trace 
+    echo "./riscv --milestone=3 --trace=none -s -f -e --expect ./code/ms3/ref/vec_xprod.nocache.trace ./code/ms3/input/vec_xprod.input"
+    ./riscv --milestone=3 --trace=none -s -f -e --expect ./code/ms3/ref/vec_xprod.nocache.trace ./code/ms3/input/vec_xprod.input
+}
+
+
+# Function to run the guest memory fault checks
+run4() {
+    echo -e "${YELLOW_BOLD}Each program makes a disallowed access; the run must end with its Bad Read/Bad Write report, and big_array may use memory up to --mem-size${RESET}"
+
+    for t in store_code load_unmapped; do
+        for mode in "-m -e" "-m -j -e" "-s -f -e --trace=none"; do
+            ./riscv $mode ./code/ms3/input/$t.input > ./code/ms3/out/$t.trace
+            echo "diff ./code/ms3/ref/$t.trace ./code/ms3/out/$t.trace ($mode)"
+            diff       ./code/ms3/ref/$t.trace ./code/ms3/out/$t.trace
+        done
+        # the report goes through stdout, so --expect checks it too
+        echo "./riscv --expect=./code/ms3/ref/$t.trace"
+        ./riscv -s -f -e --trace=none --expect=./code/ms3/ref/$t.trace ./code/ms3/input/$t.input > /dev/null
+    done
+
+    # big_array uses memory up to the default --mem-size, and faults past a smaller one
+    for mode in "-m -e" "-m -b -e" "-m -j -e"; do
+        ./riscv $mode ./code/ms3/input/big_array.input > ./code/ms3/out/big_array.trace
+        echo "diff ./code/ms3/ref/big_array.trace ./code/ms3/out/big_array.trace ($mode)"
+        diff       ./code/ms3/ref/big_array.trace ./code/ms3/out/big_array.trace
+    done
+    for mode in "-m -e" "-m -j -e" "--milestone=2 -s -f -e --trace=none"; do
+        ./riscv $mode --mem-size=0x200000 ./code/ms3/input/big_array.input > ./code/ms3/out/big_array.small.trace
+        echo "diff ./code/ms3/ref/big_array.small.trace ./code/ms3/out/big_array.small.trace ($mode)"
+        diff       ./code/ms3/ref/big_array.small.trace ./code/ms3/out/big_array.small.trace
+    done
+}
+
+
+# Function to run the multi-cycle unit checks
+run5() {
+    echo -e "${YELLOW_BOLD}Each cycle of --mul-latency must cost the dependent multiplies of mul_chain one cycle, and none may change a result${RESET}"
+
+    for lat in 1 2 3 4; do
+        for wf in "" "--regfile-write-first"; do
+            echo "--mul-latency=$lat $wf"
+            ./riscv --milestone=2 --trace=none -s -f -e --cosim --mul-latency=$lat $wf ./code/ms3/input/mul_chain.input
+        done
+    done > ./code/ms3/out/mul_chain.trace
+    echo "diff ./code/ms3/ref/mul_chain.trace ./code/ms3/out/mul_chain.trace"
+    diff       ./code/ms3/ref/mul_chain.trace ./code/ms3/out/mul_chain.trace
+}
+
+
+# Function to run the RV32M checks
+run6() {
+    echo -e "${YELLOW_BOLD}The RV32M programs print their checksum in every emulator mode and stay in lockstep under -s --cosim${RESET}"
+
+    for t in div_index fixed_point; do
+        for mode in "-m -e" "-m -b -e" "-m -j -e"; do
+            ./riscv $mode ./code/ms3/input/$t.input > ./code/ms3/out/$t.emu.trace
+            echo "diff ./code/ms3/ref/$t.emu.trace ./code/ms3/out/$t.emu.trace ($mode)"
+            diff       ./code/ms3/ref/$t.emu.trace ./code/ms3/out/$t.emu.trace
+        done
+
+        for units in "" "--mul-latency=3 --div-latency=20"; do
+            echo "--milestone=3 --trace=none -s -f -c -e --cosim $units"
+            ./riscv --milestone=3 --trace=none -s -f -c -e --cosim $units ./code/ms3/input/$t.input
+        done > ./code/ms3/out/$t.trace
+        echo "diff ./code/ms3/ref/$t.trace ./code/ms3/out/$t.trace"
+        diff       ./code/ms3/ref/$t.trace ./code/ms3/out/$t.trace
+    done
+
+    # a program without multiplies or divides takes as long whatever the units
+    ./riscv --milestone=2 --trace=none -s -f -e ./code/ms3/input/random.input > ./code/ms3/out/random.units.trace
+    ./riscv --milestone=2 --trace=none -s -f -e --div-latency=5 ./code/ms3/input/random.input | grep -v "MUL/DIV" > ./code/ms3/out/random.div5.trace
+    echo "diff ./code/ms3/out/random.units.trace ./code/ms3/out/random.div5.trace"
+    diff       ./code/ms3/out/random.units.trace ./code/ms3/out/random.div5.trace
+}
+
+
+# Function to run the control flow checks
+run7() {
+    echo -e "${YELLOW_BOLD}Calls, returns, signed and unsigned compares and a jump table, in every emulator mode and under -s --cosim${RESET}"
+
+    for mode in "-m -e" "-m -b -e" "-m -j -e"; do
+        ./riscv $mode ./code/ms3/input/control_flow.input > ./code/ms3/out/control_flow.emu.trace
+        echo "diff ./code/ms3/ref/control_flow.emu.trace ./code/ms3/out/control_flow.emu.trace ($mode)"
+        diff       ./code/ms3/ref/control_flow.emu.trace ./code/ms3/out/control_flow.emu.trace
+    done
+
+    for sim in "--milestone=3 --trace=none -s -f -c -e --cosim" "--milestone=2 --trace=none -s -f -e --cosim"; do
+        echo "$sim"
+        ./riscv $sim ./code/ms3/input/control_flow.input
+    done > ./code/ms3/out/control_flow.trace
+    echo "diff ./code/ms3/ref/control_flow.trace ./code/ms3/out/control_flow.trace"
+    diff       ./code/ms3/ref/control_flow.trace ./code/ms3/out/control_flow.trace
+}
+
+
+# Function to run the CSR checks
+run8() {
+    echo -e "${YELLOW_BOLD}perf_counters prints its checksum in every emulator mode, and each bad CSR access ends the run with its report${RESET}"
+
+    for mode in "-m -e" "-m -b -e" "-m -j -e"; do
+        ./riscv $mode ./code/ms3/input/perf_counters.input > ./code/ms3/out/perf_counters.emu.trace
+        echo "diff ./code/ms3/ref/perf_counters.emu.trace ./code/ms3/out/perf_counters.emu.trace ($mode)"
+        diff       ./code/ms3/ref/perf_counters.emu.trace ./code/ms3/out/perf_counters.emu.trace
+    done
+
+    for sim in "--milestone=3 --trace=none -s -f -c -e --cosim" "--milestone=2 --trace=none -s -f -e --cosim"; do
+        echo "$sim"
+        ./riscv $sim ./code/ms3/input/perf_counters.input
+    done > ./code/ms3/out/perf_counters.trace
+    echo "diff ./code/ms3/ref/perf_counters.trace ./code/ms3/out/perf_counters.trace"
+    diff       ./code/ms3/ref/perf_counters.trace ./code/ms3/out/perf_counters.trace
+
+    # --cosim copies CSR results from the pipeline, so the pipeline must raise these itself
+    for t in csr_unknown csr_read_only; do
+        for mode in "-m -e" "-m -j -e" "-s -f -e --trace=none" "--milestone=3 -s -f -c -e --trace=none --cosim"; do
+            ./riscv $mode ./code/ms3/input/$t.input > ./code/ms3/out/$t.trace
+            echo "diff ./code/ms3/ref/$t.trace ./code/ms3/out/$t.trace ($mode)"
+            diff       ./code/ms3/ref/$t.trace ./code/ms3/out/$t.trace
+        done
+    done
 }
 
 
@@ -73,7 +189,22 @@ case $1 in
     no_cache)
         run3
         ;;
+    memory_faults)
+        run4
+        ;;
+    units)
+        run5
+        ;;
+    rv32m)
+        run6
+        ;;
+    control_flow)
+        run7
+        ;;
+    csr)
+        run8
+        ;;
     *)
-        echo "Usage: $0 {cache_complete|cache_summary|no_cache}"
+        echo "Usage: $0 {cache_complete|cache_summary|no_cache|memory_faults|units|rv32m|control_flow|csr}"
         ;;
 esac
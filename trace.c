@@ -0,0 +1,784 @@
+#define _GNU_SOURCE  // fopencookie(), open_memstream()
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdio_ext.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "types.h"
+#include "riscv.h"
+#include "trace.h"
+
+#define TRACE_BUFFER_SIZE (1 << 20)
+#define TRACE_LINE_MAX    4096      // longer lines are stored verbatim
+
+// record tags
+enum
+{
+  TRACE_REC_CYCLE    = 0x01,  // varint cycle delta
+  TRACE_REC_REGS     = 0x02,  // varint changed mask, zig-zag delta per register
+  TRACE_REC_TEXT_NEW = 0x03,  // varint length, bytes; appended to the dictionary
+  TRACE_REC_TEXT_REF = 0x04,  // varint dictionary index
+  TRACE_REC_RAW      = 0x05,  // varint length, bytes; not a whole line
+  TRACE_REC_STAGE    = 0x10,  // + stage: varint bits, zig-zag PC delta
+  TRACE_REC_SHIFT    = 0x18,  // + stage: what the previous stage held last cycle
+  TRACE_REC_HOLD     = 0x20,  // + stage: what this stage held last cycle
+};
+
+static const char* const trace_stage_names[TRACE_STAGES] = { "IF ", "ID ", "EX ", "MEM", "WB " };
+
+typedef struct
+{
+  Word    bits;
+  Address pc;
+}trace_slot_t;
+
+/**
+ * State shared by the writer and the reader; both apply the same updates so
+ * deltas resolve against identical history.
+ **/
+typedef struct
+{
+  uint64_t     cycle;
+  Register     regs[32];
+  trace_slot_t cur[TRACE_STAGES];   // this cycle
+  trace_slot_t prev[TRACE_STAGES];  // last cycle
+  char**       dict;
+  size_t*      dict_len;
+  uint32_t     dict_count;
+}trace_state_t;
+
+static trace_state_t trace_st;
+static FILE*         trace_out = NULL;   // binary output, NULL in text mode
+static char          trace_line[TRACE_LINE_MAX];
+static size_t        trace_line_len = 0;
+
+// open-addressing index over trace_st.dict, writer side only
+#define TRACE_HASH_SIZE (2 * TRACE_DICT_SIZE)
+static int32_t* trace_hash = NULL;
+
+///////////////////////////////////////////////////////////////////////////////
+/// Encoding helpers
+///////////////////////////////////////////////////////////////////////////////
+
+static inline void put_varint(uint64_t v)
+{
+  while (v >= 0x80) {
+    putc_unlocked((int)(v & 0x7F) | 0x80, trace_out);
+    v >>= 7;
+  }
+  putc_unlocked((int)v, trace_out);
+}
+
+static inline uint32_t zigzag(int32_t v)
+{
+  return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t v)
+{
+  return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+static bool get_varint(FILE* in, uint64_t* v)
+{
+  *v = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    int c = getc_unlocked(in);
+    if (c == EOF) return false;
+    *v |= (uint64_t)(c & 0x7F) << shift;
+    if (!(c & 0x80)) return true;
+  }
+  return false;
+}
+
+static void trace_state_init(trace_state_t* st)
+{
+  memset(st, 0, sizeof(*st));
+  st->dict = calloc(TRACE_DICT_SIZE, sizeof(char*));
+  st->dict_len = calloc(TRACE_DICT_SIZE, sizeof(size_t));
+  if (st->dict == NULL || st->dict_len == NULL) {
+    printf("Error: Unable to allocate the trace dictionary\n");
+    exit(-1);
+  }
+}
+
+static void trace_dict_add(trace_state_t* st, const char* s, size_t len)
+{
+  char* copy = malloc(len);
+  if (copy == NULL) {
+    printf("Error: Unable to allocate the trace dictionary\n");
+    exit(-1);
+  }
+  memcpy(copy, s, len);
+  st->dict[st->dict_count] = copy;
+  st->dict_len[st->dict_count] = len;
+  st->dict_count++;
+}
+
+static uint32_t trace_hash_bytes(const char* s, size_t len)
+{
+  uint32_t h = 2166136261u;  // FNV-1a
+  for (size_t i = 0; i < len; i++) {
+    h = (h ^ (uint8_t)s[i]) * 16777619u;
+  }
+  return h;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Writer
+///////////////////////////////////////////////////////////////////////////////
+
+static void trace_put_bytes(uint8_t tag, const char* s, size_t len)
+{
+  putc_unlocked(tag, trace_out);
+  put_varint(len);
+  fwrite(s, 1, len, trace_out);
+}
+
+// one complete line (with its newline) printed by the simulator
+static void trace_put_line(const char* s, size_t len)
+{
+  uint32_t slot = trace_hash_bytes(s, len) & (TRACE_HASH_SIZE - 1);
+  while (trace_hash[slot] >= 0) {
+    int32_t id = trace_hash[slot];
+    if (trace_st.dict_len[id] == len && memcmp(trace_st.dict[id], s, len) == 0) {
+      putc_unlocked(TRACE_REC_TEXT_REF, trace_out);
+      put_varint((uint64_t)id);
+      return;
+    }
+    slot = (slot + 1) & (TRACE_HASH_SIZE - 1);
+  }
+
+  trace_put_bytes(TRACE_REC_TEXT_NEW, s, len);
+  if (trace_st.dict_count < TRACE_DICT_SIZE) {
+    trace_hash[slot] = (int32_t)trace_st.dict_count;
+    trace_dict_add(&trace_st, s, len);
+  }
+}
+
+// receives everything printed to stdout while the binary trace is open
+static ssize_t trace_stdout_write(void* cookie, const char* buf, size_t size)
+{
+  for (size_t i = 0; i < size; i++) {
+    trace_line[trace_line_len++] = buf[i];
+    if (buf[i] == '\n') {
+      trace_put_line(trace_line, trace_line_len);
+      trace_line_len = 0;
+    } else if (trace_line_len == TRACE_LINE_MAX) {
+      trace_put_bytes(TRACE_REC_RAW, trace_line, trace_line_len);
+      trace_line_len = 0;
+    }
+  }
+  return size;
+}
+
+/**
+ * Moves pending stdout text into the trace so records stay in print order.
+ **/
+static void trace_sync(void)
+{
+  fflush(stdout);
+  if (trace_line_len > 0) {
+    trace_put_bytes(TRACE_REC_RAW, trace_line, trace_line_len);
+    trace_line_len = 0;
+  }
+}
+
+static void trace_close(void)
+{
+  if (trace_out != NULL) {
+    trace_sync();
+    fclose(trace_out);
+    trace_out = NULL;
+  }
+}
+
+void trace_open_bin(const char* path)
+{
+  trace_out = fopen(path, "wb");
+  if (trace_out == NULL) {
+    printf("Error: unable to create trace file %s\n", path);
+    exit(-1);
+  }
+  setvbuf(trace_out, NULL, _IOFBF, TRACE_BUFFER_SIZE);
+  fwrite(TRACE_MAGIC, 1, sizeof(TRACE_MAGIC) - 1, trace_out);
+
+  trace_state_init(&trace_st);
+  trace_hash = malloc(TRACE_HASH_SIZE * sizeof(int32_t));
+  if (trace_hash == NULL) {
+    printf("Error: Unable to allocate the trace dictionary\n");
+    exit(-1);
+  }
+  memset(trace_hash, 0xFF, TRACE_HASH_SIZE * sizeof(int32_t));
+
+  cookie_io_functions_t io = { .read = NULL, .write = trace_stdout_write, .seek = NULL, .close = NULL };
+  FILE* f = fopencookie(NULL, "w", io);
+  if (f == NULL) {
+    printf("Error: unable to redirect output into the trace\n");
+    exit(-1);
+  }
+  setvbuf(f, NULL, _IOFBF, TRACE_LINE_MAX);
+  fflush(stdout);
+  stdout = f;
+  atexit(trace_close);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Text format (shared by the simulator and trace_to_text())
+///////////////////////////////////////////////////////////////////////////////
+
+static void trace_print_cycle(uint64_t cycle)
+{
+  printf("v==============Cycle Counter = %5ld==============v\n\n", (long)cycle);
+}
+
+static void trace_print_stage(trace_stage_t stage, Word bits, Address pc)
+{
+  printf("[%s]: Instruction [%08x]@[%08x]: ", trace_stage_names[stage], bits, pc);
+  decode_instruction(bits);
+}
+
+static void trace_print_regs(const Register* R)
+{
+  for (uint8_t i = 0; i < 8; i++)       // 8 columns
+  {
+    for (uint8_t j = 0; j < 4; j++)     // of 4 registers each
+    {
+      printf("r%2d=%08x ", i * 4 + j, R[i * 4 + j]);
+    }
+    printf("\n");
+  }
+  printf("\n");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Asynchronous text writer
+///////////////////////////////////////////////////////////////////////////////
+
+#define TRACE_RING_SIZE    (4 << 20)               // bytes, power of two
+#define TRACE_RING_WAKE    (TRACE_RING_SIZE / 8)   // fill level that wakes an idle writer
+#define TRACE_RING_CHUNK   (64 * 1024)             // largest text record
+#define TRACE_IO_SIZE      (1 << 20)               // bytes handed to the output at once
+#define TRACE_IDLE_MS      50                      // an idle writer still drains this often
+#define TRACE_DISASM_BITS  16
+#define TRACE_DISASM_SIZE  (1 << TRACE_DISASM_BITS) // instruction words remembered
+
+// record types in the ring
+enum
+{
+  TRACE_ASYNC_PAD,     // nothing more before the end of the ring
+  TRACE_ASYNC_CYCLE,   // uint64_t cycle
+  TRACE_ASYNC_STAGE,   // trace_async_stage_t
+  TRACE_ASYNC_REGS,    // Register[32]
+  TRACE_ASYNC_TEXT,    // bytes printed to stdout
+};
+
+// every record starts with a header and is padded to a multiple of 8 bytes
+typedef struct
+{
+  uint32_t type;
+  uint32_t len;        // payload bytes after the header
+}trace_async_rec_t;
+
+typedef struct
+{
+  uint32_t    stage;
+  Word        bits;
+  Address     pc;
+  uint32_t    disasm_len;
+  const char* disasm;  // owned by the disassembly cache, never freed
+}trace_async_stage_t;
+
+typedef struct
+{
+  Word        bits;
+  uint32_t    len;
+  const char* text;    // NULL for an empty slot
+}trace_disasm_t;
+
+static bool             trace_async = false;
+static Byte*            trace_ring = NULL;
+static _Atomic uint64_t trace_head = 0;        // bytes produced, only the simulator writes it
+static _Atomic uint64_t trace_tail = 0;        // bytes consumed, only the writer thread writes it
+static uint64_t         trace_next_head = 0;   // head once the reserved record is committed
+static uint64_t         trace_tail_seen = 0;   // the simulator's last look at trace_tail
+static atomic_bool      trace_writer_idle = false;
+static atomic_bool      trace_producer_full = false;
+static atomic_bool      trace_done = false;
+static pthread_t        trace_thread;
+static pthread_mutex_t  trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   trace_data = PTHREAD_COND_INITIALIZER;   // writer waits for records
+static pthread_cond_t   trace_space = PTHREAD_COND_INITIALIZER;  // simulator waits for room
+static FILE*            trace_text_out = NULL; // stdout before trace_open_async()
+static trace_disasm_t*  trace_disasm_tab = NULL;
+static uint32_t         trace_disasm_count = 0;
+
+static void trace_signal(pthread_cond_t* cond)
+{
+  pthread_mutex_lock(&trace_lock);
+  pthread_cond_signal(cond);
+  pthread_mutex_unlock(&trace_lock);
+}
+
+/**
+ * Blocks the simulator until the writer has consumed up to tail.
+ **/
+static void trace_wait_space(uint64_t tail)
+{
+  pthread_mutex_lock(&trace_lock);
+  atomic_store(&trace_producer_full, true);
+  pthread_cond_signal(&trace_data);
+  while ((trace_tail_seen = atomic_load(&trace_tail)) < tail) {
+    pthread_cond_wait(&trace_space, &trace_lock);
+  }
+  atomic_store(&trace_producer_full, false);
+  pthread_mutex_unlock(&trace_lock);
+}
+
+/**
+ * Reserves a record with len payload bytes and returns the payload. Nothing
+ * is visible to the writer until trace_commit().
+ **/
+static void* trace_reserve(uint32_t type, size_t len)
+{
+  uint64_t need = sizeof(trace_async_rec_t) + ((len + 7) & ~(size_t)7);
+  uint64_t head = atomic_load_explicit(&trace_head, memory_order_relaxed);
+  uint64_t off = head & (TRACE_RING_SIZE - 1);
+  uint64_t pad = (off + need > TRACE_RING_SIZE) ? TRACE_RING_SIZE - off : 0;
+
+  // records never wrap, a short tail of the ring is skipped instead
+  if (head + pad + need - trace_tail_seen > TRACE_RING_SIZE) {
+    trace_tail_seen = atomic_load_explicit(&trace_tail, memory_order_acquire);
+    if (head + pad + need - trace_tail_seen > TRACE_RING_SIZE) {
+      trace_wait_space(head + pad + need - TRACE_RING_SIZE);
+    }
+  }
+  if (pad > 0) {
+    ((trace_async_rec_t*)(trace_ring + off))->type = TRACE_ASYNC_PAD;
+    off = 0;
+  }
+
+  trace_async_rec_t* rec = (trace_async_rec_t*)(trace_ring + off);
+  rec->type = type;
+  rec->len = (uint32_t)len;
+  trace_next_head = head + pad + need;
+  return rec + 1;
+}
+
+static void trace_commit(void)
+{
+  // sequentially consistent, pairs with the writer setting trace_writer_idle
+  atomic_store(&trace_head, trace_next_head);
+  if (atomic_load(&trace_writer_idle) && trace_next_head - trace_tail_seen >= TRACE_RING_WAKE) {
+    trace_signal(&trace_data);
+  }
+}
+
+// receives everything printed to stdout while the writer thread runs
+static ssize_t trace_async_write(void* cookie, const char* buf, size_t size)
+{
+  for (size_t done = 0; done < size; ) {
+    size_t len = size - done;
+    if (len > TRACE_RING_CHUNK) len = TRACE_RING_CHUNK;
+    memcpy(trace_reserve(TRACE_ASYNC_TEXT, len), buf + done, len);
+    trace_commit();
+    done += len;
+  }
+  return size;
+}
+
+/**
+ * Moves text still buffered in stdout into the ring so records stay in print
+ * order.
+ **/
+static inline void trace_async_sync(void)
+{
+  if (__fpending(stdout) > 0) {
+    fflush(stdout);
+  }
+}
+
+/**
+ * Disassembly of bits exactly as decode_instruction() prints it, or NULL once
+ * the cache is full. Only the simulator thread calls this.
+ **/
+static const trace_disasm_t* trace_disasm(Word bits)
+{
+  uint32_t slot = (bits * 2654435761u) >> (32 - TRACE_DISASM_BITS);
+  while (trace_disasm_tab[slot].text != NULL) {
+    if (trace_disasm_tab[slot].bits == bits) {
+      return &trace_disasm_tab[slot];
+    }
+    slot = (slot + 1) & (TRACE_DISASM_SIZE - 1);
+  }
+  if (trace_disasm_count >= TRACE_DISASM_SIZE / 2) {
+    return NULL;
+  }
+
+  // decode_instruction() prints to stdout, point that at a string for the call
+  char* text = NULL;
+  size_t len = 0;
+  FILE* ms = open_memstream(&text, &len);
+  if (ms == NULL) {
+    return NULL;
+  }
+  FILE* saved = stdout;
+  stdout = ms;
+  decode_instruction(bits);
+  stdout = saved;
+  fclose(ms);
+
+  trace_disasm_tab[slot].bits = bits;
+  trace_disasm_tab[slot].len = (uint32_t)len;
+  trace_disasm_tab[slot].text = text;
+  trace_disasm_count++;
+  return &trace_disasm_tab[slot];
+}
+
+static inline char* trace_hex8(char* p, uint32_t v)
+{
+  static const char digits[] = "0123456789abcdef";
+  for (int i = 7; i >= 0; i--) {
+    p[i] = digits[v & 0xF];
+    v >>= 4;
+  }
+  return p + 8;
+}
+
+static inline char* trace_str(char* p, const char* s, size_t len)
+{
+  memcpy(p, s, len);
+  return p + len;
+}
+
+/**
+ * Formats one record in the writer thread, same text as trace_print_*().
+ * Returns the end of the formatted text.
+ **/
+static char* trace_format(char* p, const trace_async_rec_t* rec)
+{
+  const void* payload = rec + 1;
+  switch (rec->type) {
+    case TRACE_ASYNC_CYCLE: {
+      uint64_t cycle;
+      memcpy(&cycle, payload, sizeof(cycle));
+      p += sprintf(p, "v==============Cycle Counter = %5ld==============v\n\n", (long)cycle);
+      break;
+    }
+    case TRACE_ASYNC_STAGE: {
+      const trace_async_stage_t* st = payload;
+      p = trace_str(p, "[", 1);
+      p = trace_str(p, trace_stage_names[st->stage], 3);
+      p = trace_str(p, "]: Instruction [", 16);
+      p = trace_hex8(p, st->bits);
+      p = trace_str(p, "]@[", 3);
+      p = trace_hex8(p, st->pc);
+      p = trace_str(p, "]: ", 3);
+      p = trace_str(p, st->disasm, st->disasm_len);
+      break;
+    }
+    case TRACE_ASYNC_REGS: {
+      const Register* R = payload;
+      for (int i = 0; i < 32; i++) {
+        *p++ = 'r';
+        *p++ = (i < 10) ? ' ' : (char)('0' + i / 10);
+        *p++ = (char)('0' + i % 10);
+        *p++ = '=';
+        p = trace_hex8(p, R[i]);
+        *p++ = ' ';
+        if (i % 4 == 3) *p++ = '\n';
+      }
+      *p++ = '\n';
+      break;
+    }
+  }
+  return p;
+}
+
+static void* trace_writer(void* arg)
+{
+  char* buf = malloc(TRACE_IO_SIZE);
+  size_t used = 0;
+  uint64_t tail = 0;
+
+  for (;;) {
+    uint64_t head = atomic_load_explicit(&trace_head, memory_order_acquire);
+    while (tail != head) {
+      const trace_async_rec_t* rec = (const trace_async_rec_t*)(trace_ring + (tail & (TRACE_RING_SIZE - 1)));
+      if (rec->type == TRACE_ASYNC_PAD) {
+        tail += TRACE_RING_SIZE - (tail & (TRACE_RING_SIZE - 1));
+        continue;
+      }
+
+      // the longest formatted record is a text chunk or a stage with its disassembly
+      size_t worst = (rec->type == TRACE_ASYNC_STAGE)
+                   ? 64 + ((const trace_async_stage_t*)(rec + 1))->disasm_len
+                   : 512 + ((rec->type == TRACE_ASYNC_TEXT) ? rec->len : 0);
+      if (used + worst > TRACE_IO_SIZE) {
+        fwrite(buf, 1, used, trace_text_out);
+        used = 0;
+        // hand the space back before formatting more
+        atomic_store(&trace_tail, tail);
+        if (atomic_load(&trace_producer_full)) trace_signal(&trace_space);
+      }
+
+      if (rec->type == TRACE_ASYNC_TEXT) {
+        used = trace_str(buf + used, (const char*)(rec + 1), rec->len) - buf;
+      } else {
+        used = trace_format(buf + used, rec) - buf;
+      }
+      tail += sizeof(trace_async_rec_t) + ((rec->len + 7) & ~(uint32_t)7);
+    }
+
+    fwrite(buf, 1, used, trace_text_out);
+    fflush(trace_text_out);
+    used = 0;
+    atomic_store(&trace_tail, tail);
+    if (atomic_load(&trace_producer_full)) trace_signal(&trace_space);
+
+    if (atomic_load(&trace_done) && atomic_load(&trace_head) == tail) {
+      break;
+    }
+
+    // sleep until enough has piled up for a large write, or a while has passed
+    pthread_mutex_lock(&trace_lock);
+    atomic_store(&trace_writer_idle, true);
+    if (!atomic_load(&trace_done) && atomic_load(&trace_head) - tail < TRACE_RING_WAKE
+        && !atomic_load(&trace_producer_full)) {
+      struct timespec until;
+      clock_gettime(CLOCK_REALTIME, &until);
+      until.tv_nsec += TRACE_IDLE_MS * 1000000L;
+      if (until.tv_nsec >= 1000000000L) {
+        until.tv_sec++;
+        until.tv_nsec -= 1000000000L;
+      }
+      pthread_cond_timedwait(&trace_data, &trace_lock, &until);
+    }
+    atomic_store(&trace_writer_idle, false);
+    pthread_mutex_unlock(&trace_lock);
+  }
+
+  free(buf);
+  return NULL;
+}
+
+static void trace_async_close(void)
+{
+  if (!trace_async) {
+    return;
+  }
+  fflush(stdout);
+  pthread_mutex_lock(&trace_lock);
+  atomic_store(&trace_done, true);
+  pthread_cond_signal(&trace_data);
+  pthread_mutex_unlock(&trace_lock);
+  pthread_join(trace_thread, NULL);
+
+  trace_async = false;
+  stdout = trace_text_out;
+  fflush(stdout);
+}
+
+void trace_open_async(void)
+{
+  if (trace_out != NULL || trace_async) {
+    return;
+  }
+
+  trace_ring = malloc(TRACE_RING_SIZE);
+  trace_disasm_tab = calloc(TRACE_DISASM_SIZE, sizeof(trace_disasm_t));
+  if (trace_ring == NULL || trace_disasm_tab == NULL) {
+    printf("Error: Unable to allocate the trace buffer\n");
+    exit(-1);
+  }
+
+  cookie_io_functions_t io = { .read = NULL, .write = trace_async_write, .seek = NULL, .close = NULL };
+  FILE* f = fopencookie(NULL, "w", io);
+  if (f == NULL) {
+    printf("Error: unable to redirect output into the trace buffer\n");
+    exit(-1);
+  }
+  setvbuf(f, NULL, _IOFBF, TRACE_LINE_MAX);
+  fflush(stdout);
+  trace_text_out = stdout;
+
+  if (pthread_create(&trace_thread, NULL, trace_writer, NULL) != 0) {
+    printf("Error: unable to start the trace writer thread\n");
+    exit(-1);
+  }
+  stdout = f;
+  trace_async = true;
+  atexit(trace_async_close);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Trace records
+///////////////////////////////////////////////////////////////////////////////
+
+void trace_cycle(uint64_t cycle)
+{
+  if (trace_async) {
+    trace_async_sync();
+    memcpy(trace_reserve(TRACE_ASYNC_CYCLE, sizeof(cycle)), &cycle, sizeof(cycle));
+    trace_commit();
+    return;
+  }
+  if (trace_out == NULL) {
+    trace_print_cycle(cycle);
+    return;
+  }
+  trace_sync();
+  putc_unlocked(TRACE_REC_CYCLE, trace_out);
+  put_varint(cycle - trace_st.cycle);
+  trace_st.cycle = cycle;
+  memcpy(trace_st.prev, trace_st.cur, sizeof(trace_st.cur));
+}
+
+void trace_stage(trace_stage_t stage, Word bits, Address pc)
+{
+  if (trace_async) {
+    trace_async_sync();
+    const trace_disasm_t* d = trace_disasm(bits);
+    if (d == NULL) {
+      trace_print_stage(stage, bits, pc);  // as text through stdout
+      return;
+    }
+    trace_async_stage_t* st = trace_reserve(TRACE_ASYNC_STAGE, sizeof(trace_async_stage_t));
+    st->stage = stage;
+    st->bits = bits;
+    st->pc = pc;
+    st->disasm_len = d->len;
+    st->disasm = d->text;
+    trace_commit();
+    return;
+  }
+  if (trace_out == NULL) {
+    trace_print_stage(stage, bits, pc);
+    return;
+  }
+  trace_sync();
+  const trace_slot_t* shift = (stage > 0) ? &trace_st.prev[stage - 1] : NULL;
+  const trace_slot_t* hold = &trace_st.prev[stage];
+  if (shift != NULL && shift->bits == bits && shift->pc == pc) {
+    putc_unlocked(TRACE_REC_SHIFT + stage, trace_out);
+  } else if (hold->bits == bits && hold->pc == pc) {
+    putc_unlocked(TRACE_REC_HOLD + stage, trace_out);
+  } else {
+    putc_unlocked(TRACE_REC_STAGE + stage, trace_out);
+    put_varint(bits);
+    put_varint(zigzag((int32_t)(pc - hold->pc)));
+  }
+  trace_st.cur[stage].bits = bits;
+  trace_st.cur[stage].pc = pc;
+}
+
+void trace_regs(const regfile_t* regfile_p)
+{
+  if (trace_async) {
+    trace_async_sync();
+    memcpy(trace_reserve(TRACE_ASYNC_REGS, sizeof(regfile_p->R)), regfile_p->R, sizeof(regfile_p->R));
+    trace_commit();
+    return;
+  }
+  if (trace_out == NULL) {
+    trace_print_regs(regfile_p->R);
+    return;
+  }
+  trace_sync();
+  uint32_t mask = 0;
+  for (int i = 0; i < 32; i++) {
+    if (regfile_p->R[i] != trace_st.regs[i]) mask |= 1U << i;
+  }
+  putc_unlocked(TRACE_REC_REGS, trace_out);
+  put_varint(mask);
+  for (int i = 0; i < 32; i++) {
+    if (mask & (1U << i)) {
+      put_varint(zigzag((int32_t)(regfile_p->R[i] - trace_st.regs[i])));
+      trace_st.regs[i] = regfile_p->R[i];
+    }
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Reader
+///////////////////////////////////////////////////////////////////////////////
+
+static bool trace_get_bytes(FILE* in, char** s, size_t* len)
+{
+  uint64_t n;
+  if (!get_varint(in, &n)) return false;
+  *s = malloc(n ? n : 1);
+  if (*s == NULL || fread(*s, 1, n, in) != n) {
+    free(*s);
+    return false;
+  }
+  *len = n;
+  return true;
+}
+
+int trace_to_text(FILE* in)
+{
+  char magic[sizeof(TRACE_MAGIC) - 1];
+  if (fread(magic, 1, sizeof(magic), in) != sizeof(magic) || memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0) {
+    return -1;
+  }
+
+  trace_state_t st;
+  trace_state_init(&st);
+
+  int tag;
+  while ((tag = getc_unlocked(in)) != EOF) {
+    uint64_t v;
+    if (tag == TRACE_REC_CYCLE) {
+      if (!get_varint(in, &v)) return -1;
+      st.cycle += v;
+      memcpy(st.prev, st.cur, sizeof(st.cur));
+      trace_print_cycle(st.cycle);
+    } else if (tag == TRACE_REC_REGS) {
+      if (!get_varint(in, &v)) return -1;
+      uint32_t mask = (uint32_t)v;
+      for (int i = 0; i < 32; i++) {
+        if (mask & (1U << i)) {
+          if (!get_varint(in, &v)) return -1;
+          st.regs[i] += (Register)unzigzag((uint32_t)v);
+        }
+      }
+      trace_print_regs(st.regs);
+    } else if (tag == TRACE_REC_TEXT_NEW || tag == TRACE_REC_RAW) {
+      char* s;
+      size_t len;
+      if (!trace_get_bytes(in, &s, &len)) return -1;
+      fwrite(s, 1, len, stdout);
+      if (tag == TRACE_REC_TEXT_NEW && st.dict_count < TRACE_DICT_SIZE) {
+        trace_dict_add(&st, s, len);
+      }
+      free(s);
+    } else if (tag == TRACE_REC_TEXT_REF) {
+      if (!get_varint(in, &v) || v >= st.dict_count) return -1;
+      fwrite(st.dict[v], 1, st.dict_len[v], stdout);
+    } else if (tag >= TRACE_REC_STAGE && tag < TRACE_REC_HOLD + TRACE_STAGES) {
+      int stage = tag & 0x7;
+      if (stage >= TRACE_STAGES) return -1;
+      trace_slot_t slot;
+      if (tag < TRACE_REC_SHIFT) {
+        uint64_t bits;
+        if (!get_varint(in, &bits) || !get_varint(in, &v)) return -1;
+        slot.bits = (Word)bits;
+        slot.pc = st.prev[stage].pc + (Address)unzigzag((uint32_t)v);
+      } else if (tag < TRACE_REC_HOLD) {
+        if (stage == 0) return -1;
+        slot = st.prev[stage - 1];
+      } else {
+        slot = st.prev[stage];
+      }
+      st.cur[stage] = slot;
+      trace_print_stage(stage, slot.bits, slot.pc);
+    } else {
+      return -1;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,65 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include "types.h"
+
+///////////////////////////////////////////////////////////////////////////////
+/// Pipeline trace output, as text or as a compact binary stream
+///////////////////////////////////////////////////////////////////////////////
+
+/**
+ * The per-cycle trace (cycle header, one line per stage, register dump) is
+ * emitted through these calls. By default they print the usual text. After
+ * trace_open_bin() they append records to a binary file instead:
+ *
+ *   - stage lines store the instruction word and a PC delta, or a single
+ *     byte when the instruction just moved on from the previous stage (or
+ *     stayed put during a stall);
+ *   - the register dump stores a bitmask of changed registers and one
+ *     zig-zag varint delta for each;
+ *   - everything else written to stdout is captured line by line, and lines
+ *     seen before are replaced by their index in a dictionary.
+ *
+ * In text mode, trace_open_async() moves the formatting and writing onto a
+ * background thread. The simulator then only appends raw records (and any
+ * other stdout text) to a single-producer/single-consumer ring buffer, and
+ * blocks only when that ring is full.
+ *
+ * trace2txt (trace_to_text()) expands a binary trace back into exactly the
+ * text the simulator would have printed, so it can be diffed against the
+ * reference traces under code/ms*\/ref.
+ */
+
+typedef enum
+{
+  TRACE_IF, TRACE_ID, TRACE_EX, TRACE_MEM, TRACE_WB,
+  TRACE_STAGES
+}trace_stage_t;
+
+#define TRACE_MAGIC      "RVTB\x01"   // file header, last byte is the version
+#define TRACE_DICT_SIZE  65536        // distinct text lines remembered
+
+/**
+ * Sends the trace (and anything else printed to stdout) to a binary file.
+ **/
+void trace_open_bin(const char* path);
+
+/**
+ * Formats and writes the text trace (and anything else printed to stdout) on
+ * a background thread. Output is flushed at exit. Does nothing when the binary
+ * trace is open.
+ **/
+void trace_open_async(void);
+
+void trace_cycle(uint64_t cycle);
+void trace_stage(trace_stage_t stage, Word bits, Address pc);
+void trace_regs(const regfile_t* regfile_p);
+
+/**
+ * Expands a binary trace onto stdout. Returns 0, or -1 if in is malformed.
+ **/
+int trace_to_text(FILE* in);
+
+#endif  // __TRACE_H__
@@ -0,0 +1,24 @@
+#include <stdio.h>
+#include "trace.h"
+
+/* Expands a trace written with `riscv --trace-bin FILE` into the text the
+ * simulator would have printed. */
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s TRACE\n", argv[0]);
+    return -1;
+  }
+
+  FILE *in = fopen(argv[1], "rb");
+  if (in == NULL) {
+    fprintf(stderr, "Unable to open %s\n", argv[1]);
+    return -1;
+  }
+
+  int ret = trace_to_text(in);
+  fclose(in);
+  if (ret != 0) {
+    fprintf(stderr, "%s: malformed trace\n", argv[1]);
+  }
+  return ret;
+}
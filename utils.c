@@ -2,6 +2,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+void (*invalid_access_detail)(void) = NULL;
+
 /* Unpacks the 32-bit machine code instruction given into the correct
  * type within the instruction struct */
 Instruction parse_instruction(uint32_t instruction_bits) {
@@ -69,10 +71,20 @@ Instruction parse_instruction(uint32_t instruction_bits) {
     instruction.itype.imm = instruction_bits & ((1U << 12) - 1);
     break;
 
-  // Ecall
+  // Ecall and CSR accesses, I-Type
   case 0x73:
-    //Ecall only has an opcode and the rest of the instruction is 0's
-    instruction.rest = 0;
+    //Ecall is all 0's apart from the opcode, CSR accesses use funct3 1-3 and 5-7
+    //with the CSR number in imm (and an immediate source in rs1 for 5-7)
+    instruction.itype.rd = instruction_bits & ((1U << 5) - 1);
+    instruction_bits >>= 5;
+
+    instruction.itype.funct3 = instruction_bits & ((1U << 3) - 1);
+    instruction_bits >>= 3;
+
+    instruction.itype.rs1 = instruction_bits & ((1U << 5) - 1);
+    instruction_bits >>= 5;
+
+    instruction.itype.imm = instruction_bits & ((1U << 12) - 1);
     break;
 
   // S-Type
@@ -120,6 +132,30 @@ Instruction parse_instruction(uint32_t instruction_bits) {
     instruction.utype.imm = instruction_bits & ((1U << 20) - 1);
     break;
 
+  //AUIPC, U-Type
+  case 0x17:
+
+    instruction.utype.rd = instruction_bits & ((1U << 5) - 1);
+    instruction_bits >>= 5;
+
+    instruction.utype.imm = instruction_bits & ((1U << 20) - 1);
+    break;
+
+  //JALR, I-Type
+  case 0x67:
+
+    instruction.itype.rd = instruction_bits & ((1U << 5) - 1);
+    instruction_bits >>= 5;
+
+    instruction.itype.funct3 = instruction_bits & ((1U << 3) - 1);
+    instruction_bits >>= 3;
+
+    instruction.itype.rs1 = instruction_bits & ((1U << 5) - 1);
+    instruction_bits >>= 5;
+
+    instruction.itype.imm = instruction_bits & ((1U << 12) - 1);
+    break;
+
   //UJ-Type
   case 0x6f:
 
@@ -217,6 +253,34 @@ int get_store_offset(Instruction instruction) {
   int imm = (instruction.stype.imm7 << 5) | instruction.stype.imm5;
   return sign_extend_number(imm, 12);
 }
+
+/* Returns the result of the RV32M instruction with the given funct3 (the
+ * R-type with funct7 0x01). Division by zero and the one overflowing signed
+ * division don't trap; they return what the specification defines. */
+Word muldiv_result(unsigned int funct3, Word rs1, Word rs2) {
+  switch (funct3) {
+    case 0x0: // mul
+      return rs1 * rs2;
+    case 0x1: // mulh
+      return (Word)(((sDouble)(sWord)rs1 * (sDouble)(sWord)rs2) >> 32);
+    case 0x2: // mulhsu
+      return (Word)(((sDouble)(sWord)rs1 * (sDouble)rs2) >> 32);
+    case 0x3: // mulhu
+      return (Word)(((Double)rs1 * (Double)rs2) >> 32);
+    case 0x4: // div
+      if (rs2 == 0) return 0xFFFFFFFF;
+      if (rs1 == 0x80000000 && rs2 == 0xFFFFFFFF) return rs1;
+      return (Word)((sWord)rs1 / (sWord)rs2);
+    case 0x5: // divu
+      return rs2 == 0 ? 0xFFFFFFFF : rs1 / rs2;
+    case 0x6: // rem
+      if (rs2 == 0) return rs1;
+      if (rs1 == 0x80000000 && rs2 == 0xFFFFFFFF) return 0;
+      return (Word)((sWord)rs1 % (sWord)rs2);
+    default:  // remu
+      return rs2 == 0 ? rs1 : rs1 % rs2;
+  }
+}
 /************************Helper functions************************/
 
 void handle_invalid_instruction(Instruction instruction) {
@@ -225,10 +289,57 @@ void handle_invalid_instruction(Instruction instruction) {
 
 void handle_invalid_read(Address address) {
   printf("Bad Read. Address: 0x%08x\n", address);
+  if (invalid_access_detail) {
+    invalid_access_detail();
+  }
   exit(-1);
 }
 
 void handle_invalid_write(Address address) {
   printf("Bad Write. Address: 0x%08x\n", address);
+  if (invalid_access_detail) {
+    invalid_access_detail();
+  }
+  exit(-1);
+}
+
+static void handle_failed_alloc(const char* what) {
+  printf("Error: Unable to allocate memory for %s\n", what);
   exit(-1);
 }
+
+void* checked_calloc(size_t count, size_t size, const char* what) {
+  void* ptr = calloc(count, size);
+  if (ptr == NULL) {
+    handle_failed_alloc(what);
+  }
+  return ptr;
+}
+
+void* checked_realloc(void* ptr, size_t size, const char* what) {
+  ptr = realloc(ptr, size);
+  if (ptr == NULL) {
+    handle_failed_alloc(what);
+  }
+  return ptr;
+}
+
+/* The emulator ends the program with exit() at the exit ecall, so the
+ * reports a run opens are completed from here. They may be opened again
+ * (e.g. once per interval), but each is closed only once. */
+#define CLOSE_AT_EXIT_MAX 8
+
+void close_at_exit(void (*close_fn)(void)) {
+  static void (*registered[CLOSE_AT_EXIT_MAX])(void);
+  static int count = 0;
+  for (int i = 0; i < count; i++) {
+    if (registered[i] == close_fn) {
+      return;
+    }
+  }
+  if (count == CLOSE_AT_EXIT_MAX || atexit(close_fn) != 0) {
+    printf("Error: Unable to register a report for exit\n");
+    exit(-1);
+  }
+  registered[count++] = close_fn;
+}
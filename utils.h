@@ -1,6 +1,7 @@
 #ifndef __UTILS_H__
 #define __UTILS_H__
 
+#include <stddef.h>
 #include "types.h"
 
 #define RTYPE_FORMAT "%s\tx%d, x%d, x%d\n"
@@ -8,8 +9,12 @@
 #define MEM_FORMAT "%s\tx%d, %d(x%d)\n"
 #define LUI_FORMAT "lui\tx%d, %d\n"
 #define JAL_FORMAT "jal\tx%d, %d\n"
+#define JALR_FORMAT "jalr\tx%d, %d(x%d)\n"
+#define AUIPC_FORMAT "auipc\tx%d, %d\n"
 #define BRANCH_FORMAT "%s\tx%d, x%d, %d\n"
 #define ECALL_FORMAT "ecall\n"
+#define CSR_FORMAT "%s\tx%d, 0x%03x, x%d\n"
+#define CSRI_FORMAT "%s\tx%d, 0x%03x, %d\n"
 #define CACHE_EVICTION_FORMAT "[MEM]: Cache eviction for address: 0x%.8llx\n"
 #define CACHE_HIT_FORMAT "[MEM]: Cache hit for address: 0x%.8llx\n"
 #define CACHE_MISS_FORMAT "[MEM]: Cache miss for address: 0x%.8llx\n"
@@ -19,8 +24,19 @@ int sign_extend_number(unsigned, unsigned);
 int get_branch_offset(Instruction);
 int get_jump_offset(Instruction);
 int get_store_offset(Instruction);
+Word muldiv_result(unsigned int, Word, Word);
 void handle_invalid_instruction(Instruction);
 void handle_invalid_read(Address);
 void handle_invalid_write(Address);
 
+// prints what made a bad read or write, after its report line, when set
+extern void (*invalid_access_detail)(void);
+
+// allocate, or end the simulation naming what the memory was for
+void* checked_calloc(size_t count, size_t size, const char* what);
+void* checked_realloc(void* ptr, size_t size, const char* what);
+
+// calls close_fn at exit, once however often it's registered
+void close_at_exit(void (*close_fn)(void));
+
 #endif // __UTILS_H__